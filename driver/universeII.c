@@ -33,6 +33,15 @@
 #include <linux/delay.h>
 #include <linux/sched.h>
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define UNIVERSEII_URING_CMD
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#endif
+
 #include "universeII.h"
 #include "vmeioctl.h"
 
@@ -91,12 +100,20 @@ MODULE_PARM_DESC(img_ovl, "  Set to 0 to forbid overlapping images. Default: All
 // Prototypes
 //----------------------------------------------------------------------------
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+typedef unsigned int __poll_t;
+#endif
+
 static int universeII_open(struct inode*, struct file*);
 static int universeII_release(struct inode*, struct file*);
 static ssize_t universeII_read(struct file *, char __user *, size_t, loff_t *);
 static ssize_t universeII_write(struct file *, const char __user *, size_t, loff_t *);
 static long universeII_ioctl(struct file*, unsigned int, unsigned long);
 static int universeII_mmap(struct file*, struct vm_area_struct*);
+static __poll_t universeII_poll(struct file*, poll_table*);
+#ifdef UNIVERSEII_URING_CMD
+static int universeII_uring_cmd(struct io_uring_cmd*, unsigned int);
+#endif
 
 /*
  * _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
@@ -113,6 +130,10 @@ static struct file_operations universeII_fops = {
     .read = universeII_read,
     .write = universeII_write,
     .unlocked_ioctl = universeII_ioctl,
+#ifdef UNIVERSEII_URING_CMD
+    .uring_cmd = universeII_uring_cmd,
+#endif
+    .poll = universeII_poll,
     .mmap = universeII_mmap
 };
 
@@ -164,6 +185,7 @@ static const int mbx[4] = { MAILBOX0, MAILBOX1, MAILBOX2, MAILBOX3 };
 #define PCI_BUF_SIZE  0x20000            // Size of one slave image buffer
 #define DMA_ACTIVE_TIMEOUT HZ            // 1s is the maximum time the
 // DMA is allowed to be active
+#define BATCH_LOCK_OPS  16               // accesses of a batch per vme_lock
 
 static struct pci_dev *universeII_dev = NULL;
 #ifdef VMIC
@@ -173,6 +195,7 @@ static struct pci_dev *vmic_dev = NULL;
 // Tundra chip and image internal handling addresses
 
 static void __iomem *baseaddr = 0;// Base address of Tundra chip
+static unsigned long baseaddrPhys = 0;  // PCI address of Tundra registers
 
 static void __iomem *dmaBuf = 0;// DMA buf address in kernel space
 static dma_addr_t dmaHandle = 0;
@@ -182,6 +205,13 @@ static unsigned int dma_dctl;            // DCTL register for DMA
 static int dma_in_use = 0;
 static int dma_blt_berr = 0;            // for DMA BLT until BERR
 
+// Asynchronous DMA transfer, started by IOCTL_DMA_START_xxx
+static int dma_async = 0;                // transfer started, result not fetched
+static volatile int dma_async_done = 0;  // transfer finished or timed out
+static int dma_async_write;
+static int dma_async_offset;
+static dma_param_t dma_async_param;
+
 // All image related information like start address, end address, ...
 static image_desc_t image[18];
 
@@ -214,6 +244,12 @@ static DEFINE_SPINLOCK( vme_lock);
 static DEFINE_SPINLOCK( dma_lock);
 static DEFINE_SPINLOCK( mbx_lock);
 
+// Serializes use of the DMA engine (single and chained transfers)
+static DEFINE_MUTEX( dma_mutex);
+
+// Keeps the mapping of images (vBase, size) while a batch uses them
+static DEFINE_MUTEX( image_mutex);
+
 // Autoprobing 
 static int __init universeII_init(void);
 static int universeII_probe(struct pci_dev*, const struct pci_device_id*);
@@ -262,6 +298,8 @@ static void DMA_timeout(unsigned long ptr)
 static void DMA_timeout(struct timer_list *t)
 #endif
 {
+  if (dma_async)
+    dma_async_done = 1;
   wake_up_interruptible(&dmaWait);
   statistics.timeouts++;
 }
@@ -359,7 +397,11 @@ static irqreturn_t irq_handler(int irq, void *dev_id)
 
   // DMA interrupt
   if (status & 0x0100)
+  {
+    if (dma_async)
+      dma_async_done = 1;
     wake_up_interruptible(&dmaWait);
+  }
 
   // mailbox interrupt
   if (status & 0xF0000)
@@ -619,6 +661,343 @@ static void execDMA(u32 chain)
   finish_wait(&dmaWait, &wait);
 }
 
+//----------------------------------------------------------------------------
+//
+//  setupDMA()     Check parameters and write DMA registers of a single
+//                 transfer. Returns offset of data in DMA buffer, -2 on
+//                 invalid parameters, -3 if the DMA engine is busy.
+//                 dma_mutex must be held.
+//
+//----------------------------------------------------------------------------
+static int setupDMA(dma_param_t *dmaParam, int write)
+{
+  int offset = 0;
+  unsigned int pci;
+
+  if (dmaBufSize * dmaParam->bufNr + dmaParam->count > PCI_BUF_SIZE)
+  {
+    printk("%s: DMA operation exceeds DMA buffer size!", driver_name);
+    return -2;
+  }
+
+  pci = dmaHandle + dmaBufSize * dmaParam->bufNr;
+
+  if ((pci < dmaHandle) || (pci + dmaParam->count > dmaHandle + PCI_BUF_SIZE))
+    return -2;
+
+  // Check that DMA is idle
+  if (dma_async || (readl(baseaddr + DGCS) & 0x00008000))
+  {
+    printk("%s: DMA device is not idle!\n", driver_name);
+    return -3;
+  }
+
+  dma_dctl = dmaParam->dma_ctl | dmaParam->vas | dmaParam->vdw;
+  if (write)
+    dma_dctl |= 0x80000000;
+
+  writel(dma_dctl, baseaddr + DCTL);          // Setup Control Reg
+  writel(dmaParam->count, baseaddr + DTBC);   // Count
+  writel(dmaParam->addr, baseaddr + DVA);     // VME Address
+
+  // lower 3 bits of VME and PCI address must be identical,
+  if ((pci & 0x7) == (dmaParam->addr & 0x7))
+    writel(pci, baseaddr + DLA);              // PCI address
+  else
+  {
+    offset = (((dmaParam->addr & 0x7) + 0x8) - (pci & 0x7)) & 0x7;
+    writel(pci + offset, baseaddr + DLA);
+  }
+
+  return offset;
+}
+
+//----------------------------------------------------------------------------
+//
+//  finishDMA()    Check and clear errors of a finished single transfer
+//
+//----------------------------------------------------------------------------
+static int finishDMA(dma_param_t *dmaParam, int write)
+{
+  int res = testAndClearDMAErrors();
+
+  if (!write && dma_blt_berr && (res == 0x200))
+  {
+    // DMA BLT until VME BERR is valild (but bad practice)
+    // If we read something before the BERR, it's a success.
+    if (dmaParam->count > readl(baseaddr + DTBC))
+      res = 0;
+  }
+
+  return res;
+}
+
+//----------------------------------------------------------------------------
+//
+//  doDMA()     Setup, start and wait for a single DMA transfer
+//
+//----------------------------------------------------------------------------
+static int doDMA(dma_param_t *dmaParam, int write)
+{
+  int offset, res;
+
+  mutex_lock(&dma_mutex);
+
+  offset = setupDMA(dmaParam, write);
+  if (offset < 0)
+  {
+    mutex_unlock(&dma_mutex);
+    return (offset == -3) ? -EBUSY : offset;
+  }
+
+  execDMA(0);                                 // Start and wait for DMA
+
+  res = finishDMA(dmaParam, write);
+
+  mutex_unlock(&dma_mutex);
+
+  if (res)
+    return -1;
+
+  return offset;
+}
+
+//----------------------------------------------------------------------------
+//
+//  abortDMA()     Stop an asynchronous transfer whose result will not be
+//                 fetched. dma_mutex must be held.
+//
+//----------------------------------------------------------------------------
+static void abortDMA(void)
+{
+  if (!dma_async)
+    return;
+
+  del_timer_sync(&DMA_timer);
+  if (readl(baseaddr + DGCS) & 0x00008000)
+    writel(0x40000000, baseaddr + DGCS);  // stop DMA
+  testAndClearDMAErrors();
+  dma_async = 0;
+}
+
+//----------------------------------------------------------------------------
+//
+//  startDMA()     Start a single DMA transfer without waiting for it.
+//                 Completion is signalled by poll() on the DMA device,
+//                 the result is fetched by IOCTL_DMA_RESULT.
+//
+//----------------------------------------------------------------------------
+static int startDMA(dma_param_t *dmaParam, int write)
+{
+  int offset;
+
+  mutex_lock(&dma_mutex);
+
+  offset = setupDMA(dmaParam, write);
+  if (offset < 0)
+  {
+    mutex_unlock(&dma_mutex);
+    return offset;
+  }
+
+  dma_async_param = *dmaParam;
+  dma_async_write = write;
+  dma_async_offset = offset;
+  dma_async_done = 0;
+  dma_async = 1;
+
+  DMA_timer.expires = jiffies + DMA_ACTIVE_TIMEOUT;  // timeout DMA transfer
+  add_timer(&DMA_timer);
+
+  writel(0x80006F0F, baseaddr + DGCS);    // Start DMA, clear errors
+                                          // and enable all DMA irqs
+  mutex_unlock(&dma_mutex);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//
+//  execCmdPktList()  Returns 0, number of the first unprocessed packet,
+//                    -1 for an invalid list, -2 on DMA error, -3 if the
+//                    DMA engine is busy
+//
+//----------------------------------------------------------------------------
+static int execCmdPktList(unsigned long list)
+{
+  int n = 0;
+  u32 val;
+  struct kcp *scan;
+
+  if ((list > 255) || (cpLists[list].commandPacket == NULL))
+    return -1;
+
+  mutex_lock(&dma_mutex);
+
+  // Check that DMA is idle
+  val = readl(baseaddr + DGCS);
+  if (dma_async || (val & 0x00008000))
+  {
+    mutex_unlock(&dma_mutex);
+    printk("%s: Can't execute list %ld! DMA status = "
+        "%08x!\n", driver_name, list, val);
+    return -3;
+  }
+
+  writel(0, baseaddr + DTBC);              // clear DTBC register
+  writel(cpLists[list].start, baseaddr + DCPP);
+
+  execDMA(0x08000000);                     // Enable chained mode
+
+  val = testAndClearDMAErrors();           // Check for DMA errors
+  mutex_unlock(&dma_mutex);
+
+  if (val)
+    return -2;
+
+  // Check that all command packets have been processed properly
+
+  scan = cpLists[list].commandPacket;
+  while (scan != NULL)
+  {
+    n++;
+    if (!(scan->dcp.dcpp & 0x00000002))
+    {
+      printk("%s: Processed bit of packet number "
+          "%d is not set!\n", driver_name, n);
+      return n;
+    }
+    scan = scan->next;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//
+//  execBatch()
+//
+//----------------------------------------------------------------------------
+static long execBatch(unsigned long arg)
+{
+  unsigned int i;
+  int berr = 0, res;
+  batch_param_t bParam;
+  batch_op_t *ops, *op;
+  void __iomem *ptr;
+
+  res = copy_from_user(&bParam, (char __user *) arg, sizeof(bParam));
+  if (res)
+  {
+    printk("%s: Line %d  copy_from_user returned %02d", driver_name, __LINE__, res);
+    return -1;
+  }
+  if ((bParam.count < 1) || (bParam.count > BATCH_MAX_OPS))
+    return -1;
+
+  ops = kmalloc(bParam.count * sizeof(*ops), GFP_KERNEL);
+  if (ops == NULL)
+    return -ENOMEM;
+
+  res = copy_from_user(ops, (char __user *) (unsigned long) bParam.ops, bParam.count * sizeof(*ops));
+  if (res)
+  {
+    printk("%s: Line %d  copy_from_user returned %02d", driver_name, __LINE__, res);
+    kfree(ops);
+    return -1;
+  }
+
+  // Check all accesses before touching the bus. The images are opened
+  // by other file handles, image_mutex keeps them mapped until the end.
+
+  mutex_lock(&image_mutex);
+
+  for (i = 0; i < bParam.count; i++)
+  {
+    op = &ops[i];
+    if ((op->image < 0) || (op->image >= MAX_IMAGE) ||
+        (!image[op->image].okToWrite) || (image[op->image].vBase == NULL) ||
+        ((op->width != 1) && (op->width != 2) && (op->width != 4)) ||
+        (op->offset > image[op->image].size) ||
+        (image[op->image].size - op->offset < op->width))
+    {
+      mutex_unlock(&image_mutex);
+      printk("%s: IOCTL_EXEC_BATCH: Invalid access %d!\n", driver_name, i);
+      kfree(ops);
+      return -2;
+    }
+  }
+
+  // Execute batch, vme_lock is released every BATCH_LOCK_OPS accesses.
+  // Stop at first bus error.
+
+  spin_lock(&vme_lock);
+
+  if (testAndClearBERR())
+    printk("%s: Resetting previous uncleared bus error!\n", driver_name);
+
+  for (i = 0; i < bParam.count; i++)
+  {
+    op = &ops[i];
+    ptr = image[op->image].vBase + op->offset;
+
+    if (i && !(i % BATCH_LOCK_OPS))
+    {
+      spin_unlock(&vme_lock);
+      cond_resched();
+      spin_lock(&vme_lock);
+    }
+
+    switch (op->width)
+    {
+    case 1:
+      if (op->write)
+        writeb(op->data, ptr);
+      else
+        op->data = readb(ptr);
+      break;
+    case 2:
+      if (op->write)
+        writew(op->data, ptr);
+      else
+        op->data = readw(ptr);
+      break;
+    case 4:
+      if (op->write)
+        writel(op->data, ptr);
+      else
+        op->data = readl(ptr);
+      break;
+    }
+
+    berr = testAndClearBERR();
+    if (berr)
+      break;
+  }
+
+  spin_unlock(&vme_lock);
+  mutex_unlock(&image_mutex);
+
+  bParam.berr = berr ? (int) i : -1;
+
+  res = copy_to_user((char __user *) (unsigned long) bParam.ops, ops, bParam.count * sizeof(*ops));
+  kfree(ops);
+  if (res)
+  {
+    printk("%s: Line %d  copy_to_user returned %02d", driver_name, __LINE__, res);
+    return -1;
+  }
+
+  res = copy_to_user((char __user *) arg, &bParam, sizeof(bParam));
+  if (res)
+  {
+    printk("%s: Line %d  copy_to_user returned %02d", driver_name, __LINE__, res);
+    return -1;
+  }
+
+  return 0;
+}
+
 //----------------------------------------------------------------------------
 //
 //  universeII_read()
@@ -627,8 +1006,8 @@ static void execDMA(u32 chain)
 static ssize_t universeII_read(struct file *file, char __user *buf,
     size_t count, loff_t *ppos)
 {
-  int i = 0, okcount = 0, offset = 0, berr = 0;
-  unsigned int dw, pci = 0;
+  int i = 0, okcount = 0, berr = 0;
+  unsigned int dw;
   char *temp = buf;
   int res=0;
 
@@ -660,53 +1039,7 @@ static ssize_t universeII_read(struct file *file, char __user *buf,
       printk("%s: Line %d  __copy_from_user returned %02d", driver_name, __LINE__, res);
       return -1;
     }
-    if (dmaBufSize * dmaParam.bufNr + dmaParam.count > PCI_BUF_SIZE)
-    {
-      printk("%s: DMA operation exceeds DMA buffer size!", driver_name);
-      return -1;
-    }
-
-    dma_dctl = dmaParam.dma_ctl | dmaParam.vas | dmaParam.vdw;
-    pci = dmaHandle + dmaBufSize * dmaParam.bufNr;
-
-    if ((pci < dmaHandle) || (pci + dmaParam.count > dmaHandle + PCI_BUF_SIZE))
-      return -2;
-
-    // Check that DMA is idle
-    if (readl(baseaddr + DGCS) & 0x00008000)
-    {
-      printk("%s: DMA device is not idle!\n", driver_name);
-      return 0;
-    }
-
-    writel(dma_dctl, baseaddr + DCTL);          // Setup Control Reg
-    writel(dmaParam.count, baseaddr + DTBC);// Count
-    writel(dmaParam.addr, baseaddr + DVA);// VME Address
-
-    // lower 3 bits of VME and PCI address must be identical,
-    if ((pci & 0x7) == (dmaParam.addr & 0x7))
-      writel(pci, baseaddr + DLA);// PCI address
-    else
-    {
-      offset = (((dmaParam.addr & 0x7) + 0x8) - (pci & 0x7)) & 0x7;
-      writel(pci + offset, baseaddr + DLA);
-    }
-
-    execDMA(0);                          // Start and wait for DMA
-
-    res = testAndClearDMAErrors();
-    if (dma_blt_berr && (res == 0x200))
-    {
-      // DMA BLT until VME BERR is valild (but bad practice)
-      // If we read something before the BERR, it's a success.
-      if (dmaParam.count > readl(baseaddr + DTBC))
-        res = 0;
-    }
-    if (res)
-      okcount = -1;
-    else
-      okcount = offset;
-
+    okcount = doDMA(&dmaParam, 0);
     break;
 
     default:
@@ -813,8 +1146,8 @@ static ssize_t universeII_read(struct file *file, char __user *buf,
 static ssize_t universeII_write(struct file *file, const char __user *buf,
     size_t count, loff_t *ppos)
 {
-  int i = 0, okcount = 0, offset = 0, berr = 0, res = 0;
-  unsigned int dw, pci = 0;
+  int i = 0, okcount = 0, berr = 0, res = 0;
+  unsigned int dw;
   char *temp = (char *) buf;
 
   u8 vc;          // 8 bit transfers
@@ -845,47 +1178,7 @@ static ssize_t universeII_write(struct file *file, const char __user *buf,
       printk("%s: Line %d  __copy_from_user returned %02d", driver_name, __LINE__, res);
       return -1;
     }
-    if (dmaBufSize * dmaParam.bufNr + dmaParam.count > PCI_BUF_SIZE)
-    {
-      printk("%s: DMA operation exceeds DMA buffer size!", driver_name);
-      return -1;
-    }
-
-    dma_dctl = dmaParam.dma_ctl | dmaParam.vas | dmaParam.vdw;
-    pci = dmaHandle + dmaBufSize * dmaParam.bufNr;
-
-    if ((pci < dmaHandle) || (pci + dmaParam.count > dmaHandle + PCI_BUF_SIZE))
-      return -2;
-
-    // Check that DMA is idle
-    if (readl(baseaddr + DGCS) & 0x00008000)
-    {
-      printk("%s: DMA device is not idle!\n", driver_name);
-      return 0;
-    }
-
-    writel(0x80000000 | dma_dctl, baseaddr + DCTL);  // Setup Control Reg
-    writel(dmaParam.count, baseaddr + DTBC);// Count
-    writel(dmaParam.addr, baseaddr + DVA);// VME address
-
-    // lower 3 bits of VME and PCI address must be identical,
-    if ((pci & 0x7) == (dmaParam.addr & 0x7))
-    {
-      writel(pci, baseaddr + DLA);// PCI address
-    }
-    else
-    {
-      offset = (((dmaParam.addr & 0x7) + 0x8) - (pci & 0x7)) & 0x7;
-      writel(pci + offset, baseaddr + DLA);
-    }
-
-    execDMA(0);                          // Start and wait for DMA
-
-    if (testAndClearDMAErrors())// Check for DMA errors
-      okcount = -1;
-    else
-      okcount = offset;
-
+    okcount = doDMA(&dmaParam, 1);
     break;
 
     default:
@@ -1032,7 +1325,20 @@ static int universeII_mmap(struct file *file, struct vm_area_struct *vma)
     vma->vm_pgoff = p->buffer >> PAGE_SHIFT;
   }
 
-  if ((minor == CONTROL_MINOR) || (minor > MAX_MINOR))
+  if (minor == CONTROL_MINOR)
+  {                    // universeII registers, used for BERR checks
+    if (vma->vm_end - vma->vm_start > PAGE_SIZE)
+    {
+      printk("%s mmap: INVALID, start at 0x%08lx end "
+          "0x%08lx\n", driver_name, vma->vm_start, vma->vm_end);
+      return -EINVAL;
+    }
+
+    vma->vm_pgoff = baseaddrPhys >> PAGE_SHIFT;
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+  }
+
+  if (minor > MAX_MINOR)
     return -EBADF;
 
   if (remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff,
@@ -1047,6 +1353,29 @@ static int universeII_mmap(struct file *file, struct vm_area_struct *vma)
   return 0;
 }
 
+//----------------------------------------------------------------------------
+//
+//  universeII_poll()     DMA device is readable when an asynchronous
+//                        transfer has finished, other devices are always
+//                        ready
+//
+//----------------------------------------------------------------------------
+static __poll_t universeII_poll(struct file *file, poll_table *wait)
+{
+  unsigned int minor = MINOR(file_inode(file)->i_rdev);
+  __poll_t mask = 0;
+
+  if (minor != DMA_MINOR)
+    return DEFAULT_POLLMASK;            // as without a poll method
+
+  poll_wait(file, &dmaWait, wait);
+
+  if (dma_async && dma_async_done)
+    mask |= POLLIN | POLLRDNORM;
+
+  return mask;
+}
+
 //----------------------------------------------------------------------------
 //
 //  universeII_open()
@@ -1086,6 +1415,8 @@ static int universeII_release(struct inode *inode, struct file *file)
   unsigned int minor = MINOR(inode->i_rdev);
   int i, j;
 
+  mutex_lock(&image_mutex);               // wait for batches using the image
+
   if (image[minor].vBase != NULL)
   {
     iounmap(image[minor].vBase);
@@ -1104,6 +1435,15 @@ static int universeII_release(struct inode *inode, struct file *file)
   image[minor].phys_end = 0;
   image[minor].size = 0;
 
+  mutex_unlock(&image_mutex);
+
+  if (minor == DMA_MINOR)
+  {    // nobody is left to fetch the result of an asynchronous transfer
+    mutex_lock(&dma_mutex);
+    abortDMA();
+    mutex_unlock(&dma_mutex);
+  }
+
   if ((minor > 9) && (minor < 18))
   {    // Slave image
     image[minor].buffer = 0;
@@ -1255,6 +1595,8 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
 
     spin_unlock(&set_image_lock);
 
+    mutex_lock(&image_mutex);
+
     image[minor].phys_start = readl(baseaddr + aBS[minor]);
     image[minor].phys_end = readl(baseaddr + aBD[minor]);
     image[minor].size = image[minor].phys_end -
@@ -1273,10 +1615,13 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
         release_resource(&image[minor].masterRes);
         memset(&image[minor].masterRes, 0, sizeof(image[minor].masterRes));
       }
+      mutex_unlock(&image_mutex);
       printk("%s: IOCTL_SET_IMAGE, Error in ioremap!\n", driver_name);
       return -7;
     }
 
+    mutex_unlock(&image_mutex);
+
     break;
   }
 
@@ -1692,45 +2037,8 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
   }
 
   case IOCTL_EXEC_DCP:
-  {
-    int n = 0;
-    u32 val;
-    struct kcp *scan;
-
-    // Check that DMA is idle
-    val = readl(baseaddr + DGCS);
-    if (val & 0x00008000)
-    {
-      printk("%s: Can't execute list %ld! DMA status = "
-          "%08x!\n", driver_name, arg, val);
-      return -1;
-    }
-
-    writel(0, baseaddr + DTBC);              // clear DTBC register
-    writel(cpLists[arg].start, baseaddr + DCPP);
-
-    execDMA(0x08000000);                     // Enable chained mode
-
-    if (testAndClearDMAErrors())             // Check for DMA errors
-      return -2;
-
-    // Check that all command packets have been processed properly
-
-    scan = cpLists[arg].commandPacket;
-    while (scan != NULL)
-    {
-      n++;
-      if (!(scan->dcp.dcpp & 0x00000002))
-      {
-        printk("%s: Processed bit of packet number "
-            "%d is not set!\n", driver_name, n);
-        return n;
-      }
-      scan = scan->next;
-    }
-
+    return execCmdPktList(arg);
     break;
-  }
 
   case IOCTL_DEL_DCL:
   {
@@ -1814,6 +2122,10 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
     break;
   }
 
+  case IOCTL_EXEC_BATCH:
+    return execBatch(arg);
+    break;
+
   case IOCTL_TEST_BERR:
   {
     int berr;
@@ -1850,6 +2162,10 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
 
   case IOCTL_RELEASE_DMA:
   {
+    mutex_lock(&dma_mutex);
+    abortDMA();
+    mutex_unlock(&dma_mutex);
+
     dma_in_use = 0;
     dma_blt_berr = 0;
     break;
@@ -1861,6 +2177,59 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
     break;
   }
 
+  case IOCTL_DMA_START_READ:
+  case IOCTL_DMA_START_WRITE:
+  {
+    dma_param_t dmaParam;
+
+    res = copy_from_user(&dmaParam, (char*) arg, sizeof(dmaParam));
+    if (res)
+    {
+      printk("%s: Line %d  copy_from_user returned %02d", driver_name, __LINE__, res);
+      return -1;
+    }
+
+    return startDMA(&dmaParam, cmd == IOCTL_DMA_START_WRITE);
+    break;
+  }
+
+  case IOCTL_DMA_RESULT:
+  {
+    dma_result_t result;
+
+    mutex_lock(&dma_mutex);
+
+    if (!dma_async)
+    {
+      mutex_unlock(&dma_mutex);
+      return -1;                      // no transfer started
+    }
+
+    if (!dma_async_done)
+    {
+      mutex_unlock(&dma_mutex);
+      return 1;                       // transfer still running
+    }
+
+    del_timer(&DMA_timer);
+
+    result.status = finishDMA(&dma_async_param, dma_async_write) ? -1 : 0;
+    result.offset = dma_async_offset;
+    result.count = dma_async_param.count - readl(baseaddr + DTBC);
+    dma_async = 0;
+
+    mutex_unlock(&dma_mutex);
+
+    res = copy_to_user((char*) arg, &result, sizeof(result));
+    if (res)
+    {
+      printk("%s: Line %d  copy_to_user returned %02d", driver_name, __LINE__, res);
+      return -1;
+    }
+
+    break;
+  }
+
   case IOCTL_VMESYSRST:
   {
     writel(readl(baseaddr + MISC_CTL) | 0x400000, baseaddr + MISC_CTL);
@@ -1925,6 +2294,8 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
 
     // free all images
 
+    mutex_lock(&image_mutex);
+
     for (i = 0; i < MAX_IMAGE; i++)
     {
       writel(0x00800000, baseaddr + aCTL[i]);
@@ -1946,6 +2317,8 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
       image[i].okToWrite = 0;
     }
 
+    mutex_unlock(&image_mutex);
+
     // reset all counters
 
     statistics.reads = 0;
@@ -1968,6 +2341,68 @@ static long universeII_ioctl(struct file *file, unsigned int cmd,
   return 0;
 }
 
+#ifdef UNIVERSEII_URING_CMD
+//----------------------------------------------------------------------------
+//
+//  universeII_uring_cmd()
+//
+//----------------------------------------------------------------------------
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define uring_cmd_payload(ioucmd) ((const uring_cmd_t *) io_uring_sqe_cmd((ioucmd)->sqe))
+#else
+#define uring_cmd_payload(ioucmd) ((const uring_cmd_t *) (ioucmd)->cmd)
+#endif
+
+static int universeII_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+  int res;
+  dma_param_t dmaParam;
+  unsigned long arg = (unsigned long) uring_cmd_payload(ioucmd)->arg;
+
+  // All commands wait for the bus or the DMA engine. Let io_uring issue
+  // them again from a worker thread, so the submitting thread continues.
+  if (issue_flags & IO_URING_F_NONBLOCK)
+    return -EAGAIN;
+
+  statistics.ioctls++;
+  switch (ioucmd->cmd_op)
+  {
+  case URING_DMA_READ:
+  case URING_DMA_WRITE:
+    res = copy_from_user(&dmaParam, (char __user *) arg, sizeof(dmaParam));
+    if (res)
+    {
+      printk("%s: Line %d  copy_from_user returned %02d", driver_name, __LINE__, res);
+      return -EFAULT;
+    }
+    res = doDMA(&dmaParam, ioucmd->cmd_op == URING_DMA_WRITE);
+    if (res == -1)
+      return -EIO;                       // bus or DMA error
+    if (res == -2)
+      return -EINVAL;
+    return res;                          // offset or -EBUSY
+
+  case IOCTL_EXEC_DCP:
+    res = execCmdPktList(arg);
+    if (res == -1)
+      return -EINVAL;
+    if (res == -2)
+      return -EIO;
+    if (res == -3)
+      return -EBUSY;
+    return res;
+
+  case IOCTL_EXEC_BATCH:
+    res = execBatch(arg);
+    if ((res == -1) || (res == -2))
+      return -EINVAL;
+    return res;                          // 0 or -ENOMEM
+  }
+
+  return -ENOTTY;
+}
+#endif
+
 //----------------------------------------------------------------------------
 //
 //  cleanup_module()
@@ -1989,6 +2424,7 @@ static void universeII_remove(struct pci_dev *pdev)
   writel(0, baseaddr + LINT_EN);  // Turn off Ints
   //pcivector = readl(baseaddr + PCI_MISC1) & 0x000000FF;
   free_irq(universeII_dev->irq, universeII_dev);   // Free Vector
+  del_timer_sync(&DMA_timer);
 
   for (i = 1; i < MAX_IMAGE + 1; i++)
     if (image[i].vBase != NULL)
@@ -2111,6 +2547,7 @@ static int universeII_probe(struct pci_dev *pdev, const struct pci_device_id *id
     return -2;
   }
   ba = pci_resource_start(universeII_dev, 0); //BAR 0 is the BS register at PCI_BS
+  baseaddrPhys = ba;
   baseaddr = (void __iomem *) ioremap(ba, 4096);
   if (!baseaddr)
   {
@@ -43,6 +43,9 @@
 #define IOCTL_REQUEST_DMA  0xF201
 #define IOCTL_RELEASE_DMA  0xF202
 #define IOCTL_DMA_BLT_BERR 0xF203
+#define IOCTL_DMA_START_READ   0xF204
+#define IOCTL_DMA_START_WRITE  0xF205
+#define IOCTL_DMA_RESULT       0xF206
 
 
 /* Defines for DMA linked list operations */
@@ -58,6 +61,18 @@
 #define IOCTL_RELEASE_MBX  0xF403
 
 
+/* Batched single accesses */
+#define IOCTL_EXEC_BATCH   0xF501
+
+#define BATCH_MAX_OPS      256     // max. number of accesses per ioctl
+
+
+/* Commands for io_uring passthrough (IORING_OP_URING_CMD).
+   IOCTL_EXEC_DCP and IOCTL_EXEC_BATCH are supported as well. */
+#define URING_DMA_READ     0xF601
+#define URING_DMA_WRITE    0xF602
+
+
 /* Misc. */
 #define IOCTL_TEST_ADDR    0xF901
 #define IOCTL_TEST_BERR    0xF902
@@ -86,6 +101,14 @@ typedef struct
 } dma_param_t;
 
 
+typedef struct
+{
+  int status;                // 0: ok, -1: DMA error or timeout
+  int offset;                // offset of data in DMA buffer
+  unsigned int count;        // number of bytes transferred
+} dma_result_t;
+
+
 typedef struct
 {
   unsigned int dctl;
@@ -120,4 +143,28 @@ typedef struct
   unsigned int mode;
 } there_data_t;
 
+
+typedef struct
+{
+  unsigned long long arg;    // command payload: ioctl argument or address
+} uring_cmd_t;               // of dma_param_t for URING_DMA_READ/WRITE
+
+
+typedef struct
+{
+  int image;                 // master image 0..7
+  unsigned int offset;       // offset within image
+  unsigned int width;        // 1, 2 or 4 byte(s)
+  int write;                 // 1: write 'data', 0: read into 'data'
+  unsigned int data;
+} batch_op_t;
+
+
+typedef struct
+{
+  unsigned long long ops;    // user space address of batch_op_t array
+  unsigned int count;        // number of accesses, max. BATCH_MAX_OPS
+  int berr;                  // index of first bus error, -1 if none
+} batch_param_t;
+
 #endif
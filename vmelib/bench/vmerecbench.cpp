@@ -0,0 +1,169 @@
+/*
+ Benchmark and check of class Recorder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//----------------------------------------------------------------------------
+//  Writes 'MB' MB plus a tail that isn't a multiple of REC_ALIGN through
+//  Recorder::write(), once with O_DIRECT (if the file system has it) and
+//  once through the page cache, and reports MB/s, the writes and the
+//  maximum of writes in flight. Each file is checked: close() must trim
+//  the padding of the last buffer, and the data must read back unchanged.
+//
+//  Build:  g++ -O2 -std=c++11 -I.. -I../../driver -o vmerecbench vmerecbench.cpp
+//              ../vmerecorder.cpp ../vmepipeline.cpp ../vmelib.cpp ../vmering.cpp -lpthread
+//  Usage:  vmerecbench [directory [MB]]
+//----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vmerecorder.h"
+
+using namespace std;
+
+#define CHUNK  (64 * 1024 + 12)     // bytes per write(), not aligned
+#define TAIL   1234                 // bytes after 'MB' MB
+
+// byte 'i' of the file
+
+static inline unsigned char pattern(uint64_t i)
+{
+  return (unsigned char) (i ^ (i >> 8) ^ (i >> 16));
+}
+
+//----------------------------------------------------------------------------
+//  Check size and contents of file 'name'
+//     returns 0 if ok, -1 otherwise
+//----------------------------------------------------------------------------
+static int verify(const char *name, uint64_t size)
+{
+  vector<unsigned char> buf(CHUNK);
+  struct stat st;
+  uint64_t pos = 0;
+  ssize_t n, i;
+  int fd;
+
+  if ((stat(name, &st) != 0) || ((uint64_t) st.st_size != size))
+  {
+    cerr << "vmerecbench: " << name << " has " << st.st_size << " bytes instead of " << size << "!\n";
+    return -1;
+  }
+
+  if ((fd = open(name, O_RDONLY)) < 0)
+    return -1;
+
+  while ((n = read(fd, &buf[0], CHUNK)) > 0)
+  {
+    for (i = 0; i < n; i++)
+      if (buf[i] != pattern(pos + i))
+      {
+        cerr << "vmerecbench: " << name << " differs at byte " << pos + i << "!\n";
+        close(fd);
+        return -1;
+      }
+    pos += n;
+  }
+
+  close(fd);
+  return (pos == size) ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+//  One run, returns 0 if ok, -1 otherwise
+//----------------------------------------------------------------------------
+static int run(const string &name, uint64_t size, bool tryDirect)
+{
+  vector<unsigned char> data(CHUNK + 256);
+  Recorder rec;
+  uint64_t pos;
+  unsigned int n, i;
+
+  if (rec.open(name.c_str(), tryDirect) < 0)
+    return -1;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for (pos = 0; pos < size; pos += n)
+  {
+    n = (size - pos > CHUNK) ? CHUNK : size - pos;
+    for (i = 0; i < n; i++)
+      data[i] = pattern(pos + i);
+
+    if (rec.write(&data[0], n) < 0)
+    {
+      cerr << "vmerecbench: write failed!\n";
+      return -1;
+    }
+  }
+
+  if (rec.close() < 0)
+  {
+    cerr << "vmerecbench: close failed!\n";
+    return -1;
+  }
+
+  double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cout << left << setw(12) << (tryDirect ? "O_DIRECT" : "page cache") << right
+       << setw(8) << (rec.isDirect() ? "yes" : "no") << setw(8) << (rec.usesRing() ? "yes" : "no")
+       << fixed << setprecision(0) << setw(10) << size / t / 1048576
+       << setw(9) << rec.getWrites() << setw(11) << rec.getMaxInFlight() << setw(8) << rec.getStalls();
+
+  if (verify(name.c_str(), size) < 0)
+  {
+    cout << "   FAILED\n";
+    return -1;
+  }
+
+  cout << "   ok\n";
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  string dir = (argc > 1) ? argv[1] : "/tmp";
+  unsigned int mb = (argc > 2) ? atoi(argv[2]) : 256;
+  uint64_t size = (uint64_t) mb * 1048576 + TAIL;
+  string name = dir + "/vmerecbench.dat";
+  int failed = 0;
+
+  if (mb == 0)
+  {
+    cerr << "usage: vmerecbench [directory [MB]]\n";
+    return 1;
+  }
+
+  cout << size << " bytes to " << name << "\n";
+  cout << "mode         direct    ring      MB/s   writes  in flight  stalls\n";
+
+  if (run(name, size, true) < 0)
+    failed++;
+  if (run(name, size, false) < 0)
+    failed++;
+
+  unlink(name.c_str());
+
+  return failed ? 1 : 0;
+}
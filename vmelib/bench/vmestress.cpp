@@ -0,0 +1,194 @@
+/*
+ Stress test of the direct accesses of class VMEBridge
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//----------------------------------------------------------------------------
+//  Runs 1, 2, 4, ... threads doing direct accesses and block copies, each
+//  thread on its own image, and reports the accesses per second. Images
+//  and Universe II registers are simulated by memory (attachImage(),
+//  attachRegisters()), no hardware or driver is needed.
+//
+//  Every access is checked, and a bus error injected into the simulated
+//  PCI_CSR must be reported by the next access and only by that one.
+//
+//  Build:  g++ -O2 -std=c++11 -I.. -I../../driver -o vmestress vmestress.cpp
+//              ../vmelib.cpp ../vmering.cpp -lpthread
+//  Usage:  vmestress [max. threads [seconds per run]]
+//----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmelib.h"
+
+using namespace std;
+
+#define IMAGE_SIZE  0x10000
+#define IMAGE_VME   0x100000      // VME base of image i: i * IMAGE_VME
+#define BLOCK       1024          // bytes of a block copy
+
+#define PCI_CSR     0x0004        // Universe II PCI_CSR register offset
+#define CSR_S_TA    0x08000000    // PCI_CSR: signalled target abort
+
+static volatile uint32_t regs[0x1000 / 4];
+static atomic<bool> running;
+static atomic<unsigned long> failures;
+
+//----------------------------------------------------------------------------
+//  Accesses of one thread to 'image' until 'running' is cleared
+//----------------------------------------------------------------------------
+static void worker(VMEBridge *vme, int image, unsigned long *ops)
+{
+  unsigned int base = image * IMAGE_VME;
+  unsigned int addr, data, pattern, i;
+  unsigned char out[BLOCK], in[BLOCK];
+  unsigned long n = 0;
+
+  for (pattern = image << 24; running.load(memory_order_relaxed); pattern++)
+  {
+    addr = base + ((pattern * 4) % (IMAGE_SIZE - BLOCK));
+
+    if ((vme->wlDirect(image, addr, pattern) != 0) ||
+        (vme->rlDirect(image, addr, &data) != 0) || (data != pattern))
+      failures++;
+    n += 2;
+
+    if ((pattern & 0x3f) == 0)
+    {
+      for (i = 0; i < BLOCK; i++)
+        out[i] = pattern + i;
+
+      if ((vme->copyToWindow(image, addr, out, BLOCK) != 0) ||
+          (vme->copyFromWindow(image, addr, in, BLOCK) != 0) || memcmp(in, out, BLOCK))
+        failures++;
+      n += 2;
+    }
+  }
+
+  *ops = n;
+}
+
+//----------------------------------------------------------------------------
+//  A bus error flagged in PCI_CSR must fail the next access
+//----------------------------------------------------------------------------
+static int checkBerr(VMEBridge &vme)
+{
+  unsigned int data;
+
+  regs[PCI_CSR / 4] = CSR_S_TA;
+  if (vme.rlDirect(0, 0, &data) != -1)
+  {
+    cerr << "vmestress: bus error not reported!\n";
+    return -1;
+  }
+
+  regs[PCI_CSR / 4] = 0;          // memory doesn't clear on write of 1
+
+  if (vme.rlDirect(0, 0, &data) != 0)
+  {
+    cerr << "vmestress: bus error reported twice!\n";
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int maxThreads = (argc > 1) ? atoi(argv[1]) : 8;
+  double seconds = (argc > 2) ? atof(argv[2]) : 1.0;
+  vector<unsigned char *> mem(8);
+  ostringstream log;
+  int i, n;
+
+  if ((maxThreads < 1) || (seconds <= 0))
+  {
+    cerr << "usage: vmestress [max. threads [seconds per run]]\n";
+    return 1;
+  }
+
+  VMEBridge vme;                   // fails to open the driver, that's fine
+  vme.setErrorlog(&log);
+  vme.attachRegisters((uintptr_t) regs);
+
+  for (i = 0; i < 8; i++)
+  {
+    mem[i] = (unsigned char *) calloc(IMAGE_SIZE, 1);
+    if (vme.attachImage(i, (uintptr_t) mem[i], i * IMAGE_VME, IMAGE_SIZE, D32) < 0)
+    {
+      cerr << "vmestress: can't attach image " << i << "!\n";
+      return 1;
+    }
+  }
+
+  if (checkBerr(vme) < 0)
+    return 1;
+
+  cout << "threads     accesses/s   per thread\n";
+
+  for (n = 1; n <= maxThreads; n *= 2)
+  {
+    vector<unsigned long> ops(n);
+    vector<thread> threads;
+
+    running = true;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (i = 0; i < n; i++)
+      threads.push_back(thread(worker, &vme, i % 8, &ops[i]));
+
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    running = false;
+
+    unsigned long total = 0;
+    for (i = 0; i < n; i++)
+    {
+      threads[i].join();
+      total += ops[i];
+    }
+
+    double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << setw(7) << n << setw(15) << (unsigned long) (total / t)
+         << setw(13) << (unsigned long) (total / t / n) << endl;
+  }
+
+  if (checkBerr(vme) < 0)
+    return 1;
+
+  for (i = 0; i < 8; i++)
+  {
+    vme.attachImage(i, 0, 0, 0);
+    free(mem[i]);
+  }
+  vme.attachRegisters(0);
+
+  if (failures)
+  {
+    cerr << "vmestress: " << failures << " failed accesses!\n";
+    return 1;
+  }
+
+  cout << "all accesses ok\n";
+  return 0;
+}
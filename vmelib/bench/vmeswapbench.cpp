@@ -0,0 +1,268 @@
+/*
+ Benchmark and check of the byte swap and unpack functions
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//----------------------------------------------------------------------------
+//  Selects the scalar, SSE2 and AVX2 kernels in turn by vmeSwapSelect(),
+//  checks their results against a plain reference and reports MB/s of
+//  the source data. All lengths from 0 to 67 and unaligned buffers are
+//  checked to cover the scalar tails of the vector loops. Levels the CPU
+//  doesn't support are skipped.
+//
+//  Build:  g++ -O2 -std=c++11 -I.. -o vmeswapbench vmeswapbench.cpp ../vmeswap.cpp
+//  Usage:  vmeswapbench [MB of data [repetitions]]
+//----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmeswap.h"
+
+using namespace std;
+
+static const char *levelName[] = {"scalar", "sse2", "avx2"};
+
+static uint32_t load(const unsigned char *p)
+{
+  uint32_t l;
+
+  memcpy(&l, p, 4);
+  return l;
+}
+
+//----------------------------------------------------------------------------
+//  Reference results
+//----------------------------------------------------------------------------
+static void refSwap16(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++)
+  {
+    dst[2 * i] = src[2 * i + 1];
+    dst[2 * i + 1] = src[2 * i];
+  }
+}
+
+static void refSwap32(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  for (unsigned int i = 0; i < n; i++)
+  {
+    dst[4 * i] = src[4 * i + 3];
+    dst[4 * i + 1] = src[4 * i + 2];
+    dst[4 * i + 2] = src[4 * i + 1];
+    dst[4 * i + 3] = src[4 * i];
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Big endian CAEN events of 0..32 data words, some invalid words
+//----------------------------------------------------------------------------
+static void makeEvents(unsigned char *p, unsigned int n)
+{
+  unsigned int i = 0, k, count = 0;
+  uint32_t w;
+
+  while (i < n)
+  {
+    w = (2 << 24);                                      // header
+    for (k = rand() % 33; i < n; k--, i++)
+    {
+      if (k == 0)
+        w = (4 << 24) | (count++ & 0xFFFFFF);           // trailer
+      else if ((rand() % 1000) == 0)
+        w = (6 << 24) | (rand() & 0xFFFF);              // invalid
+      else if (w >> 24 != 2)
+        w = ((rand() % 32) << 16) | (rand() & 0x3FFF);  // data
+
+      w = __builtin_bswap32(w);
+      memcpy(p + 4 * i, &w, 4);
+      w = 0;
+
+      if (k == 0)
+      {
+        i++;
+        break;
+      }
+    }
+  }
+}
+
+struct Unpacked
+{
+  vector<unsigned int> channel, value, event, counter;
+  VMEUnpacked out;
+  unsigned int done;
+
+  Unpacked(unsigned int n) : channel(n), value(n), event(n), counter(n)
+  {
+    out.channel = &channel[0];
+    out.value = &value[0];
+    out.event = &event[0];
+    out.size = n;
+    out.counter = &counter[0];
+    out.maxEvents = n;
+  }
+
+  void unpack(const unsigned char *src, unsigned int n, const VMEWordLayout &l)
+  {
+    out.nrData = out.nrEvents = out.nrHeaders = out.nrInvalid = 0;
+    done = vmeUnpack(src, n, l, out);
+  }
+
+  bool operator==(const Unpacked &u) const
+  {
+    return (done == u.done) && (out.nrData == u.out.nrData) && (out.nrEvents == u.out.nrEvents) &&
+      (out.nrHeaders == u.out.nrHeaders) && (out.nrInvalid == u.out.nrInvalid) &&
+      !memcmp(out.channel, u.out.channel, out.nrData * 4) && !memcmp(out.value, u.out.value, out.nrData * 4) &&
+      !memcmp(out.event, u.out.event, out.nrData * 4) && !memcmp(out.counter, u.out.counter, out.nrEvents * 4);
+  }
+};
+
+//----------------------------------------------------------------------------
+//  Checks of the selected kernels, returns number of failures
+//----------------------------------------------------------------------------
+static int check(const unsigned char *src, const Unpacked &ref, unsigned int words)
+{
+  vector<unsigned char> a(4 * 68 + 4), b(4 * 68 + 4);
+  VMEWordLayout l = vmeCaenLayout(true);
+  Unpacked u(words);
+  unsigned int n, off;
+  int failed = 0;
+
+  for (off = 0; off < 4; off++)
+    for (n = 0; n < 68; n++)
+    {
+      refSwap16(&b[0], src + off, n);
+      vmeSwapCopy16(&a[off], src + off, n);
+      if (memcmp(&a[off], &b[0], 2 * n))
+        failed++;
+
+      refSwap32(&b[0], src + off, n);
+      vmeSwapCopy32(&a[off], src + off, n);
+      if (memcmp(&a[off], &b[0], 4 * n))
+        failed++;
+
+      memcpy(&a[off], src + off, 4 * n);         // in place
+      vmeSwap32(&a[off], n);
+      if (memcmp(&a[off], &b[0], 4 * n))
+        failed++;
+    }
+
+  // the event data ends with a trailer, the last word must be unpacked
+
+  u.unpack(src, words, l);
+  if (!(u == ref) || (u.done != words))
+    failed++;
+
+  // not swapped: as the swapped words unpacked from a swapped copy
+
+  vector<unsigned char> copy(4 * words);
+  refSwap32(&copy[0], src, words);
+  l.swap = false;
+  u.unpack(&copy[0], words, l);
+  if (!(u == ref))
+    failed++;
+
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int mb = (argc > 1) ? atoi(argv[1]) : 16;
+  unsigned int reps = (argc > 2) ? atoi(argv[2]) : 10;
+  unsigned int words, r;
+  int level, failed = 0;
+  double t16, t32, tUnpack;
+
+  if ((mb == 0) || (reps == 0))
+  {
+    cerr << "usage: vmeswapbench [MB of data [repetitions]]\n";
+    return 1;
+  }
+
+  words = mb * 0x40000;
+  vector<unsigned char> src(4 * words), dst(4 * words);
+  makeEvents(&src[0], words);
+
+  // reference unpack, the scalar loop checked against a direct decode
+
+  VMEWordLayout l = vmeCaenLayout(true);
+  Unpacked ref(words);
+  vmeSwapSelect(VME_SIMD_SCALAR);
+  ref.unpack(&src[0], words, l);
+
+  unsigned int nrData = 0;
+  for (r = 0; r < words; r++)
+  {
+    uint32_t w = __builtin_bswap32(load(&src[4 * r]));
+    if (((w >> 24) & 7) == 0)
+    {
+      if ((ref.channel[nrData] != ((w >> 16) & 0x1F)) || (ref.value[nrData] != (w & 0x3FFF)))
+        failed++;
+      nrData++;
+    }
+  }
+  if (nrData != ref.out.nrData)
+    failed++;
+
+  cout << mb << " MB, " << ref.out.nrEvents << " events\n";
+  cout << "kernel     swap16 MB/s   swap32 MB/s   unpack MB/s   check\n";
+
+  for (level = VME_SIMD_SCALAR; level <= VME_SIMD_AVX2; level++)
+  {
+    if (vmeSwapSelect(level) != level)
+    {
+      cout << left << setw(8) << levelName[level] << right << "   not supported\n";
+      continue;
+    }
+
+    int errors = check(&src[0], ref, words);
+    Unpacked u(words);
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (r = 0; r < reps; r++)
+      vmeSwapCopy16(&dst[0], &src[0], 2 * words);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    for (r = 0; r < reps; r++)
+      vmeSwapCopy32(&dst[0], &src[0], words);
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+    for (r = 0; r < reps; r++)
+      u.unpack(&src[0], words, l);
+    chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+    t16 = chrono::duration<double>(t1 - t0).count();
+    t32 = chrono::duration<double>(t2 - t1).count();
+    tUnpack = chrono::duration<double>(t3 - t2).count();
+
+    cout << left << setw(8) << vmeSwapKernel() << right << fixed << setprecision(0)
+         << setw(14) << mb * reps / t16 << setw(14) << mb * reps / t32
+         << setw(14) << mb * reps / tUnpack << "   " << (errors ? "FAILED" : "ok") << endl;
+
+    failed += errors;
+  }
+
+  if (failed)
+  {
+    cerr << "vmeswapbench: " << failed << " checks failed!\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,421 @@
+/*
+ Implementation of class VMECrate
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "vmecrate.h"
+
+using namespace std;
+
+#define IMAGE_ALIGN  0x10000ULL  // images are 64 kB aligned
+
+// image range while planning, [lo, hi) may exceed 32 bit before the check
+
+struct PlanRange
+{
+  int vas, vdw;
+  uint64_t lo, hi;
+  vector<int> modules;
+};
+
+//----------------------------------------------------------------------------
+//  Size of address space 'vas', 0 if invalid
+//----------------------------------------------------------------------------
+static uint64_t spaceSize(int vas)
+{
+  switch (vas)
+  {
+  case A16:
+    return 0x10000ULL;
+  case A24:
+    return 0x1000000ULL;
+  case A32:
+    return 0x100000000ULL;
+  default:
+    return 0;
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Parse address space/data width names, -1 if unknown
+//----------------------------------------------------------------------------
+static int parseSpace(const string &s)
+{
+  if (s == "A16")
+    return A16;
+  if (s == "A24")
+    return A24;
+  if (s == "A32")
+    return A32;
+  return -1;
+}
+
+static int parseWidth(const string &s)
+{
+  if (s == "D8")
+    return D8;
+  if (s == "D16")
+    return D16;
+  if (s == "D32")
+    return D32;
+  if (s == "D64")
+    return D64;
+  return -1;
+}
+
+// order of ranges: address space, data width (D64 last), address
+
+static bool rangeBefore(const PlanRange &a, const PlanRange &b)
+{
+  if (a.vas != b.vas)
+    return a.vas < b.vas;
+  if (a.vdw != b.vdw)
+    return a.vdw < b.vdw;
+  return a.lo < b.lo;
+}
+
+static const char *spaceName(int vas)
+{
+  return (vas == A32) ? "A32" : (vas == A24) ? "A24" : "A16";
+}
+
+static const char *widthName(int vdw)
+{
+  return (vdw == D64) ? "D64" : (vdw == D32) ? "D32" : (vdw == D16) ? "D16" : "D8";
+}
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+VMECrate::VMECrate(VMEBridge &bridge)
+{
+  vme = &bridge;
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+VMECrate::~VMECrate()
+{
+  release();
+}
+
+//----------------------------------------------------------------------------
+//  Read crate description from 'file'
+//     returns number of modules read, < 0 on error
+//----------------------------------------------------------------------------
+int VMECrate::load(const char *file)
+{
+  ifstream in(file);
+  string line, name, space, width, base, size;
+  char *end1, *end2;
+  unsigned long b, s;
+  int nr = 0, lineNr = 0;
+  size_t pos;
+
+  if (!in)
+  {
+    *Err << "VMECrate: Can't open crate description " << file << "!\n";
+    return -1;
+  }
+
+  while (getline(in, line))
+  {
+    lineNr++;
+
+    if ((pos = line.find('#')) != string::npos)
+      line.erase(pos);
+
+    istringstream fields(line);
+    if (!(fields >> name))
+      continue;   // empty line
+
+    if (!(fields >> space >> width >> base >> size))
+    {
+      *Err << "VMECrate: " << file << ":" << lineNr << ": Expected name, space, width, base, size!\n";
+      return -2;
+    }
+
+    b = strtoul(base.c_str(), &end1, 0);
+    s = strtoul(size.c_str(), &end2, 0);
+    if (*end1 || *end2 || (parseSpace(space) < 0) || (parseWidth(width) < 0))
+    {
+      *Err << "VMECrate: " << file << ":" << lineNr << ": Invalid module description!\n";
+      return -2;
+    }
+
+    if (addModule(name, b, s, parseSpace(space), parseWidth(width)) < 0)
+      return -2;
+
+    nr++;
+  }
+
+  return nr;
+}
+
+//----------------------------------------------------------------------------
+//  Add a module, returns its index or -1
+//----------------------------------------------------------------------------
+int VMECrate::addModule(const string &name, unsigned int base, unsigned int size, int vas, int vdw)
+{
+  VMEModule mod;
+  uint64_t end = spaceSize(vas);
+
+  if ((!end) || (!size) || ((uint64_t) base + size > end))
+  {
+    *Err << "VMECrate: Module " << name << " exceeds its address space!\n";
+    return -1;
+  }
+
+  if ((vdw != D8) && (vdw != D16) && (vdw != D32) && (vdw != D64))
+  {
+    *Err << "VMECrate: Module " << name << " has invalid data width!\n";
+    return -1;
+  }
+
+  if (find(name) >= 0)
+  {
+    *Err << "VMECrate: Module " << name << " is defined twice!\n";
+    return -1;
+  }
+
+  mod.name = name;
+  mod.vas = vas;
+  mod.vdw = vdw;
+  mod.base = base;
+  mod.size = size;
+  mod.plan = -1;
+  modules.push_back(mod);
+
+  return modules.size() - 1;
+}
+
+//----------------------------------------------------------------------------
+//  Compute image layout using at most 'maxImages' images
+//     returns number of images, < 0 if the modules don't fit
+//----------------------------------------------------------------------------
+int VMECrate::plan(unsigned int maxImages)
+{
+  vector<PlanRange> single, ranges;
+  unsigned int i, j, best;
+  uint64_t gap, bestGap;
+
+  for (i = 0; i < images.size(); i++)
+    if (images[i].image >= 0)
+    {
+      *Err << "VMECrate: Release images before planning again!\n";
+      return -1;
+    }
+
+  images.clear();
+
+  // one 64 kB aligned range per module, sorted by space, width and address
+
+  for (i = 0; i < modules.size(); i++)
+  {
+    PlanRange r;
+
+    r.vas = modules[i].vas;
+    r.vdw = modules[i].vdw;
+    r.lo = modules[i].base & ~(IMAGE_ALIGN - 1);
+    r.hi = ((uint64_t) modules[i].base + modules[i].size + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1);
+    r.modules.push_back(i);
+    single.push_back(r);
+  }
+  sort(single.begin(), single.end(), rangeBefore);
+
+  // merge overlapping and adjacent ranges of the same data width, an
+  // image's width is used for all accesses through it
+
+  for (i = 0; i < single.size(); i++)
+  {
+    if (!ranges.empty())
+    {
+      PlanRange &last = ranges.back();
+
+      if ((last.vas == single[i].vas) && (last.vdw == single[i].vdw) && (single[i].lo <= last.hi))
+      {
+        last.hi = max(last.hi, single[i].hi);
+        last.modules.push_back(single[i].modules[0]);
+        continue;
+      }
+    }
+    ranges.push_back(single[i]);
+  }
+
+  // join neighbours with the smallest gap until the images suffice
+
+  while (ranges.size() > maxImages)
+  {
+    best = 0;
+    bestGap = 0;
+
+    for (i = 1; i < ranges.size(); i++)
+    {
+      if ((ranges[i].vas != ranges[i - 1].vas) || (ranges[i].vdw != ranges[i - 1].vdw))
+        continue;
+
+      gap = ranges[i].lo - ranges[i - 1].hi;
+      if ((!best) || (gap < bestGap))
+      {
+        best = i;
+        bestGap = gap;
+      }
+    }
+
+    if (!best)
+    {
+      *Err << "VMECrate: Modules need at least " << ranges.size() << " images!\n";
+      return -2;
+    }
+
+    PlanRange &prev = ranges[best - 1];
+
+    prev.hi = ranges[best].hi;
+    prev.modules.insert(prev.modules.end(), ranges[best].modules.begin(), ranges[best].modules.end());
+    ranges.erase(ranges.begin() + best);
+  }
+
+  for (i = 0; i < ranges.size(); i++)
+  {
+    VMEImagePlan p;
+
+    if (ranges[i].hi - ranges[i].lo > 0xFFFF0000ULL)
+    {
+      *Err << "VMECrate: Image for module " << modules[ranges[i].modules[0]].name << " exceeds 4 GB!\n";
+      images.clear();
+      return -3;
+    }
+
+    p.vas = ranges[i].vas;
+    p.vdw = ranges[i].vdw;
+    p.base = (unsigned int) ranges[i].lo;
+    p.size = (unsigned int) (ranges[i].hi - ranges[i].lo);
+    p.image = -1;
+    p.modules = ranges[i].modules;
+
+    for (j = 0; j < p.modules.size(); j++)
+      modules[p.modules[j]].plan = i;
+
+    images.push_back(p);
+  }
+
+  return images.size();
+}
+
+//----------------------------------------------------------------------------
+//  Allocate the planned images, returns 0 or -1 (nothing allocated)
+//----------------------------------------------------------------------------
+int VMECrate::allocate(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < images.size(); i++)
+  {
+    if (images[i].image >= 0)
+      continue;
+
+    images[i].image = vme->getImage(images[i].base, images[i].size, images[i].vas, images[i].vdw, MASTER);
+    if (images[i].image < 0)
+    {
+      *Err << "VMECrate: Can't allocate image for " << modules[images[i].modules[0]].name << "!\n";
+      release();
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Release all allocated images, the plan is kept
+//----------------------------------------------------------------------------
+void VMECrate::release(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < images.size(); i++)
+    if (images[i].image >= 0)
+    {
+      vme->releaseImage(images[i].image);
+      images[i].image = -1;
+    }
+}
+
+//----------------------------------------------------------------------------
+//  Module lookup
+//----------------------------------------------------------------------------
+int VMECrate::find(const string &name)
+{
+  unsigned int i;
+
+  for (i = 0; i < modules.size(); i++)
+    if (modules[i].name == name)
+      return i;
+
+  return -1;
+}
+
+// image number for the module, -1 if unknown or not allocated
+
+int VMECrate::getImage(const string &name)
+{
+  int mod = find(name);
+
+  if ((mod < 0) || (modules[mod].plan < 0))
+    return -1;
+
+  return images[modules[mod].plan].image;
+}
+
+// mapped address of the module base, 0 if unknown or not allocated
+
+uintptr_t VMECrate::getAddr(const string &name)
+{
+  int mod = find(name);
+  int image = getImage(name);
+
+  if (image < 0)
+    return 0;
+
+  return vme->getPciBaseAddr(image) + (modules[mod].base - images[modules[mod].plan].base);
+}
+
+//----------------------------------------------------------------------------
+//  Print planned layout
+//----------------------------------------------------------------------------
+void VMECrate::printPlan(ostream &out)
+{
+  unsigned int i, j;
+
+  for (i = 0; i < images.size(); i++)
+  {
+    const VMEImagePlan &p = images[i];
+
+    out << "Image " << i << ": " << spaceName(p.vas) << " " << widthName(p.vdw) << " 0x" << hex << p.base << " - 0x" << (uint64_t) p.base + p.size - 1 << dec << " (" << p.size / 1024 << " kB):";
+
+    for (j = 0; j < p.modules.size(); j++)
+      out << " " << modules[p.modules[j]].name;
+    out << "\n";
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ Definition of class VMECrate
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMECRATE_H
+#define VMECRATE_H
+
+#include <string>
+#include <vector>
+
+#include "vmelib.h"
+
+// VME module as given in the crate description
+
+struct VMEModule
+{
+  std::string name;
+  int vas;                 // A16, A24, A32
+  int vdw;                 // D8, D16, D32, D64
+  unsigned int base;       // VME base address
+  unsigned int size;       // size of the address window in bytes
+  int plan;                // index of the image in the plan
+};
+
+// master image of the planned layout
+
+struct VMEImagePlan
+{
+  int vas, vdw;
+  unsigned int base, size; // 64 kB aligned
+  int image;               // VMEBridge image number, -1 if not allocated
+  std::vector<int> modules;
+};
+
+//----------------------------------------------------------------------------
+//  VMECrate: compute and allocate the master images for a crate.
+//
+//  The crate description lists one module per line:
+//
+//      # name     space  width  base        size
+//      adc0       A32    D32    0x20000000  0x10000
+//      scaler     A24    D16    0x00400000  0x1000
+//
+//  plan() merges the 64 kB aligned module windows of each address space
+//  and data width into images. If there are more than 'maxImages', the
+//  images with the smallest gaps in between are joined, which keeps the
+//  mapped size minimal. Modules of different data widths never share an
+//  image, as the image's width is used for every access through it.
+//----------------------------------------------------------------------------
+
+class VMECrate
+{
+private:
+  VMEBridge *vme;
+  std::vector<VMEModule> modules;
+  std::vector<VMEImagePlan> images;
+
+  VMECrate(const VMECrate &);
+  VMECrate &operator=(const VMECrate &);
+
+public:
+  VMECrate(VMEBridge &bridge);
+  virtual ~VMECrate();
+
+  int load(const char *file);
+  int addModule(const std::string &name, unsigned int base, unsigned int size, int vas, int vdw);
+
+  int plan(unsigned int maxImages = 8);
+  int allocate(void);
+  void release(void);
+
+  // lookup, valid after allocate()
+
+  int find(const std::string &name);
+  int getImage(const std::string &name);
+  uintptr_t getAddr(const std::string &name);
+
+  const std::vector<VMEModule> &getModules(void) const
+  {
+    return modules;
+  }
+
+  const std::vector<VMEImagePlan> &getPlan(void) const
+  {
+    return images;
+  }
+
+  void printPlan(std::ostream &out);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -0,0 +1,453 @@
+/*
+ Implementation of class ParallelDecoder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "vmedecoder.h"
+
+using namespace std;
+
+#define SPIN_COUNT    16           // polls before yielding
+#define YIELD_COUNT   64           // polls before sleeping
+#define WAIT_SLEEP    20000        // ns, sleep while idle
+
+static void backoff(unsigned int &polls)
+{
+  struct timespec pause = {0, WAIT_SLEEP};
+
+  polls++;
+
+  if (polls < SPIN_COUNT)
+    return;
+  if (polls < YIELD_COUNT)
+    sched_yield();
+  else
+    nanosleep(&pause, NULL);
+}
+
+static inline unsigned int wordType(const unsigned char *p, const VMEWordLayout &layout)
+{
+  uint32_t w;
+
+  memcpy(&w, p, sizeof(w));
+  if (layout.swap)
+    w = __builtin_bswap32(w);
+
+  return (w >> layout.typeShift) & layout.typeMask;
+}
+
+//----------------------------------------------------------------------------
+//  Constructor, allocates the output of 'nrBlocks' blocks of up to
+//  'maxBlockSize' bytes. 'nrThreads' 0: one per CPU.
+//----------------------------------------------------------------------------
+ParallelDecoder::ParallelDecoder(const VMEWordLayout &layout, DecoderSink *sink, unsigned int nrThreads, unsigned int maxBlockSize,
+                                 unsigned int nrBlocks, unsigned int rangeSize)
+  : inject(nrBlocks ? nrBlocks : 1), commitSeq(0), quit(false), nrCommitted(0), nrRangesDone(0), nrSteals(0)
+{
+  unsigned int i;
+
+  Err = &cerr;
+  this->layout = layout;
+  this->sink = sink;
+  submitSeq = 0;
+  running = false;
+  nrStalls = 0;
+
+  if (!nrThreads)
+    nrThreads = thread::hardware_concurrency();
+  if (!nrThreads)
+    nrThreads = 1;
+  if (!nrBlocks)
+    nrBlocks = 1;
+
+  this->nrThreads = nrThreads;
+  maxWords = maxBlockSize / 4;
+  rangeWords = (rangeSize >= 4) ? rangeSize / 4 : 1;
+  maxRanges = (maxWords + rangeWords - 1) / rangeWords;
+  if (!maxRanges)
+    maxRanges = 1;
+
+  for (i = 0; i < nrBlocks; i++)
+  {
+    Block *b = new Block;
+
+    b->channel.resize(maxWords ? maxWords : 1);
+    b->value.resize(maxWords ? maxWords : 1);
+    b->event.resize(maxWords ? maxWords : 1);
+    b->counter.resize(maxWords ? maxWords : 1);
+    b->ranges.resize(maxRanges);
+    b->begin.resize(maxRanges);
+    b->firstEvent.resize(maxRanges);
+    b->nrRanges = 0;
+    b->remaining = 0;
+    b->done = false;
+    blocks.push_back(b);
+  }
+
+  for (i = 0; i < nrThreads; i++)
+  {
+    Worker *w = new Worker;
+
+    w->tasks.resize(maxRanges);
+    w->head = 0;
+    w->tail = 0;
+    workers.push_back(w);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, outstanding blocks are not committed
+//----------------------------------------------------------------------------
+ParallelDecoder::~ParallelDecoder()
+{
+  unsigned int i;
+
+  stop(false);
+
+  for (i = 0; i < blocks.size(); i++)
+    delete blocks[i];
+  for (i = 0; i < workers.size(); i++)
+    delete workers[i];
+}
+
+//----------------------------------------------------------------------------
+//  Start the worker threads
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int ParallelDecoder::start(void)
+{
+  unsigned int i;
+
+  if (running)
+    return 0;
+
+  if (!sink)
+  {
+    *Err << "ParallelDecoder: No sink!\n";
+    return -1;
+  }
+
+  quit = false;
+  running = true;
+
+  for (i = 0; i < nrThreads; i++)
+    threads.push_back(thread(&ParallelDecoder::work, this, i));
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Stop the workers, with 'drain' after all submitted blocks are committed
+//----------------------------------------------------------------------------
+void ParallelDecoder::stop(bool drain)
+{
+  unsigned int polls = 0, i;
+  uint64_t seq;
+
+  if (!running)
+    return;
+
+  if (drain)
+    while (commitSeq.load(memory_order_acquire) != submitSeq)
+      backoff(polls);
+
+  quit = true;
+  for (i = 0; i < threads.size(); i++)
+    threads[i].join();
+  threads.clear();
+
+  // forget what was not committed
+
+  while (inject.pop(seq))
+    ;
+  for (i = 0; i < workers.size(); i++)
+  {
+    workers[i]->head = 0;
+    workers[i]->tail = 0;
+  }
+  for (i = 0; i < blocks.size(); i++)
+    blocks[i]->done = false;
+  commitSeq = submitSeq;
+
+  running = false;
+}
+
+//----------------------------------------------------------------------------
+//  Queue a block, see class description
+//----------------------------------------------------------------------------
+int ParallelDecoder::submit(const void *data, unsigned int size, uint64_t trigger, void *user, int timeout)
+{
+  struct timespec t0, t;
+  unsigned int polls = 0;
+  Block *b;
+
+  if (!running)
+  {
+    *Err << "ParallelDecoder: Not started!\n";
+    return -1;
+  }
+
+  if (size / 4 > maxWords)
+  {
+    *Err << "ParallelDecoder: Block of " << size << " bytes exceeds maximum size!\n";
+    return -1;
+  }
+
+  if (submitSeq - commitSeq.load(memory_order_acquire) >= blocks.size())
+  {
+    nrStalls++;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (submitSeq - commitSeq.load(memory_order_acquire) >= blocks.size())
+    {
+      if (timeout >= 0)
+      {
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if ((t.tv_sec - t0.tv_sec) * 1000 + (t.tv_nsec - t0.tv_nsec) / 1000000 >= timeout)
+          return 0;
+      }
+      backoff(polls);
+    }
+  }
+
+  b = blocks[submitSeq % blocks.size()];
+  b->data = (const unsigned char *) data;
+  b->words = size / 4;
+  b->trigger = trigger;
+  b->user = user;
+  b->nrRanges = 0;
+
+  inject.push(submitSeq);    // can't be full, one entry per block
+  submitSeq++;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Split block 'seq' into ranges ending with a trailer word, push them on
+//  the deque of worker 'id' (which is empty)
+//----------------------------------------------------------------------------
+void ParallelDecoder::split(unsigned int id, uint64_t seq)
+{
+  unsigned int index = seq % blocks.size();
+  Block &b = *blocks[index];
+  Worker &w = *workers[id];
+  unsigned int nr, k, begin, end;
+
+  nr = (b.words + rangeWords - 1) / rangeWords;
+
+  for (k = 0, begin = 0; (k < nr) && (begin < b.words); k++)
+  {
+    if (k == nr - 1)
+      end = b.words;
+    else
+    {
+      // next event boundary at or after the nominal split point
+
+      end = (unsigned int) ((uint64_t) (k + 1) * b.words / nr);
+      if (end <= begin)
+        end = begin + 1;
+      while ((end < b.words) && (wordType(b.data + 4 * (end - 1), layout) != layout.trailer))
+        end++;
+    }
+
+    VMEUnpacked &r = b.ranges[k];
+
+    r.channel = &b.channel[begin];
+    r.value = &b.value[begin];
+    r.event = &b.event[begin];
+    r.size = end - begin;
+    r.counter = &b.counter[begin];
+    r.maxEvents = end - begin;
+    r.nrData = r.nrEvents = r.nrHeaders = r.nrInvalid = 0;
+    b.begin[k] = begin;
+
+    begin = end;
+  }
+
+  b.nrRanges = k;
+  b.remaining.store(k, memory_order_relaxed);
+
+  if (!k)
+  {
+    b.done.store(true, memory_order_release);
+    commit();
+    return;
+  }
+
+  // ranges are pushed in reverse, the owner starts with the first one
+
+  lock_guard<mutex> guard(w.lock);
+
+  for (end = 0; k > 0; end++)
+  {
+    k--;
+    w.tasks[end].block = index;
+    w.tasks[end].range = k;
+  }
+
+  w.head = 0;
+  w.tail = end;
+}
+
+bool ParallelDecoder::popLocal(unsigned int id, Task &t)
+{
+  Worker &w = *workers[id];
+  lock_guard<mutex> guard(w.lock);
+
+  if (w.head == w.tail)
+    return false;
+
+  w.tail--;
+  t = w.tasks[w.tail];
+
+  return true;
+}
+
+bool ParallelDecoder::steal(unsigned int id, Task &t)
+{
+  unsigned int i, victim;
+
+  for (i = 1; i < nrThreads; i++)
+  {
+    victim = (id + i) % nrThreads;
+    Worker &w = *workers[victim];
+
+    if (w.head.load(memory_order_relaxed) == w.tail.load(memory_order_relaxed))
+      continue;    // don't lock empty deques, rechecked below
+
+    lock_guard<mutex> guard(w.lock);
+
+    if (w.head != w.tail)
+    {
+      t = w.tasks[w.head];
+      w.head++;
+      nrSteals.fetch_add(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------------------
+//  Unpack one range, the last range of a block marks it done
+//----------------------------------------------------------------------------
+void ParallelDecoder::decode(const Task &t)
+{
+  Block &b = *blocks[t.block];
+  VMEUnpacked &r = b.ranges[t.range];
+
+  vmeUnpack(b.data + 4 * b.begin[t.range], r.size, layout, r);
+  nrRangesDone.fetch_add(1, memory_order_relaxed);
+
+  if (b.remaining.fetch_sub(1, memory_order_acq_rel) == 1)
+  {
+    b.done.store(true, memory_order_release);
+    commit();
+  }
+}
+
+bool ParallelDecoder::ready(void)
+{
+  uint64_t seq = commitSeq.load(memory_order_acquire);
+
+  // done is cleared before commitSeq moves on, a free block is never done
+
+  return blocks[seq % blocks.size()]->done.load(memory_order_acquire);
+}
+
+//----------------------------------------------------------------------------
+//  Pass finished blocks to the sink in order. Only one thread commits, a
+//  block finished while it does is checked again after the unlock.
+//----------------------------------------------------------------------------
+void ParallelDecoder::commit(void)
+{
+  DecodedBlock d;
+  uint64_t seq;
+  unsigned int i, events;
+
+  do
+  {
+    if (!commitLock.try_lock())
+      return;
+
+    for (;;)
+    {
+      seq = commitSeq.load(memory_order_relaxed);
+      Block &b = *blocks[seq % blocks.size()];
+
+      if (!b.done.load(memory_order_acquire))
+        break;
+
+      d.trigger = b.trigger;
+      d.user = b.user;
+      d.ranges = &b.ranges[0];
+      d.firstEvent = &b.firstEvent[0];
+      d.nrRanges = b.nrRanges;
+      d.nrData = d.nrEvents = d.nrInvalid = 0;
+
+      for (i = 0, events = 0; i < b.nrRanges; i++)
+      {
+        b.firstEvent[i] = events;
+        events += b.ranges[i].nrEvents;
+        d.nrData += b.ranges[i].nrData;
+        d.nrInvalid += b.ranges[i].nrInvalid;
+      }
+      d.nrEvents = events;
+
+      sink->commit(d);
+
+      b.done.store(false, memory_order_relaxed);
+      nrCommitted.fetch_add(1, memory_order_relaxed);
+      commitSeq.store(seq + 1, memory_order_release);
+    }
+
+    commitLock.unlock();
+  }
+  while (ready());
+}
+
+//----------------------------------------------------------------------------
+//  Thread of worker 'id': own deque, new blocks, then the others' deques
+//----------------------------------------------------------------------------
+void ParallelDecoder::work(unsigned int id)
+{
+  unsigned int polls = 0;
+  uint64_t seq;
+  Task t;
+
+  while (!quit.load(memory_order_relaxed))
+  {
+    if (popLocal(id, t))
+      decode(t);
+    else if (inject.pop(seq))
+      split(id, seq);
+    else if (steal(id, t))
+      decode(t);
+    else
+    {
+      backoff(polls);
+      continue;
+    }
+
+    polls = 0;
+  }
+}
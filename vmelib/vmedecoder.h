@@ -0,0 +1,188 @@
+/*
+ Definition of class ParallelDecoder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEDECODER_H
+#define VMEDECODER_H
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "vmequeue.h"
+#include "vmeswap.h"
+
+// a decoded block, passed to DecoderSink::commit() in submission order
+
+struct DecodedBlock
+{
+  uint64_t trigger;                  // given to submit()
+  void *user;
+  const VMEUnpacked *ranges;         // in the order of the data
+  const unsigned int *firstEvent;    // per range: events of earlier ranges
+  unsigned int nrRanges;
+  unsigned int nrData, nrEvents, nrInvalid;
+};
+
+class DecoderSink
+{
+public:
+  virtual ~DecoderSink()
+  {
+  }
+
+  // called by one thread at a time, the block's data may be reused after it
+
+  virtual void commit(const DecodedBlock &block) = 0;
+};
+
+//----------------------------------------------------------------------------
+//  ParallelDecoder: unpacks multi event DMA blocks on a thread pool.
+//
+//  submit() only queues the block. A worker takes it, splits it after a
+//  trailer word every 'rangeSize' bytes into event ranges and pushes them
+//  on its own deque. Workers decode from the back of their deque and steal
+//  from the front of the others' when theirs is empty, so one large block
+//  is spread over all threads. Each range is unpacked into its part of the
+//  block's output arrays, no copies are made.
+//
+//  The worker finishing the oldest outstanding block commits it and all
+//  following finished ones to the sink, so the sink sees the blocks in the
+//  order of submit(). Data passed to submit() must stay valid until its
+//  block has been committed; at most 'nrBlocks' blocks are outstanding.
+//----------------------------------------------------------------------------
+
+class ParallelDecoder
+{
+private:
+  struct Block
+  {
+    const unsigned char *data;
+    unsigned int words;
+    uint64_t trigger;
+    void *user;
+
+    std::vector<unsigned int> channel, value, event, counter;
+    std::vector<VMEUnpacked> ranges;
+    std::vector<unsigned int> begin;         // first word of each range
+    std::vector<unsigned int> firstEvent;
+    unsigned int nrRanges;
+
+    std::atomic<unsigned int> remaining;
+    std::atomic<bool> done;
+  };
+
+  struct Task
+  {
+    unsigned int block, range;
+  };
+
+  // deque of a worker, the owner uses the back, thieves the front
+
+  struct Worker
+  {
+    std::mutex lock;
+    std::vector<Task> tasks;
+    std::atomic<unsigned int> head, tail;   // changed under 'lock'
+    char pad[VME_CACHE_LINE];
+  };
+
+  VMEWordLayout layout;
+  DecoderSink *sink;
+  unsigned int nrThreads, maxWords, rangeWords, maxRanges;
+
+  std::vector<Block *> blocks;
+  std::vector<Worker *> workers;
+  std::vector<std::thread> threads;
+  VMEMpmcQueue<uint64_t> inject;
+
+  uint64_t submitSeq;
+  std::atomic<uint64_t> commitSeq;
+  std::mutex commitLock;
+  std::atomic<bool> quit;
+  bool running;
+
+  std::atomic<unsigned long long> nrCommitted, nrRangesDone, nrSteals;
+  unsigned long long nrStalls;
+
+  void work(unsigned int id);
+  bool popLocal(unsigned int id, Task &t);
+  bool steal(unsigned int id, Task &t);
+  void split(unsigned int id, uint64_t seq);
+  void decode(const Task &t);
+  void commit(void);
+  bool ready(void);
+
+public:
+  ParallelDecoder(const VMEWordLayout &layout, DecoderSink *sink, unsigned int nrThreads = 0, unsigned int maxBlockSize = 0x40000,
+                  unsigned int nrBlocks = 16, unsigned int rangeSize = 0x4000);
+  virtual ~ParallelDecoder();
+
+  ParallelDecoder(const ParallelDecoder &) = delete;
+  ParallelDecoder &operator=(const ParallelDecoder &) = delete;
+
+  int start(void);
+  void stop(bool drain = true);
+
+  // queue 'size' bytes of module data, wait up to 'timeout' ms (-1: forever)
+  // for a free block; returns 1 if queued, 0 on timeout, -1 on error
+
+  int submit(const void *data, unsigned int size, uint64_t trigger, void *user = 0, int timeout = -1);
+
+  unsigned int getThreads(void) const
+  {
+    return nrThreads;
+  }
+
+  unsigned long long getBlocks(void) const
+  {
+    return nrCommitted.load(std::memory_order_relaxed);
+  }
+
+  unsigned long long getRanges(void) const
+  {
+    return nrRangesDone.load(std::memory_order_relaxed);
+  }
+
+  // ranges decoded by another worker than the one which split the block
+
+  unsigned long long getSteals(void) const
+  {
+    return nrSteals.load(std::memory_order_relaxed);
+  }
+
+  // submit() calls which found all blocks outstanding
+
+  unsigned long long getStalls(void) const
+  {
+    return nrStalls;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ Implementation of class DmaStreamReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <chrono>
+
+#include "vmedmastream.h"
+
+using namespace std;
+
+#define SLOT_FREE    0
+#define SLOT_FILLED  1
+#define SLOT_IN_USE  2
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+DmaStreamReader::DmaStreamReader(VMEBridge &bridge, unsigned int src, unsigned int cnt, int as, int dw, bool inc)
+{
+  Err = &cerr;
+  vme = &bridge;
+  source = src;
+  count = cnt;
+  vas = as;
+  vdw = dw;
+  increment = inc;
+
+  nrSlots = 0;
+  slotSize = 0;
+  dmaBase = 0;
+  nextFill = 0;
+  nextRead = 0;
+  running = false;
+  error = 0;
+  transfers = 0;
+  stalls = 0;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+DmaStreamReader::~DmaStreamReader()
+{
+  stop();
+}
+
+//----------------------------------------------------------------------------
+//  Start readout thread. requestDMA() must have been called before.
+//----------------------------------------------------------------------------
+int DmaStreamReader::start(void)
+{
+  unsigned int i;
+
+  if (running)
+    return 0;
+
+  nrSlots = vme->getDMABufCount();
+  slotSize = vme->getDMABufSize();
+  dmaBase = vme->getDMABase();
+
+  if ((nrSlots < 2) || (!dmaBase))
+  {
+    *Err << "DmaStreamReader: requestDMA() with at least 2 buffers needed!\n";
+    return -1;
+  }
+
+  // data start at an offset of (source & 7) and must not exceed the slot
+
+  if ((source & 0x7) + count > slotSize)
+  {
+    *Err << "DmaStreamReader: Transfer size exceeds DMA buffer size!\n";
+    return -2;
+  }
+
+  if (increment && (count & 0x7))
+  {
+    *Err << "DmaStreamReader: Transfer size must be a multiple of 8!\n";
+    return -2;
+  }
+
+  slotState.assign(nrSlots, SLOT_FREE);
+  slots.resize(nrSlots);
+  for (i = 0; i < nrSlots; i++)
+    slots[i].slot = i;
+
+  nextFill = 0;
+  nextRead = 0;
+  error = 0;
+  running = true;
+
+  worker = thread(&DmaStreamReader::run, this);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Stop readout thread, waits for the current transfer to finish
+//----------------------------------------------------------------------------
+void DmaStreamReader::stop(void)
+{
+  {
+    lock_guard<mutex> guard(lock);
+    running = false;
+  }
+  slotFreed.notify_all();
+  slotFilled.notify_all();
+
+  if (worker.joinable())
+    worker.join();
+}
+
+//----------------------------------------------------------------------------
+//  Readout thread: fill the buffers in turn as soon as they are free
+//----------------------------------------------------------------------------
+void DmaStreamReader::run(void)
+{
+  unsigned int slot, addr = source;
+  int ret;
+
+  for (;;)
+  {
+    slot = nextFill % nrSlots;
+
+    {
+      unique_lock<mutex> guard(lock);
+
+      if (running && (slotState[slot] != SLOT_FREE))
+      {
+        stalls++;
+        while (running && (slotState[slot] != SLOT_FREE))
+          slotFreed.wait(guard);
+      }
+      if (!running)
+        return;
+    }
+
+    VMEDMAFuture dma = vme->DMAreadAsync(addr, count, vas, vdw, slot);
+    ret = dma.get();
+
+    {
+      lock_guard<mutex> guard(lock);
+
+      if (ret < 0)
+      {
+        error = ret;
+        running = false;
+        slotFilled.notify_all();
+        return;
+      }
+
+      slots[slot].data = (const unsigned char *) (dmaBase + slot * slotSize + dma.offset());
+      slots[slot].size = dma.count();
+      slots[slot].vmeAddr = addr;
+      slots[slot].seq = nextFill;
+      slotState[slot] = SLOT_FILLED;
+      nextFill++;
+      transfers++;
+    }
+    slotFilled.notify_one();
+
+    if (increment)
+      addr += count;
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Get the next filled buffer, wait up to 'timeout' ms (-1: forever)
+//     returns 1 on success, 0 on timeout, < 0 if readout has stopped
+//----------------------------------------------------------------------------
+int DmaStreamReader::next(DmaSlot &slot, int timeout)
+{
+  unsigned int idx;
+  unique_lock<mutex> guard(lock);
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+
+  if (!nrSlots)
+    return -1;
+
+  idx = nextRead % nrSlots;
+
+  while (slotState[idx] != SLOT_FILLED)
+  {
+    if (!running)
+      return error ? error : -1;
+
+    if (timeout < 0)
+      slotFilled.wait(guard);
+    else if ((slotFilled.wait_until(guard, deadline) == cv_status::timeout) && (slotState[idx] != SLOT_FILLED))
+      return 0;
+  }
+
+  slotState[idx] = SLOT_IN_USE;
+  slot = slots[idx];
+  nextRead++;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Give buffer back for the next transfer
+//----------------------------------------------------------------------------
+void DmaStreamReader::release(const DmaSlot &slot)
+{
+  {
+    lock_guard<mutex> guard(lock);
+
+    if ((slot.slot >= nrSlots) || (slotState[slot.slot] != SLOT_IN_USE))
+      return;
+
+    slotState[slot.slot] = SLOT_FREE;
+  }
+  slotFreed.notify_one();
+}
+
+//----------------------------------------------------------------------------
+//  Status and statistics
+//----------------------------------------------------------------------------
+int DmaStreamReader::getError(void)
+{
+  lock_guard<mutex> guard(lock);
+  return error;
+}
+
+unsigned long long DmaStreamReader::getTransfers(void)
+{
+  lock_guard<mutex> guard(lock);
+  return transfers;
+}
+
+unsigned long long DmaStreamReader::getStalls(void)
+{
+  lock_guard<mutex> guard(lock);
+  return stalls;
+}
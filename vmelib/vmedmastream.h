@@ -0,0 +1,104 @@
+/*
+ Definition of class DmaStreamReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEDMASTREAM_H
+#define VMEDMASTREAM_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+
+// A filled DMA buffer slot, the data stays valid until release() is called
+
+struct DmaSlot
+{
+  const unsigned char *data;     // points into the mapped DMA buffer
+  unsigned int size;             // number of bytes transferred
+  unsigned int slot;             // DMA buffer number
+  unsigned int vmeAddr;          // VME source address of this transfer
+  unsigned long long seq;        // sequence number of this transfer
+};
+
+//----------------------------------------------------------------------------
+//  DmaStreamReader: continuous DMA readout into the buffers set up by
+//  VMEBridge::requestDMA(nrOfBufs). A background thread fills the buffers
+//  in turn, the consumer gets them in order by next() and hands them back
+//  by release(). A buffer is reused only after it has been released.
+//
+//  Each transfer reads 'count' bytes from 'source'. With 'increment' the
+//  source address advances by 'count' after each transfer (memory modules),
+//  otherwise the same address is read again (FIFOs). With BLT until BERR
+//  enabled, DmaSlot::size is the number of bytes read before the BERR.
+//----------------------------------------------------------------------------
+
+class DmaStreamReader
+{
+private:
+  VMEBridge *vme;
+  unsigned int source, count;
+  int vas, vdw;
+  bool increment;
+
+  unsigned int nrSlots, slotSize;
+  uintptr_t dmaBase;
+
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable slotFreed, slotFilled;
+  std::vector<int> slotState;
+  std::vector<DmaSlot> slots;
+  unsigned long long nextFill, nextRead;
+  bool running;
+  int error;
+
+  unsigned long long transfers, stalls;
+
+  void run();
+
+public:
+  DmaStreamReader(VMEBridge &bridge, unsigned int source, unsigned int count, int vas, int vdw, bool increment = false);
+  virtual ~DmaStreamReader();
+
+  DmaStreamReader(const DmaStreamReader &) = delete;
+  DmaStreamReader &operator=(const DmaStreamReader &) = delete;
+
+  int start(void);
+  void stop(void);
+
+  int next(DmaSlot &slot, int timeout = -1);
+  void release(const DmaSlot &slot);
+
+  int getError(void);
+  unsigned long long getTransfers(void);
+  unsigned long long getStalls(void);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
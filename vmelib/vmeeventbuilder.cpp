@@ -0,0 +1,191 @@
+/*
+ Implementation of class EventBuilder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "vmeeventbuilder.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+EventBuilder::EventBuilder(VMEBridge &bridge)
+{
+  vme = &bridge;
+  list = -1;
+  dmaBase = 0;
+  eventSize = 0;
+  events = 0;
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+EventBuilder::~EventBuilder()
+{
+  clear();
+}
+
+//----------------------------------------------------------------------------
+//  Add module read by 'size' bytes from 'vmeAddr', invalidates a built list
+//     returns index of the module, -1 on error
+//----------------------------------------------------------------------------
+int EventBuilder::addModule(unsigned int id, unsigned int vmeAddr, unsigned int size, int vas, int vdw)
+{
+  Module m;
+
+  if ((!size) || (size > 0x7FFFFFFF))
+  {
+    *Err << "EventBuilder: Invalid size of module " << id << "!\n";
+    return -1;
+  }
+
+  if (list >= 0)
+    vme->delCmdPktList(list);
+  list = -1;
+  eventSize = 0;
+
+  m.id = id;
+  m.vmeAddr = vmeAddr;
+  m.size = size;
+  m.vas = vas;
+  m.vdw = vdw;
+  m.offset = 0;
+  modules.push_back(m);
+
+  return modules.size() - 1;
+}
+
+//----------------------------------------------------------------------------
+//  Create the command packet list
+//     returns number of modules, < 0 on error
+//----------------------------------------------------------------------------
+int EventBuilder::build(void)
+{
+  unsigned int i, offset, bufSize;
+
+  if (list >= 0)
+    vme->delCmdPktList(list);
+  list = -1;
+  eventSize = 0;
+
+  if (modules.empty())
+  {
+    *Err << "EventBuilder: No modules added!\n";
+    return -1;
+  }
+
+  dmaBase = vme->getDMABase();
+  bufSize = vme->getDMABufSize() * vme->getDMABufCount();
+  if (!dmaBase)
+  {
+    *Err << "EventBuilder: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  if ((list = vme->newCmdPktList()) < 0)
+    return -2;
+
+  for (i = 0; i < modules.size(); i++)
+  {
+    Module &m = modules[i];
+
+    offset = vme->addCmdPkt(list, 0, m.vmeAddr, m.size, m.vas, m.vdw);
+    if ((offset == 0xFFFFFFFF) || ((uint64_t) offset + m.size > bufSize))
+    {
+      *Err << "EventBuilder: Modules exceed DMA buffer!\n";
+      vme->delCmdPktList(list);
+      list = -1;
+      return -3;
+    }
+
+    m.offset = offset;
+    eventSize += sizeof(EventFragmentHeader) + ((m.size + 3) & ~3);
+  }
+
+  return modules.size();
+}
+
+//----------------------------------------------------------------------------
+//  Remove all modules
+//----------------------------------------------------------------------------
+void EventBuilder::clear(void)
+{
+  if (list >= 0)
+    vme->delCmdPktList(list);
+
+  list = -1;
+  eventSize = 0;
+  modules.clear();
+}
+
+//----------------------------------------------------------------------------
+//  Read one event
+//     returns size of the event, -1 on DMA error, -2 if not built or
+//     'maxSize' is too small
+//----------------------------------------------------------------------------
+int EventBuilder::read(void *event, unsigned int maxSize)
+{
+  unsigned char *p = (unsigned char *) event;
+  EventFragmentHeader hdr;
+  unsigned int i, pad;
+
+  if (list < 0)
+  {
+    *Err << "EventBuilder: List must be built before reading!\n";
+    return -2;
+  }
+
+  if (maxSize < eventSize)
+  {
+    *Err << "EventBuilder: Event buffer too small, " << eventSize << " bytes needed!\n";
+    return -2;
+  }
+
+  if (vme->execCmdPktList(list) != 0)
+    return -1;
+
+  for (i = 0; i < modules.size(); i++)
+  {
+    const Module &m = modules[i];
+
+    hdr.id = m.id;
+    hdr.length = m.size;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+
+    memcpy(p, (const void *) (dmaBase + m.offset), m.size);
+    p += m.size;
+
+    for (pad = m.size & 3; pad && (pad < 4); pad++)
+      *p++ = 0;
+  }
+
+  events++;
+
+  return eventSize;
+}
+
+int EventBuilder::read(vector<unsigned char> &event)
+{
+  event.resize(eventSize);
+
+  return read(eventSize ? &event[0] : 0, eventSize);
+}
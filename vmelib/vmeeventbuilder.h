@@ -0,0 +1,110 @@
+/*
+ Definition of class EventBuilder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEEVENTBUILDER_H
+#define VMEEVENTBUILDER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+
+// header in front of the data of each module in an event
+
+struct EventFragmentHeader
+{
+  uint32_t id;          // module id given to addModule()
+  uint32_t length;      // number of data bytes following
+};
+
+//----------------------------------------------------------------------------
+//  EventBuilder: reads a set of modules by one DMA command packet list.
+//
+//  build() turns the modules into one command packet per module, read()
+//  executes the list and assembles the event:
+//
+//      EventFragmentHeader, data of module 1, padding to 4 bytes
+//      EventFragmentHeader, data of module 2, padding to 4 bytes
+//      ...
+//
+//  in the order the modules were added. The driver starts the data of a
+//  packet at the alignment of its VME address, the 0-7 gap bytes between
+//  packets in the DMA buffer are not copied. requestDMA() must have been
+//  called before build().
+//----------------------------------------------------------------------------
+
+class EventBuilder
+{
+private:
+  struct Module
+  {
+    unsigned int id, vmeAddr, size;
+    int vas, vdw;
+    unsigned int offset;     // of the data in the DMA buffer
+  };
+
+  VMEBridge *vme;
+  std::vector<Module> modules;
+  int list;
+  uintptr_t dmaBase;
+  unsigned int eventSize;
+
+  unsigned long long events;
+
+  EventBuilder(const EventBuilder &);
+  EventBuilder &operator=(const EventBuilder &);
+
+public:
+  EventBuilder(VMEBridge &bridge);
+  virtual ~EventBuilder();
+
+  int addModule(unsigned int id, unsigned int vmeAddr, unsigned int size, int vas, int vdw);
+  int build(void);
+  void clear(void);
+
+  // read one event into 'event', returns its size or < 0 on error
+
+  int read(void *event, unsigned int maxSize);
+  int read(std::vector<unsigned char> &event);
+
+  unsigned int getEventSize(void) const
+  {
+    return eventSize;
+  }
+
+  unsigned int getModuleCount(void) const
+  {
+    return modules.size();
+  }
+
+  unsigned long long getEvents(void) const
+  {
+    return events;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
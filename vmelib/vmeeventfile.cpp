@@ -0,0 +1,411 @@
+/*
+ Implementation of classes EventFileWriter and EventFileReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vmeeventfile.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//  EventFileWriter constructor, see Recorder for the buffers
+//----------------------------------------------------------------------------
+EventFileWriter::EventFileWriter(unsigned int nrBuffers, unsigned int bufSize) : rec(nrBuffers, bufSize)
+{
+  chunkEvents = 0;
+  nrEvents = 0;
+  Err = &cerr;
+}
+
+EventFileWriter::~EventFileWriter()
+{
+  close();
+}
+
+//----------------------------------------------------------------------------
+//  Create file 'name' with 'chunkEvents' events per index chunk
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int EventFileWriter::open(const char *name, unsigned int chunkEvents)
+{
+  EventFileHeader hdr;
+
+  if (rec.isOpen())
+    close();
+
+  if (!chunkEvents)
+  {
+    *Err << "EventFileWriter: Chunk must hold at least one event!\n";
+    return -1;
+  }
+
+  if (rec.open(name) != 0)
+    return -1;
+
+  this->chunkEvents = chunkEvents;
+  nrEvents = 0;
+  events.clear();
+  fragments.clear();
+  chunks.clear();
+  events.reserve(chunkEvents);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, EVENTFILE_MAGIC, sizeof(hdr.magic));
+  hdr.version = EVENTFILE_VERSION;
+  hdr.chunkEvents = chunkEvents;
+  hdr.created = time(NULL);
+
+  return rec.write(&hdr, sizeof(hdr));
+}
+
+//----------------------------------------------------------------------------
+//  Write the index of the current chunk
+//----------------------------------------------------------------------------
+int EventFileWriter::writeChunk(void)
+{
+  EventChunkEntry c;
+
+  if (events.empty())
+    return 0;
+
+  c.eventIndex = rec.getBytes();
+  c.fragmentIndex = c.eventIndex + events.size() * sizeof(EventIndexEntry);
+  c.nrEvents = events.size();
+  c.nrFragments = fragments.size();
+
+  if (rec.write(&events[0], events.size() * sizeof(EventIndexEntry)) != 0)
+    return -1;
+  if ((!fragments.empty()) && (rec.write(&fragments[0], fragments.size() * sizeof(FragmentIndexEntry)) != 0))
+    return -1;
+
+  chunks.push_back(c);
+  events.clear();
+  fragments.clear();
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Append one event
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int EventFileWriter::write(const void *event, unsigned int size, uint32_t trigger, bool indexFragments)
+{
+  static const unsigned char zero[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  const unsigned char *p = (const unsigned char *) event;
+  EventFragmentHeader hdr;
+  FragmentIndexEntry f;
+  EventIndexEntry e;
+  unsigned int off;
+
+  if (!rec.isOpen())
+  {
+    *Err << "EventFileWriter: File not open!\n";
+    return -1;
+  }
+
+  e.offset = rec.getBytes();
+  e.size = size;
+  e.trigger = trigger;
+  e.firstFragment = fragments.size();
+
+  // only the headers are read, indexing stops at a fragment exceeding the event
+
+  if (indexFragments)
+  {
+    for (off = 0; off + sizeof(hdr) <= size; off += sizeof(hdr) + ((hdr.length + 3) & ~3))
+    {
+      memcpy(&hdr, p + off, sizeof(hdr));
+      if ((uint64_t) off + sizeof(hdr) + hdr.length > size)
+        break;
+
+      f.id = hdr.id;
+      f.offset = off;
+      fragments.push_back(f);
+    }
+  }
+
+  e.nrFragments = fragments.size() - e.firstFragment;
+
+  if (rec.write(event, size) != 0)
+    return -1;
+  if ((size & 7) && (rec.write(zero, 8 - (size & 7)) != 0))
+    return -1;
+
+  events.push_back(e);
+  nrEvents++;
+
+  if (events.size() >= chunkEvents)
+    return writeChunk();
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Write the last index, the chunk table and the trailer
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int EventFileWriter::close(void)
+{
+  EventFileTrailer t;
+  int ret = 0;
+
+  if (!rec.isOpen())
+    return 0;
+
+  if (writeChunk() != 0)
+    ret = -1;
+
+  memset(&t, 0, sizeof(t));
+  t.chunkTable = rec.getBytes();
+  t.nrEvents = nrEvents;
+  t.nrChunks = chunks.size();
+  t.chunkEvents = chunkEvents;
+  memcpy(t.magic, EVENTFILE_END, sizeof(t.magic));
+
+  if ((!chunks.empty()) && (rec.write(&chunks[0], chunks.size() * sizeof(EventChunkEntry)) != 0))
+    ret = -1;
+  if (rec.write(&t, sizeof(t)) != 0)
+    ret = -1;
+
+  if (rec.close() != 0)
+    ret = -1;
+
+  chunks.clear();
+
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+//  EventFileReader
+//----------------------------------------------------------------------------
+EventFileReader::EventFileReader()
+{
+  map = 0;
+  mapSize = 0;
+  trailer = 0;
+  chunks = 0;
+  Err = &cerr;
+}
+
+EventFileReader::~EventFileReader()
+{
+  close();
+}
+
+//----------------------------------------------------------------------------
+//  Map file 'name' and check its index
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int EventFileReader::open(const char *name)
+{
+  const EventFileHeader *hdr;
+  const EventChunkEntry *c;
+  struct stat st;
+  void *p;
+  uint64_t end, n;
+  int fd;
+
+  close();
+
+  if ((fd = ::open(name, O_RDONLY)) < 0)
+  {
+    *Err << "EventFileReader: Can't open " << name << ": " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  if ((fstat(fd, &st) != 0) || ((uint64_t) st.st_size < sizeof(EventFileHeader) + sizeof(EventFileTrailer)))
+  {
+    *Err << "EventFileReader: " << name << " is no event file!\n";
+    ::close(fd);
+    return -1;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    *Err << "EventFileReader: Can't map " << name << ": " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  map = (const unsigned char *) p;
+  mapSize = st.st_size;
+
+  hdr = (const EventFileHeader *) map;
+  trailer = (const EventFileTrailer *) (map + mapSize - sizeof(EventFileTrailer));
+  end = mapSize - sizeof(EventFileTrailer);
+
+  if (memcmp(hdr->magic, EVENTFILE_MAGIC, sizeof(hdr->magic)) || (hdr->version != EVENTFILE_VERSION))
+  {
+    *Err << "EventFileReader: " << name << " is no event file!\n";
+    close();
+    return -1;
+  }
+
+  if (memcmp(trailer->magic, EVENTFILE_END, sizeof(trailer->magic)))
+  {
+    *Err << "EventFileReader: " << name << " has no index, was it closed?\n";
+    close();
+    return -1;
+  }
+
+  // the index must lie within the file, events are checked when accessed
+
+  if ((!trailer->chunkEvents) || (trailer->chunkTable > end) ||
+      ((end - trailer->chunkTable) / sizeof(EventChunkEntry) < trailer->nrChunks) ||
+      ((trailer->nrEvents + trailer->chunkEvents - 1) / trailer->chunkEvents != trailer->nrChunks))
+  {
+    *Err << "EventFileReader: Index of " << name << " is corrupt!\n";
+    close();
+    return -1;
+  }
+
+  chunks = (const EventChunkEntry *) (map + trailer->chunkTable);
+
+  for (n = 0; n < trailer->nrChunks; n++)
+  {
+    c = &chunks[n];
+    if ((c->nrEvents > trailer->chunkEvents) ||
+        (c->eventIndex + (uint64_t) c->nrEvents * sizeof(EventIndexEntry) > end) ||
+        (c->fragmentIndex + (uint64_t) c->nrFragments * sizeof(FragmentIndexEntry) > end))
+    {
+      *Err << "EventFileReader: Index of " << name << " is corrupt!\n";
+      close();
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void EventFileReader::close(void)
+{
+  if (map)
+    munmap((void *) map, mapSize);
+
+  map = 0;
+  mapSize = 0;
+  trailer = 0;
+  chunks = 0;
+}
+
+const EventIndexEntry *EventFileReader::entry(uint64_t n) const
+{
+  const EventChunkEntry *c;
+  const EventIndexEntry *e;
+
+  if ((!trailer) || (n >= trailer->nrEvents))
+    return 0;
+
+  c = &chunks[n / trailer->chunkEvents];
+  n %= trailer->chunkEvents;
+  if (n >= c->nrEvents)
+    return 0;
+
+  e = (const EventIndexEntry *) (map + c->eventIndex) + n;
+  if (e->offset + e->size > mapSize)
+    return 0;
+
+  return e;
+}
+
+//----------------------------------------------------------------------------
+//  Get event number 'n'
+//     returns 0 on success, -1 if there is no such event
+//----------------------------------------------------------------------------
+int EventFileReader::getEvent(uint64_t n, EventFileEvent &ev) const
+{
+  const EventIndexEntry *e = entry(n);
+
+  if (!e)
+    return -1;
+
+  ev.data = map + e->offset;
+  ev.size = e->size;
+  ev.trigger = e->trigger;
+  ev.nrFragments = e->nrFragments;
+
+  return 0;
+}
+
+const void *EventFileReader::getFragment(uint64_t n, uint32_t id, uint32_t *length) const
+{
+  const EventIndexEntry *e = entry(n);
+  const EventChunkEntry *c;
+  const FragmentIndexEntry *f;
+  EventFragmentHeader hdr;
+  unsigned int i;
+
+  if (!e)
+    return 0;
+
+  c = &chunks[n / trailer->chunkEvents];
+  if ((uint64_t) e->firstFragment + e->nrFragments > c->nrFragments)
+    return 0;
+
+  f = (const FragmentIndexEntry *) (map + c->fragmentIndex) + e->firstFragment;
+  for (i = 0; i < e->nrFragments; i++)
+  {
+    if (f[i].id != id)
+      continue;
+
+    if ((uint64_t) f[i].offset + sizeof(hdr) > e->size)
+      return 0;
+
+    memcpy(&hdr, map + e->offset + f[i].offset, sizeof(hdr));
+    if ((uint64_t) f[i].offset + sizeof(hdr) + hdr.length > e->size)
+      return 0;
+
+    if (length)
+      *length = hdr.length;
+
+    return map + e->offset + f[i].offset + sizeof(hdr);
+  }
+
+  return 0;
+}
+
+int64_t EventFileReader::findTrigger(uint32_t trigger) const
+{
+  const EventIndexEntry *e;
+  uint64_t lo = 0, hi = getEventCount(), mid;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if ((e = entry(mid)) == 0)
+      return -1;
+
+    if (e->trigger < trigger)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (((e = entry(lo)) == 0) || (e->trigger != trigger))
+    return -1;
+
+  return lo;
+}
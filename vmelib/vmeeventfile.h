@@ -0,0 +1,205 @@
+/*
+ Definition of classes EventFileWriter and EventFileReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEEVENTFILE_H
+#define VMEEVENTFILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "vmeeventbuilder.h"
+#include "vmerecorder.h"
+
+//----------------------------------------------------------------------------
+//  Event file format, all values in host byte order:
+//
+//      EventFileHeader
+//      event data, chunk 0        (padded to 8 bytes per event)
+//      EventIndexEntry[]          index of chunk 0
+//      FragmentIndexEntry[]
+//      event data, chunk 1
+//      ...
+//      EventChunkEntry[]          one per chunk
+//      EventFileTrailer           last bytes of the file
+//
+//  Each chunk holds 'chunkEvents' events (the last one fewer), so event n
+//  is entry n % chunkEvents of chunk n / chunkEvents. The fragment index
+//  lists the EventFragmentHeaders found in each event (EventBuilder
+//  format), offsets are relative to the start of the event.
+//----------------------------------------------------------------------------
+
+#define EVENTFILE_MAGIC    "VMEEVTF1"
+#define EVENTFILE_END      "VMEEVTE1"
+#define EVENTFILE_VERSION  1
+
+struct EventFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t chunkEvents;
+  uint64_t created;          // time(), seconds
+};
+
+struct EventIndexEntry
+{
+  uint64_t offset;           // of the event in the file
+  uint32_t size;             // bytes without padding
+  uint32_t trigger;
+  uint32_t firstFragment;    // in the fragment index of the chunk
+  uint32_t nrFragments;
+};
+
+struct FragmentIndexEntry
+{
+  uint32_t id;               // module id
+  uint32_t offset;           // of the EventFragmentHeader in the event
+};
+
+struct EventChunkEntry
+{
+  uint64_t eventIndex;       // file offset of the EventIndexEntry[]
+  uint64_t fragmentIndex;    // file offset of the FragmentIndexEntry[]
+  uint32_t nrEvents;
+  uint32_t nrFragments;
+};
+
+struct EventFileTrailer
+{
+  uint64_t chunkTable;       // file offset of the EventChunkEntry[]
+  uint64_t nrEvents;
+  uint32_t nrChunks;
+  uint32_t chunkEvents;
+  char magic[8];
+};
+
+//----------------------------------------------------------------------------
+//  EventFileWriter: writes events through a Recorder (O_DIRECT, writes in
+//  flight), the index of a chunk is kept in memory until the chunk is full.
+//  close() writes the chunk table and the trailer, a file without them
+//  can't be opened by EventFileReader.
+//----------------------------------------------------------------------------
+
+class EventFileWriter
+{
+private:
+  Recorder rec;
+  uint32_t chunkEvents;
+  std::vector<EventIndexEntry> events;
+  std::vector<FragmentIndexEntry> fragments;
+  std::vector<EventChunkEntry> chunks;
+  uint64_t nrEvents;
+
+  int writeChunk(void);
+
+  EventFileWriter(const EventFileWriter &);
+  EventFileWriter &operator=(const EventFileWriter &);
+
+public:
+  EventFileWriter(unsigned int nrBuffers = 8, unsigned int bufSize = 0x100000);
+  virtual ~EventFileWriter();
+
+  int open(const char *name, unsigned int chunkEvents = 4096);
+  int close(void);
+
+  // 'indexFragments': event is in EventBuilder format, index its fragments
+
+  int write(const void *event, unsigned int size, uint32_t trigger, bool indexFragments = true);
+
+  uint64_t getEvents(void) const
+  {
+    return nrEvents;
+  }
+
+  Recorder &getRecorder(void)
+  {
+    return rec;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+    rec.setErrorlog(log);
+  }
+};
+
+// event returned by EventFileReader, points into the mapped file
+
+struct EventFileEvent
+{
+  const unsigned char *data;
+  uint32_t size;
+  uint32_t trigger;
+  uint32_t nrFragments;
+};
+
+//----------------------------------------------------------------------------
+//  EventFileReader: maps an event file, events and fragments are found by
+//  the index without reading the data in front of them.
+//----------------------------------------------------------------------------
+
+class EventFileReader
+{
+private:
+  const unsigned char *map;
+  size_t mapSize;
+  const EventFileTrailer *trailer;
+  const EventChunkEntry *chunks;
+
+  const EventIndexEntry *entry(uint64_t n) const;
+
+  EventFileReader(const EventFileReader &);
+  EventFileReader &operator=(const EventFileReader &);
+
+public:
+  EventFileReader();
+  virtual ~EventFileReader();
+
+  int open(const char *name);
+  void close(void);
+
+  uint64_t getEventCount(void) const
+  {
+    return trailer ? trailer->nrEvents : 0;
+  }
+
+  int getEvent(uint64_t n, EventFileEvent &ev) const;
+
+  // data of module 'id' in event n, 0 if the event has no such fragment
+
+  const void *getFragment(uint64_t n, uint32_t id, uint32_t *length) const;
+
+  // first event with 'trigger', triggers must increase; -1 if not found
+
+  int64_t findTrigger(uint32_t trigger) const;
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -20,6 +20,8 @@
 #define _XOPEN_SOURCE 500
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -27,13 +29,148 @@
 #include <sys/mman.h>
 #include <sys/poll.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COPY_SIMD                  // vector copies through mapped images
+#endif
+
 #include <vector>
 
 #include "vmeioctl.h"
 #include "vmelib.h"
+#include "vmelock.h"
 
 using namespace std;
 
+#define UNI_REG_SIZE  0x1000       // Size of universeII register space
+#define UNI_PCI_CSR   0x0004       // PCI_CSR register offset
+#define UNI_CSR_S_TA  0x08000000   // PCI_CSR: signalled target abort
+
+#define ERR_RATE      10           // default error messages per second
+#define COPY_BLOCK    0x400        // bytes copied per bus error check
+#define COPY_WIDE     16           // copy width: widest accesses possible
+
+// last error of the calling thread
+
+static __thread VMEErrorInfo lastErr = { VME_OK, 0, -1 };
+
+static inline void setLastError(int code, unsigned int addr, int image)
+{
+  lastErr.code = code;
+  lastErr.addr = addr;
+  lastErr.image = image;
+}
+
+//----------------------------------------------------------------------------
+//  Last error of the calling thread, set by the access functions on failure
+//----------------------------------------------------------------------------
+VMEErrorInfo VMEBridge::lastError(void)
+{
+  return lastErr;
+}
+
+void VMEBridge::clearLastError(void)
+{
+  setLastError(VME_OK, 0, -1);
+}
+
+const char *VMEBridge::errorText(int code)
+{
+  switch (code)
+  {
+  case VME_OK:
+    return "No error";
+  case VME_BERR_READ:
+    return "Bus error reading";
+  case VME_BERR_WRITE:
+    return "Bus error writing";
+  case VME_NOT_MAPPED:
+    return "Address not mapped";
+  case VME_NO_IMAGE:
+    return "No image";
+  case VME_BAD_WIDTH:
+    return "Wrong data width";
+  default:
+    return "Unknown error";
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Set error sink and rate limit (errors per second, 0: no messages)
+//----------------------------------------------------------------------------
+void VMEBridge::setErrorSink(VMEErrorSink sink, void *arg)
+{
+  errSinkArg = arg;
+  errSink = sink;
+}
+
+void VMEBridge::setErrorRate(unsigned int perSecond)
+{
+  errRate = perSecond;
+}
+
+//----------------------------------------------------------------------------
+//  Store error in last error slot and pass it on if the rate limit allows.
+//  No text is formatted for suppressed errors.
+//----------------------------------------------------------------------------
+void VMEBridge::reportError(int code, unsigned int addr, int image)
+{
+  struct timespec ts;
+  long window;
+  unsigned int suppressed;
+
+  setLastError(code, addr, image);
+
+  if (!errRate)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  window = errWindow;
+  if ((ts.tv_sec != window) && __sync_bool_compare_and_swap(&errWindow, window, ts.tv_sec))
+    __sync_lock_test_and_set(&errCount, 0);
+
+  if (__sync_add_and_fetch(&errCount, 1) > errRate)
+  {
+    __sync_add_and_fetch(&errSuppressed, 1);
+    return;
+  }
+
+  suppressed = __sync_lock_test_and_set(&errSuppressed, 0);
+
+  if (errSink)
+    errSink(lastErr, suppressed, errSinkArg);
+  else
+    logError(lastErr, suppressed);
+}
+
+//----------------------------------------------------------------------------
+//  Default sink: write message to error log
+//----------------------------------------------------------------------------
+void VMEBridge::logError(const VMEErrorInfo &err, unsigned int suppressed)
+{
+  char msg[160];
+  int n = 0;
+
+  if (suppressed)
+    n = snprintf(msg, 64, "(%u error messages suppressed)\n", suppressed);
+
+  switch (err.code)
+  {
+  case VME_BERR_READ:
+  case VME_BERR_WRITE:
+    n += snprintf(msg + n, sizeof(msg) - n, "%s at address 0x%x, image %d!\n", errorText(err.code), err.addr, err.image);
+    break;
+  case VME_NO_IMAGE:
+    n += snprintf(msg + n, sizeof(msg) - n, "Address %x is not supported by any image!\n", err.addr);
+    break;
+  default:
+    n += snprintf(msg + n, sizeof(msg) - n, "%s at address 0x%x!\n", errorText(err.code), err.addr);
+    break;
+  }
+
+  Err->write(msg, n);
+}
+
 //----------------------------------------------------------------------------
 //  initiates VME SYSRST
 //----------------------------------------------------------------------------
@@ -100,12 +237,18 @@ void VMEBridge::writeUniReg(int reg, unsigned int data)
 //----------------------------------------------------------------------------
 int VMEBridge::rl(int image, unsigned int addr, unsigned int *data, int size)
 {
-  if (image > 7)
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
     return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
 
   if (pread(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x40000000) != size)
   {
-    *Err << "Bus error reading at address 0x" << hex << addr << dec << ", image " << image << "!\n";
+    reportError(VME_BERR_READ, addr, image);
     return -1;
   }
 
@@ -122,12 +265,18 @@ int VMEBridge::rl(int image, unsigned int addr, unsigned int *data)
 //----------------------------------------------------------------------------
 int VMEBridge::wl(int image, unsigned int addr, unsigned int *data, int size)
 {
-  if (image > 7)
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
     return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
 
   if (pwrite(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x40000000) != size)
   {
-    *Err << "Bus error writing at address 0x" << hex << addr << dec << ", image " << image << "!\n";
+    reportError(VME_BERR_WRITE, addr, image);
     return -1;
   }
 
@@ -149,12 +298,18 @@ int VMEBridge::wl(int image, unsigned int addr, unsigned int *data)
 //----------------------------------------------------------------------------
 int VMEBridge::rw(int image, unsigned int addr, unsigned short *data, int size)
 {
-  if (image > 7)
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
     return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
 
   if (pread(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x20000000) != size)
   {
-    *Err << "Bus error reading at address 0x" << hex << addr << dec << ", image " << image << "!\n";
+    reportError(VME_BERR_READ, addr, image);
     return -1;
   }
 
@@ -171,86 +326,874 @@ int VMEBridge::rw(int image, unsigned int addr, unsigned short *data)
 //----------------------------------------------------------------------------
 int VMEBridge::ww(int image, unsigned int addr, unsigned short *data, int size)
 {
-  if (image > 7)
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
+
+  if (pwrite(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x20000000) != size)
+  {
+    reportError(VME_BERR_WRITE, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::ww(int image, unsigned int addr, unsigned short data)
+{
+  return ww(image, addr, &data, 2);
+}
+
+int VMEBridge::ww(int image, unsigned int addr, unsigned short *data)
+{
+  return ww(image, addr, data, 2);
+}
+
+//----------------------------------------------------------------------------
+//  Read one or more byte(s) from 'addr' and store in 'data'
+//----------------------------------------------------------------------------
+int VMEBridge::rb(int image, unsigned int addr, unsigned char *data, int size)
+{
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
+
+  if (pread(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x10000000) != size)
+  {
+    reportError(VME_BERR_READ, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::rb(int image, unsigned int addr, unsigned char *data)
+{
+  return rb(image, addr, data, 1);
+}
+
+//----------------------------------------------------------------------------
+//  Write one or more byte(s) from 'data' to 'addr'
+//----------------------------------------------------------------------------
+int VMEBridge::wb(int image, unsigned int addr, unsigned char *data, int size)
+{
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
     return -2; // this is no master image
+  }
+
+  VMEReadLock guard(imageLock[image]);
+  VMEReadLock berrGuard(berrLock);        // see testBerrDirect()
+
+  if (pwrite(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x10000000) != size)
+  {
+    reportError(VME_BERR_WRITE, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::wb(int image, unsigned int addr, unsigned char data)
+{
+  return wb(image, addr, &data, 1);
+}
+
+int VMEBridge::wb(int image, unsigned int addr, unsigned char *data)
+{
+  return wb(image, addr, data, 1);
+}
+
+//----------------------------------------------------------------------------
+//  Execute a batch of single accesses. The driver processes up to
+//  BATCH_MAX_OPS accesses per system call and stops at the first bus error.
+//     returns the number of accesses executed successfully, i.e. the index
+//     of the access causing a bus error, or ops.size() if there was none.
+//     -1 is returned for invalid parameters, -2 if the driver failed.
+//----------------------------------------------------------------------------
+int VMEBridge::executeBatch(vector<VMEBatchOp> &ops)
+{
+  unsigned int i, used;
+  int ret;
+
+  used = 0;
+  for (i = 0; i < ops.size(); i++)
+  {
+    if ((ops[i].image < 0) || (ops[i].image > 7))
+    {
+      *Err << "executeBatch: Access " << i << " uses invalid image " << ops[i].image << "!\n";
+      return -1;
+    }
+    if ((ops[i].width != 1) && (ops[i].width != 2) && (ops[i].width != 4))
+    {
+      *Err << "executeBatch: Access " << i << " has invalid width " << ops[i].width << "!\n";
+      return -1;
+    }
+    used |= 1 << ops[i].image;
+  }
+
+  // lock the images in ascending order, the batch sees a consistent mapping
+
+  for (i = 0; i < 8; i++)
+    if (used & (1 << i))
+      pthread_rwlock_rdlock(&imageLock[i]);
+
+  ret = runBatch(ops);
+
+  for (i = 0; i < 8; i++)
+    if (used & (1 << i))
+      pthread_rwlock_unlock(&imageLock[i]);
+
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+//  executeBatch with the images locked
+//----------------------------------------------------------------------------
+int VMEBridge::runBatch(vector<VMEBatchOp> &ops)
+{
+  unsigned int i, n, done;
+  batch_op_t bops[BATCH_MAX_OPS];
+  batch_param_t param;
+  int ret;
+
+  for (i = 0; i < ops.size(); i++)
+    if (vme_handle[ops[i].image] == -1)
+    {
+      *Err << "executeBatch: Access " << i << " uses invalid image " << ops[i].image << "!\n";
+      return -1;
+    }
+
+  for (done = 0; done < ops.size(); done += n)
+  {
+    n = ops.size() - done;
+    if (n > BATCH_MAX_OPS)
+      n = BATCH_MAX_OPS;
+
+    for (i = 0; i < n; i++)
+    {
+      const VMEBatchOp &op = ops[done + i];
+
+      bops[i].image = op.image;
+      bops[i].offset = op.addr - vmeBaseAddr[op.image];
+      bops[i].width = op.width;
+      bops[i].write = op.write;
+      bops[i].data = op.data;
+    }
+
+    param.ops = (uintptr_t) bops;
+    param.count = n;
+    param.berr = -1;
+
+    pthread_rwlock_rdlock(&berrLock);
+    ret = ioctl(uni_handle, IOCTL_EXEC_BATCH, &param);
+    pthread_rwlock_unlock(&berrLock);
+
+    if (ret != 0)
+    {
+      *Err << "executeBatch: Driver can't execute accesses " << done << ".." << done + n - 1 << "!\n";
+      return -2;
+    }
+
+    if (param.berr >= 0)
+      n = param.berr;
+
+    for (i = 0; i < n; i++)
+      if (!bops[i].write)
+        ops[done + i].data = bops[i].data;
+
+    if (param.berr >= 0)
+    {
+      const VMEBatchOp &op = ops[done + n];
+
+      reportError(op.write ? VME_BERR_WRITE : VME_BERR_READ, op.addr, op.image);
+      return done + n;
+    }
+  }
+
+  return ops.size();
+}
+
+//----------------------------------------------------------------------------
+//  Test if a Bus Error occured
+//----------------------------------------------------------------------------
+int VMEBridge::testBerr()
+{
+  int berr;
+
+  if (uniRegs)
+  {
+    pthread_rwlock_wrlock(&berrLock);
+    berr = testBerrDirect();
+    pthread_rwlock_unlock(&berrLock);
+    return berr;
+  }
+
+  if (ioctl(uni_handle, IOCTL_TEST_BERR, 0ul))
+    return 1;
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Test and clear a Bus Error using the mapped PCI_CSR register. The
+//  driver clears S_TA after its own accesses, so berrLock must be held
+//  exclusive from the access to this test. System calls accessing the bus
+//  hold it shared: the driver serializes them, they only must not run
+//  between a direct access and its test. That covers the threads of this
+//  process only.
+//----------------------------------------------------------------------------
+int VMEBridge::testBerrDirect(void)
+{
+  uint32_t csr = uniRegs[UNI_PCI_CSR / 4];
+
+  if (csr & UNI_CSR_S_TA)
+  {
+    uniRegs[UNI_PCI_CSR / 4] = csr;   // S_TA is cleared by writing 1
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Get mapped address of 'addr' for a direct access of 'width' bytes
+//    returns 0 if 'image' is no mapped master image or 'addr' is outside
+//----------------------------------------------------------------------------
+uintptr_t VMEBridge::directAddr(int image, unsigned int addr, unsigned int width)
+{
+  unsigned int offset;
+
+  if ((image < 0) || (image > 7) || (!vmeImageBase[image]))
+    return 0;
+
+  offset = addr - vmeBaseAddr[image];
+  if ((offset > vmeImageSize[image]) || (vmeImageSize[image] - offset < width))
+    return 0;
+
+  return vmeImageBase[image] + offset;
+}
+
+//----------------------------------------------------------------------------
+//  Read/write a single long word, word or byte through the mapped image.
+//  The registers must be mapped to check for bus errors, otherwise the
+//  access falls back to the system call based functions above.
+//     returns 0 on success, -1 on bus error, -2 if 'addr' is not mapped
+//----------------------------------------------------------------------------
+int VMEBridge::rlDirect(int image, unsigned int addr, unsigned int *data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return rl(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 4)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *data = *(volatile uint32_t *) ptr;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_READ, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::wlDirect(int image, unsigned int addr, unsigned int data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return wl(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 4)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *(volatile uint32_t *) ptr = data;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_WRITE, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::rwDirect(int image, unsigned int addr, unsigned short *data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return rw(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 2)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *data = *(volatile uint16_t *) ptr;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_READ, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::wwDirect(int image, unsigned int addr, unsigned short data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return ww(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 2)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *(volatile uint16_t *) ptr = data;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_WRITE, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::rbDirect(int image, unsigned int addr, unsigned char *data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return rb(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 1)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *data = *(volatile uint8_t *) ptr;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_READ, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+int VMEBridge::wbDirect(int image, unsigned int addr, unsigned char data)
+{
+  uintptr_t ptr;
+  int berr;
+
+  if (!uniRegs)
+    return wb(image, addr, data);
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, 1)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  pthread_rwlock_wrlock(&berrLock);
+  *(volatile uint8_t *) ptr = data;
+  berr = testBerrDirect();
+  pthread_rwlock_unlock(&berrLock);
+
+  if (berr)
+  {
+    reportError(VME_BERR_WRITE, addr, image);
+    return -1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Copy 'n' bytes from/to mapped VME memory in accesses of 'width' bytes
+//----------------------------------------------------------------------------
+static void readWindow(uintptr_t src, unsigned char *dst, unsigned int n, int width)
+{
+  unsigned int i;
+  uint32_t l;
+  uint16_t w;
+
+  if (width == 4)
+    for (i = 0; i < n; i += 4)
+    {
+      l = *(volatile uint32_t *) (src + i);
+      memcpy(dst + i, &l, 4);
+    }
+  else if (width == 2)
+    for (i = 0; i < n; i += 2)
+    {
+      w = *(volatile uint16_t *) (src + i);
+      memcpy(dst + i, &w, 2);
+    }
+  else
+    for (i = 0; i < n; i++)
+      dst[i] = *(volatile uint8_t *) (src + i);
+}
+
+static void writeWindow(uintptr_t dst, const unsigned char *src, unsigned int n, int width)
+{
+  unsigned int i;
+  uint32_t l;
+  uint16_t w;
+
+  if (width == 4)
+    for (i = 0; i < n; i += 4)
+    {
+      memcpy(&l, src + i, 4);
+      *(volatile uint32_t *) (dst + i) = l;
+    }
+  else if (width == 2)
+    for (i = 0; i < n; i += 2)
+    {
+      memcpy(&w, src + i, 2);
+      *(volatile uint16_t *) (dst + i) = w;
+    }
+  else
+    for (i = 0; i < n; i++)
+      *(volatile uint8_t *) (dst + i) = src[i];
+}
+
+#ifdef COPY_SIMD
+
+//----------------------------------------------------------------------------
+//  Vector copies, 'win' is 16 byte aligned and 'n' a multiple of 16. The
+//  window is accessed by streaming loads/stores where the CPU has them,
+//  the fence completes all accesses before the bus error check.
+//----------------------------------------------------------------------------
+typedef void (*ReadKernel)(uintptr_t win, unsigned char *dst, unsigned int n);
+typedef void (*WriteKernel)(uintptr_t win, const unsigned char *src, unsigned int n);
+
+__attribute__((target("sse2")))
+static void readSse2(uintptr_t win, unsigned char *dst, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i += 16)
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_load_si128((const __m128i *) (win + i)));
+  _mm_mfence();
+}
+
+__attribute__((target("sse4.1")))
+static void readSse41(uintptr_t win, unsigned char *dst, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i += 16)
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_stream_load_si128((__m128i *) (win + i)));
+  _mm_mfence();
+}
+
+__attribute__((target("avx2")))
+static void readAvx2(uintptr_t win, unsigned char *dst, unsigned int n)
+{
+  unsigned int i = 0;
+
+  if (win & 16)
+  {
+    _mm_storeu_si128((__m128i *) dst, _mm_stream_load_si128((__m128i *) win));
+    i = 16;
+  }
+
+  for (; i + 32 <= n; i += 32)
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_stream_load_si256((__m256i *) (win + i)));
+
+  if (i < n)
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_stream_load_si128((__m128i *) (win + i)));
+  _mm_mfence();
+}
+
+__attribute__((target("sse2")))
+static void writeSse2(uintptr_t win, const unsigned char *src, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i += 16)
+    _mm_stream_si128((__m128i *) (win + i), _mm_loadu_si128((const __m128i *) (src + i)));
+  _mm_sfence();
+}
+
+__attribute__((target("avx")))
+static void writeAvx(uintptr_t win, const unsigned char *src, unsigned int n)
+{
+  unsigned int i = 0;
+
+  if (win & 16)
+  {
+    _mm_stream_si128((__m128i *) win, _mm_loadu_si128((const __m128i *) src));
+    i = 16;
+  }
+
+  for (; i + 32 <= n; i += 32)
+    _mm256_stream_si256((__m256i *) (win + i), _mm256_loadu_si256((const __m256i *) (src + i)));
+
+  if (i < n)
+    _mm_stream_si128((__m128i *) (win + i), _mm_loadu_si128((const __m128i *) (src + i)));
+  _mm_sfence();
+}
+
+static ReadKernel selectRead(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return readAvx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return readSse41;
+  if (__builtin_cpu_supports("sse2"))
+    return readSse2;
+  return 0;
+}
+
+static WriteKernel selectWrite(void)
+{
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx"))
+    return writeAvx;
+  if (__builtin_cpu_supports("sse2"))
+    return writeSse2;
+  return 0;
+}
+
+static const ReadKernel readVector = selectRead();
+static const WriteKernel writeVector = selectWrite();
+
+#endif
+
+//----------------------------------------------------------------------------
+//  Copy 'n' bytes from/to mapped VME memory by the widest accesses
+//  possible, 'win' and 'n' must be multiples of 4. Unaligned head and tail
+//  are copied by long words.
+//----------------------------------------------------------------------------
+static void readWide(uintptr_t win, unsigned char *dst, unsigned int n)
+{
+  unsigned int head = 0;
+
+#ifdef COPY_SIMD
+  unsigned int body;
+
+  if (readVector)
+  {
+    head = (16 - (win & 15)) & 15;
+    if (head > n)
+      head = n;
+    body = (n - head) & ~15;
+
+    readWindow(win, dst, head, 4);
+    if (body)
+      readVector(win + head, dst + head, body);
+    head += body;
+  }
+#endif
+
+  readWindow(win + head, dst + head, n - head, 4);
+}
+
+static void writeWide(uintptr_t win, const unsigned char *src, unsigned int n)
+{
+  unsigned int head = 0;
+
+#ifdef COPY_SIMD
+  unsigned int body;
+
+  if (writeVector)
+  {
+    head = (16 - (win & 15)) & 15;
+    if (head > n)
+      head = n;
+    body = (n - head) & ~15;
+
+    writeWindow(win, src, head, 4);
+    if (body)
+      writeVector(win + head, src + head, body);
+    head += body;
+  }
+#endif
+
+  writeWindow(win + head, src + head, n - head, 4);
+}
+
+//----------------------------------------------------------------------------
+//  Copy width for an image of data width 'vdw'. The universe splits wider
+//  PCI accesses into cycles of the image's width, D32 and D64 images are
+//  copied by vector accesses. D16 and D8 images get accesses of their width.
+//----------------------------------------------------------------------------
+static int copyWidth(int vdw)
+{
+  return (vdw == D8) ? 1 : (vdw == D16) ? 2 : COPY_WIDE;
+}
+
+//----------------------------------------------------------------------------
+//  Copy 'size' bytes between the mapped image and 'buf'. Bus errors are
+//  checked once per COPY_BLOCK bytes, the address of the failed block is
+//  given by lastError(). Without mapped registers the block pread/pwrite
+//  functions are used.
+//     returns 0 on success, -1 on bus error, -2 if 'addr' is not mapped
+//----------------------------------------------------------------------------
+int VMEBridge::copyFromWindow(int image, unsigned int addr, void *buf, unsigned int size, int width)
+{
+  unsigned char *dst = (unsigned char *) buf;
+  unsigned int done, n;
+  uintptr_t ptr;
+  int unit, berr;
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  if (!width)
+  {
+    VMEReadLock guard(imageLock[image]);
+    width = copyWidth(vmeImageWidth[image]);
+  }
+
+  unit = (width == COPY_WIDE) ? 4 : width;
+  if (((unit != 1) && (unit != 2) && (unit != 4)) || (addr % unit) || (size % unit))
+  {
+    setLastError(VME_BAD_WIDTH, addr, image);
+    return -2;
+  }
+
+  if (!uniRegs)
+  {
+    if (unit == 4)
+      return rl(image, addr, (unsigned int *) buf, size);
+    if (unit == 2)
+      return rw(image, addr, (unsigned short *) buf, size);
+    return rb(image, addr, (unsigned char *) buf, size);
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
+  if ((ptr = directAddr(image, addr, size)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
+
+  for (done = 0; done < size; done += n)
+  {
+    n = (size - done > COPY_BLOCK) ? COPY_BLOCK : size - done;
+
+    pthread_rwlock_wrlock(&berrLock);
+    if (width == COPY_WIDE)
+      readWide(ptr + done, dst + done, n);
+    else
+      readWindow(ptr + done, dst + done, n, width);
+    berr = testBerrDirect();
+    pthread_rwlock_unlock(&berrLock);
+
+    if (berr)
+    {
+      reportError(VME_BERR_READ, addr + done, image);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int VMEBridge::copyToWindow(int image, unsigned int addr, const void *buf, unsigned int size, int width)
+{
+  const unsigned char *src = (const unsigned char *) buf;
+  unsigned int done, n;
+  uintptr_t ptr;
+  int unit, berr;
+
+  if ((image < 0) || (image > 7))
+  {
+    setLastError(VME_NO_IMAGE, addr, image);
+    return -2;
+  }
+
+  if (!width)
+  {
+    VMEReadLock guard(imageLock[image]);
+    width = copyWidth(vmeImageWidth[image]);
+  }
+
+  unit = (width == COPY_WIDE) ? 4 : width;
+  if (((unit != 1) && (unit != 2) && (unit != 4)) || (addr % unit) || (size % unit))
+  {
+    setLastError(VME_BAD_WIDTH, addr, image);
+    return -2;
+  }
 
-  if (pwrite(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x20000000) != size)
+  if (!uniRegs)
   {
-    *Err << "Bus error writing at address 0x" << hex << addr << dec << ", image " << image << "!\n";
-    return -1;
+    if (unit == 4)
+      return wl(image, addr, (unsigned int *) buf, size);
+    if (unit == 2)
+      return ww(image, addr, (unsigned short *) buf, size);
+    return wb(image, addr, (unsigned char *) buf, size);
   }
 
-  return 0;
-}
+  VMEReadLock guard(imageLock[image]);
 
-int VMEBridge::ww(int image, unsigned int addr, unsigned short data)
-{
-  return ww(image, addr, &data, 2);
-}
+  if ((ptr = directAddr(image, addr, size)) == 0)
+  {
+    setLastError(VME_NOT_MAPPED, addr, image);
+    return -2;
+  }
 
-int VMEBridge::ww(int image, unsigned int addr, unsigned short *data)
-{
-  return ww(image, addr, data, 2);
-}
+  for (done = 0; done < size; done += n)
+  {
+    n = (size - done > COPY_BLOCK) ? COPY_BLOCK : size - done;
 
-//----------------------------------------------------------------------------
-//  Read one or more byte(s) from 'addr' and store in 'data'
-//----------------------------------------------------------------------------
-int VMEBridge::rb(int image, unsigned int addr, unsigned char *data, int size)
-{
-  if (image > 7)
-    return -2; // this is no master image
+    pthread_rwlock_wrlock(&berrLock);
+    if (width == COPY_WIDE)
+      writeWide(ptr + done, src + done, n);
+    else
+      writeWindow(ptr + done, src + done, n, width);
+    berr = testBerrDirect();
+    pthread_rwlock_unlock(&berrLock);
 
-  if (pread(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x10000000) != size)
-  {
-    *Err << "Bus error reading at address 0x" << hex << addr << dec << ", image " << image << "!\n";
-    return -1;
+    if (berr)
+    {
+      reportError(VME_BERR_WRITE, addr + done, image);
+      return -1;
+    }
   }
 
   return 0;
 }
 
-int VMEBridge::rb(int image, unsigned int addr, unsigned char *data)
-{
-  return rb(image, addr, data, 1);
-}
-
 //----------------------------------------------------------------------------
-//  Write one or more byte(s) from 'data' to 'addr'
+//  Attach memory mapped elsewhere as master image 'image' covering VME
+//  range [vmeBase, vmeBase + size) with data width 'vdw'. Intended to run
+//  the direct access functions against a simulated image; base = 0
+//  detaches the image.
 //----------------------------------------------------------------------------
-int VMEBridge::wb(int image, unsigned int addr, unsigned char *data, int size)
+int VMEBridge::attachImage(int image, uintptr_t base, unsigned int vmeBase, unsigned int size, int vdw)
 {
-  if (image > 7)
-    return -2; // this is no master image
-
-  if (pwrite(vme_handle[image], data, size, (addr - vmeBaseAddr[image]) | 0x10000000) != size)
+  if ((image < 0) || (image > 7) || (vme_handle[image] != -1))
   {
-    *Err << "Bus error writing at address 0x" << hex << addr << dec << ", image " << image << "!\n";
+    *Err << "attachImage: Image nr. " << image << " is invalid or in use!\n";
     return -1;
   }
 
-  return 0;
-}
+  VMEWriteLock guard(imageLock[image]);
 
-int VMEBridge::wb(int image, unsigned int addr, unsigned char data)
-{
-  return wb(image, addr, &data, 1);
-}
+  vmeImageBase[image] = base;
+  vmeBaseAddr[image] = base ? vmeBase : 0;
+  vmeImageSize[image] = base ? size : 0;
+  vmeImageWidth[image] = vdw;
 
-int VMEBridge::wb(int image, unsigned int addr, unsigned char *data)
-{
-  return wb(image, addr, data, 1);
+  return 0;
 }
 
 //----------------------------------------------------------------------------
-//  Test if a Bus Error occured
+//  Use 'regs' as universeII register space for bus error checks
+//  (regs = 0 restores the system call based checks)
 //----------------------------------------------------------------------------
-int VMEBridge::testBerr()
+void VMEBridge::attachRegisters(uintptr_t regs)
 {
-  if (ioctl(uni_handle, IOCTL_TEST_BERR, 0ul))
-    return 1;
-
-  return 0;
+  uniRegs = (volatile uint32_t *) regs;
 }
 
 //----------------------------------------------------------------------------
@@ -264,19 +1207,22 @@ int VMEBridge::there(unsigned int addr, unsigned int mode)
   tdata.addr = addr;
   tdata.mode = mode;
 
+  pthread_rwlock_rdlock(&berrLock);
   result = ioctl(uni_handle, IOCTL_TEST_ADDR, &tdata);
+  pthread_rwlock_unlock(&berrLock);
 
   switch (result)
   {
   case 1:
     return 1;
   case -1:
-    *Err << "Address " << hex << addr << dec << " is not supported by any image!\n";
+    reportError(VME_NO_IMAGE, addr, -1);
     return 0;
   case -2:
-    *Err << "Wrong data width!\n";
+    reportError(VME_BAD_WIDTH, addr, -1);
     return 0;
   default:
+    setLastError(VME_BERR_READ, addr, -1);
     return 0;
   }
 
@@ -333,6 +1279,14 @@ int VMEBridge::setupIrq(int image, unsigned int irqLevel, unsigned int statusID,
   if (checkIrqParamter(irqLevel, statusID) != 0)
     return -1;
 
+  if ((image < 0) || (image > 17))
+  {
+    *Err << "Image nr. " << image << " is invalid!\n";
+    return -1;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
   irqsetup.vmeIrq = irqLevel;
   irqsetup.vmeStatus = statusID;
   irqsetup.vmeAddrSt = addrSt;
@@ -359,6 +1313,14 @@ int VMEBridge::freeIrq(int image, unsigned int irqLevel, unsigned int statusID)
   if (checkIrqParamter(irqLevel, statusID) != 0)
     return -1;
 
+  if ((image < 0) || (image > 17))
+  {
+    *Err << "Image nr. " << image << " is invalid!\n";
+    return -1;
+  }
+
+  VMEReadLock guard(imageLock[image]);
+
   irqsetup.vmeIrq = irqLevel;
   irqsetup.vmeStatus = statusID;
 
@@ -533,6 +1495,8 @@ uintptr_t VMEBridge::requestDMA(int nrOfBufs)
     return 0;
   }
 
+  VMEWriteLock guard(dmaLock);
+
   dmaImageSize = 0x20000;
   dmaBufSize = 0x20000 / nrOfBufs;
   dmaMaxBuf = nrOfBufs - 1;
@@ -556,14 +1520,32 @@ int VMEBridge::enableBltUntilBerr(void)
 
 uintptr_t VMEBridge::getDMABase(void)
 {
+  VMEReadLock guard(dmaLock);
   return dmaImageBase;
 }
 
+//----------------------------------------------------------------------------
+//  Size and number of DMA buffers set up by requestDMA
+//----------------------------------------------------------------------------
+unsigned int VMEBridge::getDMABufSize(void)
+{
+  VMEReadLock guard(dmaLock);
+  return dmaBufSize;
+}
+
+unsigned int VMEBridge::getDMABufCount(void)
+{
+  VMEReadLock guard(dmaLock);
+  return dmaBufSize ? dmaMaxBuf + 1 : 0;
+}
+
 //----------------------------------------------------------------------------
 //  Release ownership of UniverseII onboard DMA
 //----------------------------------------------------------------------------
 void VMEBridge::releaseDMA(void)
 {
+  VMEWriteLock guard(dmaLock);
+
   ioctl(dma_handle, IOCTL_RELEASE_DMA, 0ul);
   if (munmap((char *) dmaImageBase, dmaImageSize))
     *Err << "Can't munmap allocated memory for DMA";
@@ -600,6 +1582,7 @@ int VMEBridge::DMAwrite(unsigned int dest, unsigned int count, int vas, int vdw,
 {
   int offset;
   dma_param_t param;
+  VMEReadLock guard(dmaLock);
 
   if (checkDmaParam(count, bufNr) != 0)
     return -1;
@@ -633,6 +1616,7 @@ int VMEBridge::DMAread(unsigned int source, unsigned int count, int vas, int vdw
 {
   int offset;
   dma_param_t param;
+  VMEReadLock guard(dmaLock);
 
   if (checkDmaParam(count, bufNr) != 0)
     return -1;
@@ -659,6 +1643,286 @@ int VMEBridge::DMAread(unsigned int source, unsigned int count, int vas, int vdw
   return DMAread(source, count, vas, vdw, 0);
 }
 
+//----------------------------------------------------------------------------
+//  start DMA transfer without waiting for it to finish
+//----------------------------------------------------------------------------
+VMEDMAFuture VMEBridge::DMAreadAsync(unsigned int source, unsigned int count, int vas, int vdw, unsigned int bufNr)
+{
+  dma_param_t param;
+  VMEReadLock guard(dmaLock);
+
+  if (checkDmaParam(count, bufNr) != 0)
+    return VMEDMAFuture(this, -1);
+
+  param.addr = source;
+  param.count = count;
+  param.vas = vas;
+  param.vdw = vdw;
+  param.dma_ctl = dma_ctl;
+  param.bufNr = bufNr;
+
+  if (ioctl(dma_handle, IOCTL_DMA_START_READ, &param) != 0)
+  {
+    *Err << "Can't start DMA read, DMA busy or not available!\n";
+    return VMEDMAFuture(this, -1);
+  }
+
+  return VMEDMAFuture(this, 0);
+}
+
+VMEDMAFuture VMEBridge::DMAwriteAsync(unsigned int dest, unsigned int count, int vas, int vdw, unsigned int bufNr)
+{
+  dma_param_t param;
+  VMEReadLock guard(dmaLock);
+
+  if (checkDmaParam(count, bufNr) != 0)
+    return VMEDMAFuture(this, -1);
+
+  param.addr = dest;
+  param.count = count;
+  param.vas = vas;
+  param.vdw = vdw;
+  param.dma_ctl = dma_ctl;
+  param.bufNr = bufNr;
+
+  if (ioctl(dma_handle, IOCTL_DMA_START_WRITE, &param) != 0)
+  {
+    *Err << "Can't start DMA write, DMA busy or not available!\n";
+    return VMEDMAFuture(this, -1);
+  }
+
+  return VMEDMAFuture(this, 0);
+}
+
+//----------------------------------------------------------------------------
+//  Wait up to 'timeout' ms (-1: forever) for the asynchronous DMA transfer
+//     returns 1 if finished, 0 if still running, < 0 on error
+//----------------------------------------------------------------------------
+int VMEBridge::DMAresult(int timeout, int *offset, unsigned int *count)
+{
+  int ret;
+  struct pollfd pfd;
+  dma_result_t result;
+
+  pfd.fd = dma_handle;
+  pfd.events = POLLIN;
+
+  ret = poll(&pfd, 1, timeout);
+  if (ret < 0)
+    return -1;
+  if (ret == 0)
+    return 0;
+
+  ret = ioctl(dma_handle, IOCTL_DMA_RESULT, &result);
+  if (ret == 1)
+    return 0;
+
+  if ((ret != 0) || (result.status != 0))
+  {
+    *Err << "DMA error! Asynchronous transfer failed!\n";
+    return -2;
+  }
+
+  *offset = result.offset;
+  *count = result.count;
+
+  return 1;
+}
+
+int VMEBridge::getDMAHandle(void)
+{
+  return dma_handle;
+}
+
+//----------------------------------------------------------------------------
+//  Read 'nbytes' from 'vmeAddr' into 'buf' by DMA. The transfer is split
+//  into chunks fitting a DMA buffer. With two or more buffers the next
+//  chunk is transferred while the previous one is copied to 'buf'.
+//     returns number of bytes read (less with BLT until BERR), < 0 on error
+//----------------------------------------------------------------------------
+int VMEBridge::readLarge(unsigned int vmeAddr, void *buf, unsigned int nbytes, int vas, int vdw)
+{
+  unsigned char *dst = (unsigned char *) buf;
+  unsigned int chunk, n, nextN, done, slot, slotSize, nrBufs;
+  uintptr_t base;
+  int offset, cnt;
+
+  slotSize = getDMABufSize();
+  nrBufs = getDMABufCount();
+  base = getDMABase();
+
+  if ((!nrBufs) || (!base))
+  {
+    *Err << "readLarge: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  // data are placed at an offset of (vmeAddr & 7) in the buffer, chunks
+  // are multiples of 8 so the offset is the same for all of them
+
+  chunk = (slotSize - 8) & ~7;
+  if (nbytes == 0)
+    return 0;
+
+  if (nrBufs == 1)
+  {
+    for (done = 0; done < nbytes; done += n)
+    {
+      n = (nbytes - done > chunk) ? chunk : nbytes - done;
+
+      VMEDMAFuture dma = DMAreadAsync(vmeAddr + done, n, vas, vdw, 0);
+      if ((cnt = dma.get()) < 0)
+        return -2;
+
+      memcpy(dst + done, (const void *) (base + dma.offset()), cnt);
+
+      if ((unsigned int) cnt < n)     // BLT until BERR: no more data
+        return done + cnt;
+    }
+    return nbytes;
+  }
+
+  slot = 0;
+  n = (nbytes > chunk) ? chunk : nbytes;
+  VMEDMAFuture dma = DMAreadAsync(vmeAddr, n, vas, vdw, slot);
+
+  for (done = 0; done < nbytes; done += n, n = nextN, slot ^= 1)
+  {
+    if ((cnt = dma.get()) < 0)
+      return -2;
+
+    offset = dma.offset();
+
+    // start next chunk before copying this one
+
+    nextN = nbytes - done - n;
+    if (nextN > chunk)
+      nextN = chunk;
+
+    if ((nextN) && ((unsigned int) cnt == n))
+      dma = DMAreadAsync(vmeAddr + done + n, nextN, vas, vdw, slot ^ 1);
+
+    memcpy(dst + done, (const void *) (base + slot * slotSize + offset), cnt);
+
+    if ((unsigned int) cnt < n)     // BLT until BERR: no more data
+      return done + cnt;
+  }
+
+  return nbytes;
+}
+
+//----------------------------------------------------------------------------
+//  Write 'nbytes' from 'buf' to 'vmeAddr' by DMA, the next chunk is copied
+//  to the DMA buffer while the previous one is transferred
+//     returns number of bytes written, < 0 on error
+//----------------------------------------------------------------------------
+int VMEBridge::writeLarge(unsigned int vmeAddr, const void *buf, unsigned int nbytes, int vas, int vdw)
+{
+  const unsigned char *src = (const unsigned char *) buf;
+  unsigned int chunk, n, nextN, done, slot, slotSize, nrBufs, offset;
+  uintptr_t base;
+
+  slotSize = getDMABufSize();
+  nrBufs = getDMABufCount();
+  base = getDMABase();
+
+  if ((!nrBufs) || (!base))
+  {
+    *Err << "writeLarge: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  chunk = (slotSize - 8) & ~7;
+  offset = vmeAddr & 0x7;
+  if (nbytes == 0)
+    return 0;
+
+  if (nrBufs == 1)
+  {
+    for (done = 0; done < nbytes; done += n)
+    {
+      n = (nbytes - done > chunk) ? chunk : nbytes - done;
+
+      memcpy((void *) (base + offset), src + done, n);
+      if (DMAwrite(vmeAddr + done, n, vas, vdw, 0) < 0)
+        return -2;
+    }
+    return nbytes;
+  }
+
+  slot = 0;
+  n = (nbytes > chunk) ? chunk : nbytes;
+  memcpy((void *) (base + offset), src, n);
+  VMEDMAFuture dma = DMAwriteAsync(vmeAddr, n, vas, vdw, slot);
+
+  for (done = 0; done < nbytes; done += n, n = nextN, slot ^= 1)
+  {
+    nextN = nbytes - done - n;
+    if (nextN > chunk)
+      nextN = chunk;
+
+    if (nextN)
+      memcpy((void *) (base + (slot ^ 1) * slotSize + offset), src + done + n, nextN);
+
+    if (dma.get() < 0)
+      return -2;
+
+    if (nextN)
+      dma = DMAwriteAsync(vmeAddr + done + n, nextN, vas, vdw, slot ^ 1);
+  }
+
+  return nbytes;
+}
+
+//----------------------------------------------------------------------------
+//  VMEDMAFuture
+//----------------------------------------------------------------------------
+VMEDMAFuture::VMEDMAFuture(VMEBridge *bridge, int st)
+{
+  vme = bridge;
+  state = st;
+  dmaOffset = 0;
+  dmaCount = 0;
+}
+
+bool VMEDMAFuture::valid() const
+{
+  return state >= 0;
+}
+
+bool VMEDMAFuture::ready()
+{
+  return wait(0) != 0;
+}
+
+// returns 1 if transfer is finished, 0 on timeout, < 0 on error
+
+int VMEDMAFuture::wait(int timeout)
+{
+  int ret;
+
+  if (state != 0)
+    return state;
+
+  ret = vme->DMAresult(timeout, &dmaOffset, &dmaCount);
+  if (ret != 0)
+    state = ret;
+
+  return ret;
+}
+
+// wait for the transfer and return number of bytes transferred or < 0
+
+int VMEDMAFuture::get()
+{
+  int ret = wait(-1);
+
+  if (ret < 0)
+    return ret;
+
+  return dmaCount;
+}
+
 //----------------------------------------------------------------------------
 //  Create new command packet list and return list number
 //----------------------------------------------------------------------------
@@ -673,7 +1937,8 @@ int VMEBridge::newCmdPktList(void)
     return -1;
   }
 
-  usedLists.push_back(list);
+  VMEMutexLock guard(listLock);
+  usedLists[list] = 0;
 
   return list;
 }
@@ -683,22 +1948,16 @@ int VMEBridge::newCmdPktList(void)
 //----------------------------------------------------------------------------
 int VMEBridge::delCmdPktList(int list)
 {
-  vector<int>::iterator it;
-
   if (list < 0)
   {
     *Err << "Invalid list number: " << list << "!\n";
     return -1;
   }
 
-  ioctl(uni_handle, IOCTL_DEL_DCL, (unsigned long)list);
+  VMEMutexLock guard(listLock);
 
-  for (it = usedLists.begin(); it != usedLists.end(); it++)
-    if (*it == list)
-    {
-      usedLists.erase(it);
-      break;
-    }
+  ioctl(uni_handle, IOCTL_DEL_DCL, (unsigned long)list);
+  usedLists.erase(list);
 
   return 0;
 }
@@ -708,7 +1967,7 @@ int VMEBridge::delCmdPktList(int list)
 //----------------------------------------------------------------------------
 unsigned int VMEBridge::addCmdPkt(int list, int write, unsigned int vmeAddr, int size, int vas, int vdw)
 {
-  unsigned int offset;
+  int offset;
   list_packet_t lpacket;
 
   if ((write < 0) || (write > 1))
@@ -721,6 +1980,11 @@ unsigned int VMEBridge::addCmdPkt(int list, int write, unsigned int vmeAddr, int
   lpacket.dva = vmeAddr;
   lpacket.list = list;
 
+  // the packets of a list are added in order, data of each list start at
+  // the beginning of the DMA buffer
+
+  VMEMutexLock guard(listLock);
+
   offset = ioctl(uni_handle, IOCTL_ADD_DCP, &lpacket);
 
   if (offset < 0)
@@ -728,6 +1992,7 @@ unsigned int VMEBridge::addCmdPkt(int list, int write, unsigned int vmeAddr, int
     *Err << "Can't add Command Packet to list " << list << "!\n";
     return 0xFFFFFFFF;
   }
+  unsigned int &listPtr = usedLists[list];
   listPtr += size + offset;
 
   return listPtr - size;
@@ -774,6 +2039,8 @@ uintptr_t VMEBridge::getPciBaseAddr(int image)
     return 0xFFFFFFFF;
   }
 
+  VMEReadLock guard(imageLock[image]);
+
   return vmeImageBase[image];
 }
 
@@ -784,6 +2051,14 @@ void VMEBridge::setOption(int image, unsigned int opt)
 {
   unsigned long par;
 
+  if ((image < 0) || (image > 17))
+  {
+    *Err << "setOption: Image nr. " << image << " is invalid!\n";
+    return;
+  }
+
+  VMEWriteLock guard((image == DMA) ? dmaLock : imageLock[image]);
+
   par = 0;
 
   if (opt & 0x1) // program AM
@@ -900,7 +2175,7 @@ int VMEBridge::vmemap(int image, unsigned int vme_base, unsigned int size, unsig
   if (ioctl(vme_handle[image], IOCTL_SET_CTL, (unsigned long)ctl))
   {
     *Err << "vmemap: Can't write to image " << image << "!  ";
-    bridge_error = -6;
+    __atomic_store_n(&bridge_error, -6, __ATOMIC_RELAXED);
     return -6;
   }
 
@@ -909,7 +2184,7 @@ int VMEBridge::vmemap(int image, unsigned int vme_base, unsigned int size, unsig
   if (ret < 0)
   {
     *Err << "Error: Failed to allocate Image " << image << "!\n";
-    bridge_error = -7;
+    __atomic_store_n(&bridge_error, -7, __ATOMIC_RELAXED);
     return -7;
   }
 
@@ -937,10 +2212,12 @@ int VMEBridge::getImage(unsigned int base, unsigned int size, int vas, int vdw,
   if (image < 0)
   {
     *Err << "No free image available!\n";
-    bridge_error = -4;
+    __atomic_store_n(&bridge_error, -4, __ATOMIC_RELAXED);
     return -1;
   }
 
+  VMEWriteLock guard(imageLock[image]);
+
   if (!ms)
     sprintf(vmeDev, "/dev/vme_m%i", image);
   else
@@ -951,7 +2228,7 @@ int VMEBridge::getImage(unsigned int base, unsigned int size, int vas, int vdw,
   {
     *Err << "Can't open VME image device nr. " << image << "!\n";
     vme_handle[image] = -1;
-    bridge_error = -5;
+    __atomic_store_n(&bridge_error, -5, __ATOMIC_RELAXED);
     return -2;
   }
 
@@ -975,6 +2252,7 @@ int VMEBridge::getImage(unsigned int base, unsigned int size, int vas, int vdw,
   { // Master image
     ctl = 0x40000000 | vdw | vas; // enable posted write, non-priv. data
     vmeBaseAddr[image] = base;
+    vmeImageWidth[image] = vdw;
   }
 
   if (vmemap(image, base, size, ctl, ms) < 0)
@@ -991,6 +2269,14 @@ int VMEBridge::getImage(unsigned int base, unsigned int size, int vas, int vdw,
 //----------------------------------------------------------------------------
 void VMEBridge::releaseImage(int image)
 {
+  if ((image < 0) || (image > 17))
+  {
+    *Err << "releaseImage: Image nr. " << image << " is invalid!\n";
+    return;
+  }
+
+  VMEWriteLock guard(imageLock[image]);
+
   if (munmap((char *) vmeImageBase[image], vmeImageSize[image]))
     *Err << "Can't munmap allocated memory of image " << image << "!";
   else
@@ -1015,13 +2301,32 @@ void VMEBridge::releaseImage(int image)
 //----------------------------------------------------------------------------
 VMEBridge::VMEBridge(void)
 {
+  pthread_rwlockattr_t attr;
   int i;
 
   Std = &cout;
   Err = &cerr;
 
   bridge_error = 0;
-  listPtr = 0;
+
+  for (i = 0; i < 18; i++)
+    pthread_rwlock_init(&imageLock[i], NULL);
+  pthread_rwlock_init(&dmaLock, NULL);
+  pthread_mutex_init(&listLock, NULL);
+
+  // direct accesses must not starve behind system call accesses
+
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&berrLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  errSink = 0;
+  errSinkArg = 0;
+  errRate = ERR_RATE;
+  errWindow = 0;
+  errCount = 0;
+  errSuppressed = 0;
 
   uni_handle = open("/dev/vme_ctl", O_RDWR, 0);
   if (uni_handle < 1)
@@ -1037,8 +2342,26 @@ VMEBridge::VMEBridge(void)
     bridge_error = -2;
   }
 
+  // map universeII registers for syscall free bus error checks. Older
+  // drivers don't support this, direct accesses then use pread/pwrite.
+
+  uniRegs = 0;
+  uniRegsBase = 0;
+  if (uni_handle >= 1)
+  {
+    void *regs = mmap(NULL, UNI_REG_SIZE, PROT_WRITE | PROT_READ, MAP_SHARED, uni_handle, 0);
+    if (regs != MAP_FAILED)
+    {
+      uniRegsBase = (uintptr_t) regs;
+      uniRegs = (volatile uint32_t *) regs;
+    }
+  }
+
   for (i = 0; i < 8; i++)
+  {
     vmeBaseAddr[i] = 0;
+    vmeImageWidth[i] = D32;
+  }
 
   for (i = 0; i < 18; i++)
   {
@@ -1061,12 +2384,12 @@ VMEBridge::~VMEBridge(void)
 {
   int i;
 
-  vector<int>::iterator it;
+  map<int, unsigned int>::iterator it;
 
   // remove all existing DMA command packet lists
 
   for (it = usedLists.begin(); it != usedLists.end(); it++)
-    ioctl(uni_handle, IOCTL_DEL_DCL, (unsigned long)(*it));
+    ioctl(uni_handle, IOCTL_DEL_DCL, (unsigned long)(it->first));
 
   // close all opened images and unmap memory
 
@@ -1081,7 +2404,10 @@ VMEBridge::~VMEBridge(void)
     }
   }
 
-  // close control device
+  // unmap registers and close control device
+
+  if (uniRegsBase)
+    munmap((char *) uniRegsBase, UNI_REG_SIZE);
 
   if (close(uni_handle))
     *Err << "Can't close universeII main control device!\n";
@@ -1095,4 +2421,9 @@ VMEBridge::~VMEBridge(void)
   if (close(dma_handle))
     *Err << "Can't close DMA handle!\n";
 
+  for (i = 0; i < 18; i++)
+    pthread_rwlock_destroy(&imageLock[i]);
+  pthread_rwlock_destroy(&dmaLock);
+  pthread_mutex_destroy(&listLock);
+  pthread_rwlock_destroy(&berrLock);
 }
@@ -21,8 +21,10 @@
 #define VMELIB_H
 
 #include <iostream>
+#include <map>
 #include <vector>
 #include <stdint.h>
+#include <pthread.h>
 
 //----------------------------------------------------------------------------
 // Defines
@@ -54,23 +56,126 @@
 
 #define DMA    9
 
+//----------------------------------------------------------------------------
+// Types
+//----------------------------------------------------------------------------
+
+// single access of a batch executed by VMEBridge::executeBatch()
+
+struct VMEBatchOp
+{
+  int image;               // master image 0..7
+  unsigned int addr;       // VME address
+  int width;               // 1, 2 or 4 byte(s)
+  int write;               // 1: write 'data', 0: read into 'data'
+  unsigned int data;
+};
+
+// error codes of the access functions, see VMEBridge::lastError()
+
+enum VMEErrorCode
+{
+  VME_OK = 0,
+  VME_BERR_READ,           // bus error during read access
+  VME_BERR_WRITE,          // bus error during write access
+  VME_NOT_MAPPED,          // address outside of the mapped image
+  VME_NO_IMAGE,            // invalid image or no image for address
+  VME_BAD_WIDTH            // data width not supported by image
+};
+
+struct VMEErrorInfo
+{
+  int code;                // VMEErrorCode
+  unsigned int addr;       // VME address of the failed access
+  int image;               // image used, -1 if unknown
+};
+
+// receives error reports, 'suppressed' errors were dropped by rate limit
+
+typedef void (*VMEErrorSink)(const VMEErrorInfo &err, unsigned int suppressed, void *arg);
+
 //----------------------------------------------------------------------------
 // Prototypes
 //----------------------------------------------------------------------------
 
+class VMEBridge;
+
+// Handle of an asynchronous DMA transfer started by DMAreadAsync/DMAwriteAsync
+
+class VMEDMAFuture
+{
+private:
+  VMEBridge *vme;
+  int state;                     // -1: failed, 0: running, 1: done
+  int dmaOffset;
+  unsigned int dmaCount;
+
+public:
+  VMEDMAFuture(VMEBridge *bridge = 0, int st = -1);
+
+  bool valid() const;
+  bool ready();
+  int wait(int timeout = -1);
+  int get();
+
+  int offset() const
+  {
+    return dmaOffset;
+  }
+
+  unsigned int count() const
+  {
+    return dmaCount;
+  }
+};
+
+//----------------------------------------------------------------------------
+//  VMEBridge: all functions may be called from several threads. System call
+//  accesses (rl, wl, ..., batches) to different images run concurrently,
+//  getImage/releaseImage wait for the accesses to that image to finish.
+//  DMA parameters and command packet lists are protected by their own
+//  locks. The bridge has one bus error flag, so a direct access or block
+//  copy and its bus error check exclude all other accesses of the process.
+//  The logging streams and attachRegisters() should be set up before
+//  threads start.
+//----------------------------------------------------------------------------
+
 class VMEBridge
 {
+  friend class VMERing;
+
 private:
   static const unsigned int slave_base_addr[];
   int vme_handle[18], uni_handle, dma_handle;
 
-  unsigned int listPtr, dma_ctl;
+  unsigned int dma_ctl;
   unsigned int vmeBaseAddr[8];
+  int vmeImageWidth[8];                     // data width of master images
   uintptr_t vmeImageBase[18];
   unsigned int vmeImageSize[18];
   unsigned int dmaImageSize, dmaBufSize, dmaMaxBuf;
   uintptr_t dmaImageBase;
-  std::vector<int> usedLists;
+  uintptr_t uniRegsBase;
+  volatile uint32_t *uniRegs;
+  std::map<int, unsigned int> usedLists;   // list -> next free buffer offset
+
+  // locks: image state is shared by accesses and changed by get/release,
+  // berrLock pairs a direct access with its PCI_CSR bus error check
+  // (exclusive, a block copy holds it for up to 1 kB of bus cycles) and
+  // is held shared by system calls accessing the bus
+
+  pthread_rwlock_t imageLock[18];
+  pthread_rwlock_t dmaLock;
+  pthread_mutex_t listLock;
+  pthread_rwlock_t berrLock;
+
+  // rate limited error reporting
+
+  VMEErrorSink errSink;
+  void *errSinkArg;
+  unsigned int errRate;
+  volatile long errWindow;
+  volatile unsigned int errCount, errSuppressed;
 
   int there(unsigned int addr, unsigned int mode);
   int checkIrqParamter(unsigned int level, unsigned int statusID);
@@ -78,6 +183,11 @@ private:
   int checkDmaParam(unsigned int count, unsigned int bufNr);
   uintptr_t getAddr(int, int);
   int vmemap(int, unsigned int, unsigned int, unsigned int, int);
+  uintptr_t directAddr(int image, unsigned int addr, unsigned int width);
+  int testBerrDirect(void);
+  int runBatch(std::vector<VMEBatchOp> &ops);
+  void reportError(int code, unsigned int addr, int image);
+  void logError(const VMEErrorInfo &err, unsigned int suppressed);
 
 public:
   VMEBridge();
@@ -114,12 +224,26 @@ public:
   uintptr_t requestDMA(int);
   int enableBltUntilBerr(void);
   uintptr_t getDMABase(void);
+  unsigned int getDMABufSize(void);
+  unsigned int getDMABufCount(void);
   void releaseDMA(void);
   int DMAread(unsigned int source, unsigned int count, int vas, int vdw);
   int DMAread(unsigned int source, unsigned int count, int vas, int vdw, unsigned int bufNr);
   int DMAwrite(unsigned int dest, unsigned int count, int vas, int vdw);
   int DMAwrite(unsigned int dest, unsigned int count, int vas, int vdw, unsigned int bufNr);
 
+  // Asynchronous DMA, completion can also be polled on getDMAHandle()
+
+  VMEDMAFuture DMAreadAsync(unsigned int source, unsigned int count, int vas, int vdw, unsigned int bufNr = 0);
+  VMEDMAFuture DMAwriteAsync(unsigned int dest, unsigned int count, int vas, int vdw, unsigned int bufNr = 0);
+  int DMAresult(int timeout, int *offset, unsigned int *count);
+  int getDMAHandle(void);
+
+  // DMA transfers of any size, split into chunks pipelined over two buffers
+
+  int readLarge(unsigned int vmeAddr, void *buf, unsigned int nbytes, int vas, int vdw);
+  int writeLarge(unsigned int vmeAddr, const void *buf, unsigned int nbytes, int vas, int vdw);
+
   // DMA linked list operations
 
   int newCmdPktList(void);
@@ -152,12 +276,41 @@ public:
   int rb(int image, unsigned int addr, unsigned char *data, int size);
   int wb(int image, unsigned int addr, unsigned char *data, int size);
 
+  // Batch of single read/write accesses executed by one system call
+
+  int executeBatch(std::vector<VMEBatchOp> &ops);
+
   int testBerr();
   int there(unsigned int addr);
   int there8(unsigned int addr);
   int there16(unsigned int addr);
   int there32(unsigned int addr);
 
+  // Direct access through the mapped image, no system call involved.
+  // The bus error flag is shared by all users of the bridge: a bus error
+  // may be missed or reported to the wrong access if other processes,
+  // or io_uring batches, access the bus at the same time.
+
+  int rlDirect(int image, unsigned int addr, unsigned int *data);
+  int wlDirect(int image, unsigned int addr, unsigned int data);
+
+  int rwDirect(int image, unsigned int addr, unsigned short *data);
+  int wwDirect(int image, unsigned int addr, unsigned short data);
+
+  int rbDirect(int image, unsigned int addr, unsigned char *data);
+  int wbDirect(int image, unsigned int addr, unsigned char data);
+
+  // Block copy through the mapped image, accesses of 1, 2 or 4 byte(s),
+  // width 0: widest accesses allowed by the image's data width
+
+  int copyFromWindow(int image, unsigned int addr, void *buf, unsigned int size, int width = 0);
+  int copyToWindow(int image, unsigned int addr, const void *buf, unsigned int size, int width = 0);
+
+  // Attach externally mapped memory as image/register space (simulation)
+
+  int attachImage(int image, uintptr_t base, unsigned int vmeBase, unsigned int size, int vdw = D32);
+  void attachRegisters(uintptr_t regs);
+
   // Access to Universe II Register (for use of unsupported features)
 
   unsigned int readUniReg(int);
@@ -166,8 +319,21 @@ public:
   int resetDriver();
   void vmeSysReset();
 
+  // last error of the constructor or of getImage() in any thread, use
+  // lastError() for the calling thread's error
+
   int bridge_error;
 
+  // Error codes of the calling thread's last failed access. Text messages
+  // for bus errors are limited to 'perSecond' (0: none) and passed to the
+  // sink, or to the error log if no sink is set.
+
+  static VMEErrorInfo lastError(void);
+  static void clearLastError(void);
+  static const char *errorText(int code);
+  void setErrorSink(VMEErrorSink sink, void *arg);
+  void setErrorRate(unsigned int perSecond);
+
 protected:
   // logging streams
 
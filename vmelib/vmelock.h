@@ -0,0 +1,84 @@
+/*
+ Scoped locks used internally by vmelib
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMELOCK_H
+#define VMELOCK_H
+
+#include <pthread.h>
+
+class VMEReadLock
+{
+private:
+  pthread_rwlock_t *lock;
+
+  VMEReadLock(const VMEReadLock &);
+  VMEReadLock &operator=(const VMEReadLock &);
+
+public:
+  VMEReadLock(pthread_rwlock_t &l) : lock(&l)
+  {
+    pthread_rwlock_rdlock(lock);
+  }
+
+  ~VMEReadLock()
+  {
+    pthread_rwlock_unlock(lock);
+  }
+};
+
+class VMEWriteLock
+{
+private:
+  pthread_rwlock_t *lock;
+
+  VMEWriteLock(const VMEWriteLock &);
+  VMEWriteLock &operator=(const VMEWriteLock &);
+
+public:
+  VMEWriteLock(pthread_rwlock_t &l) : lock(&l)
+  {
+    pthread_rwlock_wrlock(lock);
+  }
+
+  ~VMEWriteLock()
+  {
+    pthread_rwlock_unlock(lock);
+  }
+};
+
+class VMEMutexLock
+{
+private:
+  pthread_mutex_t *lock;
+
+  VMEMutexLock(const VMEMutexLock &);
+  VMEMutexLock &operator=(const VMEMutexLock &);
+
+public:
+  VMEMutexLock(pthread_mutex_t &l) : lock(&l)
+  {
+    pthread_mutex_lock(lock);
+  }
+
+  ~VMEMutexLock()
+  {
+    pthread_mutex_unlock(lock);
+  }
+};
+
+#endif
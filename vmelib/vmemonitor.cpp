@@ -0,0 +1,324 @@
+/*
+ Implementation of classes MonitorTap and MonitorReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vmemonitor.h"
+
+using namespace std;
+
+static inline MonitorSlot *slotOf(const unsigned char *map, const MonitorHeader *h, uint64_t n)
+{
+  return (MonitorSlot *) (map + sizeof(MonitorHeader) + (n % h->nrSlots) * h->slotStride);
+}
+
+//----------------------------------------------------------------------------
+//  MonitorTap constructor, creates the memfd with 'nrSlots' slots of
+//  'slotSize' bytes. Its size is sealed, so readers can rely on it.
+//----------------------------------------------------------------------------
+MonitorTap::MonitorTap(unsigned int nrSlots, unsigned int slotSize)
+{
+  unsigned int stride;
+  void *p;
+
+  Err = &cerr;
+  map = 0;
+  mapSize = 0;
+  header = 0;
+  every = 1;
+  count = 0;
+  published = 0;
+
+  if (!nrSlots)
+    nrSlots = 1;
+
+  stride = (sizeof(MonitorSlot) + slotSize + VME_CACHE_LINE - 1) & ~(VME_CACHE_LINE - 1);
+  mapSize = sizeof(MonitorHeader) + (size_t) nrSlots * stride;
+
+  fd = memfd_create("vmemonitor", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+  {
+    *Err << "MonitorTap: Can't create memfd: " << strerror(errno) << "!\n";
+    return;
+  }
+
+  if (ftruncate(fd, mapSize) != 0)
+  {
+    *Err << "MonitorTap: Can't size memfd: " << strerror(errno) << "!\n";
+    ::close(fd);
+    fd = -1;
+    return;
+  }
+
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+  p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (p == MAP_FAILED)
+  {
+    *Err << "MonitorTap: Can't map memfd: " << strerror(errno) << "!\n";
+    ::close(fd);
+    fd = -1;
+    return;
+  }
+
+  map = (unsigned char *) p;
+  header = (MonitorHeader *) map;
+  header->version = MONITOR_VERSION;
+  header->nrSlots = nrSlots;
+  header->slotSize = slotSize;
+  header->slotStride = stride;
+  header->published = 0;
+  memcpy(header->magic, MONITOR_MAGIC, sizeof(header->magic));
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, attached readers keep their mapping
+//----------------------------------------------------------------------------
+MonitorTap::~MonitorTap()
+{
+  if (map)
+    munmap(map, mapSize);
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void MonitorTap::setSampling(unsigned int every)
+{
+  this->every = every ? every : 1;
+  count = 0;
+}
+
+//----------------------------------------------------------------------------
+//  Path readers of other processes can open the memfd by
+//----------------------------------------------------------------------------
+string MonitorTap::getPath(void) const
+{
+  char path[64];
+
+  if (fd < 0)
+    return "";
+
+  snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int) getpid(), fd);
+
+  return path;
+}
+
+//----------------------------------------------------------------------------
+//  Publish one of 'every' events, events larger than a slot are truncated
+//     returns 1 if published, 0 if not sampled, -1 on error
+//----------------------------------------------------------------------------
+int MonitorTap::publish(const void *data, unsigned int size, uint32_t trigger)
+{
+  MonitorSlot *slot;
+  uint64_t n;
+
+  if (!map)
+    return -1;
+
+  if (++count < every)
+    return 0;
+  count = 0;
+
+  n = published;
+  slot = slotOf(map, header, n);
+
+  __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  slot->size = (size < header->slotSize) ? size : header->slotSize;
+  slot->length = size;
+  slot->trigger = trigger;
+  memcpy(slot + 1, data, slot->size);
+
+  __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+
+  published = n + 1;
+  __atomic_store_n(&header->published, published, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+int MonitorTap::process(PipelineBuffer &buf)
+{
+  publish(buf.data, buf.size, (uint32_t) buf.seq);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  MonitorReader
+//----------------------------------------------------------------------------
+MonitorReader::MonitorReader()
+{
+  map = 0;
+  mapSize = 0;
+  header = 0;
+  next = 0;
+  lost = 0;
+  latest = false;
+  Err = &cerr;
+}
+
+MonitorReader::~MonitorReader()
+{
+  detach();
+}
+
+int MonitorReader::attach(const char *path)
+{
+  int fd, ret;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+  {
+    *Err << "MonitorReader: Can't open " << path << ": " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  ret = attach(fd);
+  close(fd);
+
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+//  Map the memfd of a MonitorTap read only, 'fd' may be closed afterwards.
+//  Reading starts at the oldest event still in the ring.
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int MonitorReader::attach(int fd)
+{
+  struct stat st;
+  uint64_t pub;
+  void *p;
+
+  detach();
+
+  if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(MonitorHeader)))
+  {
+    *Err << "MonitorReader: No monitor memory!\n";
+    return -1;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+  {
+    *Err << "MonitorReader: Can't map monitor memory: " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  map = (const unsigned char *) p;
+  mapSize = st.st_size;
+  header = (const MonitorHeader *) map;
+
+  if (memcmp(header->magic, MONITOR_MAGIC, sizeof(header->magic)) || (header->version != MONITOR_VERSION) ||
+      (!header->nrSlots) || (header->slotStride < sizeof(MonitorSlot) + header->slotSize) ||
+      (sizeof(MonitorHeader) + (uint64_t) header->nrSlots * header->slotStride > mapSize))
+  {
+    *Err << "MonitorReader: No monitor memory!\n";
+    detach();
+    return -1;
+  }
+
+  pub = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+  next = (pub > header->nrSlots) ? pub - header->nrSlots : 0;
+  lost = 0;
+
+  return 0;
+}
+
+void MonitorReader::detach(void)
+{
+  if (map)
+    munmap((void *) map, mapSize);
+
+  map = 0;
+  mapSize = 0;
+  header = 0;
+}
+
+//----------------------------------------------------------------------------
+//  Copy the next event, at most 'maxSize' bytes
+//     returns bytes copied, 0 if there is no new event, -1 on error
+//----------------------------------------------------------------------------
+int MonitorReader::read(void *buf, unsigned int maxSize, MonitorEvent *ev)
+{
+  const MonitorSlot *slot;
+  uint64_t pub, n, seq;
+  uint32_t size, length, trigger;
+
+  if (!map)
+  {
+    *Err << "MonitorReader: Not attached!\n";
+    return -1;
+  }
+
+  for (;;)
+  {
+    pub = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    if (next >= pub)
+      return 0;
+
+    n = latest ? pub - 1 : next;
+    if (pub - n > header->nrSlots)
+      n = pub - header->nrSlots;
+    lost += n - next;
+    next = n + 1;
+
+    slot = slotOf(map, header, n);
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != 2 * n + 2)
+    {
+      lost++;
+      continue;
+    }
+
+    size = slot->size;
+    length = slot->length;
+    trigger = slot->trigger;
+    if (size > header->slotSize)
+      size = header->slotSize;
+    if (size > maxSize)
+      size = maxSize;
+    memcpy(buf, slot + 1, size);
+
+    // the tap may have started to overwrite the slot while copying
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+    {
+      lost++;
+      continue;
+    }
+
+    if (ev)
+    {
+      ev->number = n;
+      ev->length = length;
+      ev->trigger = trigger;
+    }
+
+    return size;
+  }
+}
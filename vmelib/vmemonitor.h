@@ -0,0 +1,184 @@
+/*
+ Definition of classes MonitorTap and MonitorReader
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEMONITOR_H
+#define VMEMONITOR_H
+
+#include <string>
+#include <stdint.h>
+
+#include "vmepipeline.h"
+
+#define MONITOR_MAGIC    "VMEMON01"
+#define MONITOR_VERSION  1
+
+// layout of the shared memory: MonitorHeader, then 'nrSlots' slots of
+// 'slotStride' bytes, each a MonitorSlot followed by the data
+
+struct MonitorHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nrSlots;
+  uint32_t slotSize;         // max. data bytes per slot
+  uint32_t slotStride;
+  uint64_t published;        // events published so far
+  char pad[32];
+};
+
+struct MonitorSlot
+{
+  uint64_t seq;              // 2n + 1 while event n is written, 2n + 2 after
+  uint32_t size;             // bytes in the slot
+  uint32_t length;           // bytes of the event, > size if truncated
+  uint32_t trigger;
+  uint32_t pad;
+};
+
+// event information returned by MonitorReader
+
+struct MonitorEvent
+{
+  uint64_t number;           // n-th published event
+  uint32_t length;           // of the event
+  uint32_t trigger;
+};
+
+//----------------------------------------------------------------------------
+//  MonitorTap: publishes a sample of the events to a memfd ring.
+//
+//  publish() copies the event into the next slot and stores the published
+//  count, it never waits and doesn't know about readers. A slot carries a
+//  sequence number which is odd while it is written, readers copy the data
+//  and check the number again to detect that the tap overwrote it. A slow
+//  reader loses events, the tap is never held up.
+//
+//  Readers in other processes attach by getPath() (/proc/<pid>/fd/<fd>)
+//  or by the descriptor passed over a unix socket; the mapping is read
+//  only for them. As a pipeline stage the tap passes every buffer on.
+//----------------------------------------------------------------------------
+
+class MonitorTap : public PipelineStage
+{
+private:
+  int fd;
+  unsigned char *map;
+  size_t mapSize;
+  MonitorHeader *header;
+
+  unsigned int every;        // publish one of 'every' events
+  unsigned int count;
+  uint64_t published;
+
+  MonitorTap(const MonitorTap &);
+  MonitorTap &operator=(const MonitorTap &);
+
+public:
+  MonitorTap(unsigned int nrSlots = 64, unsigned int slotSize = 0x10000);
+  virtual ~MonitorTap();
+
+  bool valid(void) const
+  {
+    return map != 0;
+  }
+
+  // returns 1 if published, 0 if not sampled, -1 on error
+
+  int publish(const void *data, unsigned int size, uint32_t trigger);
+
+  virtual int process(PipelineBuffer &buf);
+
+  void setSampling(unsigned int every);
+
+  int getFd(void) const
+  {
+    return fd;
+  }
+
+  std::string getPath(void) const;
+
+  uint64_t getPublished(void) const
+  {
+    return published;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+//----------------------------------------------------------------------------
+//  MonitorReader: reads the events of a MonitorTap, usually in another
+//  process. read() returns the next event not yet overwritten; with
+//  setLatest(true) it skips to the newest one.
+//----------------------------------------------------------------------------
+
+class MonitorReader
+{
+private:
+  const unsigned char *map;
+  size_t mapSize;
+  const MonitorHeader *header;
+
+  uint64_t next;
+  uint64_t lost;
+  bool latest;
+
+  MonitorReader(const MonitorReader &);
+  MonitorReader &operator=(const MonitorReader &);
+
+public:
+  MonitorReader();
+  virtual ~MonitorReader();
+
+  int attach(const char *path);
+  int attach(int fd);
+  void detach(void);
+
+  // returns bytes copied, 0 if no new event, -1 on error
+
+  int read(void *buf, unsigned int maxSize, MonitorEvent *ev = 0);
+
+  void setLatest(bool latest)
+  {
+    this->latest = latest;
+  }
+
+  // events overwritten before they could be read
+
+  uint64_t getLost(void) const
+  {
+    return lost;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
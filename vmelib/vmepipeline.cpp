@@ -0,0 +1,517 @@
+/*
+ Implementation of classes BufferPool and Pipeline
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "vmepipeline.h"
+
+using namespace std;
+
+#define HUGE_PAGE     0x200000     // bytes per huge page
+#define SPIN_COUNT    16           // polls before yielding
+#define YIELD_COUNT   64           // polls before sleeping
+#define WAIT_SLEEP    20000        // ns, sleep while waiting
+
+static unsigned long long now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+//----------------------------------------------------------------------------
+//  Wait a little longer on each call while a queue is empty/full
+//----------------------------------------------------------------------------
+static void backoff(unsigned int &polls)
+{
+  struct timespec pause = {0, WAIT_SLEEP};
+
+  polls++;
+
+  if (polls < SPIN_COUNT)
+    return;
+  if (polls < YIELD_COUNT)
+    sched_yield();
+  else
+    nanosleep(&pause, NULL);
+}
+
+static void updateMax(atomic<unsigned int> &max, unsigned int value)
+{
+  unsigned int m = max.load(memory_order_relaxed);
+
+  while ((value > m) && !max.compare_exchange_weak(m, value, memory_order_relaxed))
+    ;
+}
+
+//----------------------------------------------------------------------------
+//  BufferPool constructor, allocates and touches all buffers
+//----------------------------------------------------------------------------
+BufferPool::BufferPool(unsigned int nrBuffers, unsigned int bufSize) : freeList(nrBuffers ? nrBuffers : 1)
+{
+  size_t stride = ((size_t) bufSize + VME_CACHE_LINE - 1) & ~((size_t) VME_CACHE_LINE - 1);
+  void *p;
+  unsigned int i;
+
+  Err = &cerr;
+
+  if (!nrBuffers)
+    nrBuffers = 1;
+
+  memSize = (stride * nrBuffers + HUGE_PAGE - 1) & ~((size_t) HUGE_PAGE - 1);
+
+  // reserved huge pages first, then transparent huge pages
+
+  huge = true;
+  p = mmap(NULL, memSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p == MAP_FAILED)
+  {
+    huge = false;
+    p = mmap(NULL, memSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED)
+      madvise(p, memSize, MADV_HUGEPAGE);
+  }
+
+  if (p == MAP_FAILED)
+  {
+    *Err << "BufferPool: Can't allocate " << memSize << " bytes!\n";
+    mem = 0;
+    memSize = 0;
+    return;
+  }
+
+  mem = (unsigned char *) p;
+  memset(mem, 0, memSize);
+
+  buffers.resize(nrBuffers);
+  for (i = 0; i < nrBuffers; i++)
+  {
+    buffers[i].data = mem + i * stride;
+    buffers[i].capacity = bufSize;
+    buffers[i].size = 0;
+    buffers[i].index = i;
+    buffers[i].seq = 0;
+    freeList.push(&buffers[i]);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  BufferPool destructor, buffers must not be in use any more
+//----------------------------------------------------------------------------
+BufferPool::~BufferPool()
+{
+  if (mem)
+    munmap(mem, memSize);
+}
+
+PipelineBuffer *BufferPool::get(void)
+{
+  PipelineBuffer *buf;
+
+  return freeList.pop(buf) ? buf : 0;
+}
+
+void BufferPool::put(PipelineBuffer *buf)
+{
+  freeList.push(buf);    // can't be full, one entry per buffer
+}
+
+//----------------------------------------------------------------------------
+//  Input queue of a stage
+//----------------------------------------------------------------------------
+Pipeline::Queue::Queue(size_t size, bool multi)
+{
+  spsc = multi ? 0 : new VMESpscQueue<PipelineBuffer *>(size);
+  mpmc = multi ? new VMEMpmcQueue<PipelineBuffer *>(size) : 0;
+}
+
+Pipeline::Queue::~Queue()
+{
+  delete spsc;
+  delete mpmc;
+}
+
+//----------------------------------------------------------------------------
+//  Pipeline constructor
+//----------------------------------------------------------------------------
+Pipeline::Pipeline(unsigned int nrBuffers, unsigned int bufSize)
+  : pool(nrBuffers, bufSize), closed(false), aborted(false), headStallNs(0)
+{
+  running = false;
+  seq = 0;
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Pipeline destructor, stops without draining
+//----------------------------------------------------------------------------
+Pipeline::~Pipeline()
+{
+  unsigned int i;
+
+  stop(false);
+
+  for (i = 0; i < stages.size(); i++)
+  {
+    delete stages[i]->in;
+    delete stages[i];
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Append stage run by 'nrThreads' threads, not while running
+//     returns index of the stage, -1 on error
+//----------------------------------------------------------------------------
+int Pipeline::addStage(const string &name, PipelineStage *work, unsigned int nrThreads, unsigned int queueSize)
+{
+  Stage *st;
+
+  if (running)
+  {
+    *Err << "Pipeline: Can't add stages while running!\n";
+    return -1;
+  }
+
+  if ((!work) || (!nrThreads))
+  {
+    *Err << "Pipeline: Invalid stage " << name << "!\n";
+    return -1;
+  }
+
+  st = new Stage;
+  st->name = name;
+  st->work = work;
+  st->nrThreads = nrThreads;
+  st->queueSize = queueSize;
+  st->in = 0;
+  st->active = 0;
+  st->maxDepth = 0;
+  stages.push_back(st);
+
+  return stages.size() - 1;
+}
+
+//----------------------------------------------------------------------------
+//  Create the queues and start the threads of all stages
+//     returns 0 on success, < 0 on error
+//----------------------------------------------------------------------------
+int Pipeline::start(void)
+{
+  unsigned int s, i;
+  bool multi;
+
+  if (running)
+    return 0;
+
+  if (stages.empty() || !pool.getCount())
+  {
+    *Err << "Pipeline: No stages or no buffers!\n";
+    return -1;
+  }
+
+  for (s = 0; s < stages.size(); s++)
+  {
+    Stage &st = *stages[s];
+
+    // SPSC only between single threads, the producer is one thread
+
+    multi = (st.nrThreads > 1) || ((s > 0) && (stages[s - 1]->nrThreads > 1));
+
+    delete st.in;
+    st.in = new Queue(st.queueSize ? st.queueSize : pool.getCount(), multi);
+
+    st.active = st.nrThreads;
+    st.processed = 0;
+    st.dropped = 0;
+    st.errors = 0;
+    st.busyNs = 0;
+    st.idleNs = 0;
+    st.stallNs = 0;
+    st.maxDepth = 0;
+  }
+
+  headStallNs = 0;
+  closed = false;
+  aborted = false;
+  running = true;
+
+  for (s = 0; s < stages.size(); s++)
+    for (i = 0; i < stages[s]->nrThreads; i++)
+      threads.push_back(thread(&Pipeline::work, this, s));
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Stop all stages. With 'drain' the buffers pushed so far are processed
+//  first, otherwise they go back to the pool unprocessed.
+//----------------------------------------------------------------------------
+void Pipeline::stop(bool drain)
+{
+  PipelineBuffer *buf;
+  unsigned int i;
+
+  if (!running)
+    return;
+
+  if (!drain)
+    aborted = true;
+  closed = true;
+
+  for (i = 0; i < threads.size(); i++)
+    threads[i].join();
+  threads.clear();
+
+  for (i = 0; i < stages.size(); i++)
+    while (stages[i]->in->pop(buf))
+      pool.put(buf);
+
+  running = false;
+}
+
+//----------------------------------------------------------------------------
+//  Wait for the next input buffer of 'stage'
+//     returns false when the stage is done
+//----------------------------------------------------------------------------
+bool Pipeline::take(unsigned int stage, PipelineBuffer *&buf)
+{
+  Stage &st = *stages[stage];
+  unsigned int polls = 0;
+  bool done;
+
+  while (!st.in->pop(buf))
+  {
+    if (aborted.load(memory_order_relaxed))
+      return false;
+
+    // all input is queued once the stage in front has finished
+
+    done = (stage == 0) ? closed.load(memory_order_acquire) : (stages[stage - 1]->active.load(memory_order_acquire) == 0);
+    if (done)
+      return st.in->pop(buf);
+
+    backoff(polls);
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//  Pass 'buf' to the stage behind 'stage' or back to the pool
+//     returns false if aborted while waiting
+//----------------------------------------------------------------------------
+bool Pipeline::forward(unsigned int stage, PipelineBuffer *buf)
+{
+  unsigned int polls = 0;
+  Stage *next;
+
+  if (stage + 1 == stages.size())
+  {
+    pool.put(buf);
+    return true;
+  }
+
+  next = stages[stage + 1];
+
+  while (!next->in->push(buf))
+  {
+    if (aborted.load(memory_order_relaxed))
+    {
+      pool.put(buf);
+      return false;
+    }
+    backoff(polls);
+  }
+
+  updateMax(next->maxDepth, next->in->size());
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+//  Thread of a stage
+//----------------------------------------------------------------------------
+void Pipeline::work(unsigned int stage)
+{
+  Stage &st = *stages[stage];
+  PipelineBuffer *buf;
+  unsigned long long t0, t1, t2;
+  int ret;
+
+  t0 = now();
+
+  while (take(stage, buf))
+  {
+    t1 = now();
+    ret = st.work->process(*buf);
+    t2 = now();
+
+    st.idleNs.fetch_add(t1 - t0, memory_order_relaxed);
+    st.busyNs.fetch_add(t2 - t1, memory_order_relaxed);
+
+    if (ret != 0)
+    {
+      if (ret < 0)
+        st.errors.fetch_add(1, memory_order_relaxed);
+      st.dropped.fetch_add(1, memory_order_relaxed);
+      pool.put(buf);
+      t0 = t2;
+      continue;
+    }
+
+    st.processed.fetch_add(1, memory_order_relaxed);
+
+    if (!forward(stage, buf))
+      break;
+
+    t0 = now();
+    st.stallNs.fetch_add(t0 - t2, memory_order_relaxed);
+  }
+
+  st.active.fetch_sub(1, memory_order_release);
+}
+
+//----------------------------------------------------------------------------
+//  Get a free buffer, wait up to 'timeout' ms (-1: forever)
+//     returns 0 on timeout
+//----------------------------------------------------------------------------
+PipelineBuffer *Pipeline::get(int timeout)
+{
+  unsigned long long t0, t;
+  unsigned int polls = 0;
+  PipelineBuffer *buf;
+
+  if ((buf = pool.get()) != 0)
+  {
+    buf->size = 0;
+    return buf;
+  }
+
+  t0 = now();
+
+  while ((buf = pool.get()) == 0)
+  {
+    t = now();
+    if ((timeout >= 0) && (t - t0 >= timeout * 1000000ULL))
+    {
+      headStallNs.fetch_add(t - t0, memory_order_relaxed);
+      return 0;
+    }
+    backoff(polls);
+  }
+
+  headStallNs.fetch_add(now() - t0, memory_order_relaxed);
+  buf->size = 0;
+
+  return buf;
+}
+
+//----------------------------------------------------------------------------
+//  Hand 'buf' to the first stage
+//     returns 0 on success, -1 if not running (buffer goes back to the pool)
+//----------------------------------------------------------------------------
+int Pipeline::push(PipelineBuffer *buf)
+{
+  unsigned long long t0 = 0;
+  unsigned int polls = 0;
+
+  if ((!running) || closed)
+  {
+    pool.put(buf);
+    return -1;
+  }
+
+  buf->seq = seq++;
+
+  while (!stages[0]->in->push(buf))
+  {
+    if (!t0)
+      t0 = now();
+    backoff(polls);
+  }
+
+  if (t0)
+    headStallNs.fetch_add(now() - t0, memory_order_relaxed);
+
+  updateMax(stages[0]->maxDepth, stages[0]->in->size());
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Copy 'size' bytes (e.g. from the DMA buffer) into a free buffer and hand
+//  it to the first stage
+//     returns 1 on success, 0 on timeout, -1 on error
+//----------------------------------------------------------------------------
+int Pipeline::push(const void *data, unsigned int size, int timeout)
+{
+  PipelineBuffer *buf;
+
+  if ((!running) || closed)
+    return -1;
+
+  if ((buf = get(timeout)) == 0)
+    return 0;
+
+  if (size > buf->capacity)
+  {
+    *Err << "Pipeline: " << size << " bytes exceed buffer size!\n";
+    pool.put(buf);
+    return -1;
+  }
+
+  memcpy(buf->data, data, size);
+  buf->size = size;
+
+  return (push(buf) == 0) ? 1 : -1;
+}
+
+//----------------------------------------------------------------------------
+//  Counters of all stages
+//----------------------------------------------------------------------------
+void Pipeline::getStats(vector<PipelineStats> &stats)
+{
+  unsigned int s;
+
+  stats.resize(stages.size());
+
+  for (s = 0; s < stages.size(); s++)
+  {
+    const Stage &st = *stages[s];
+    PipelineStats &ps = stats[s];
+
+    ps.name = st.name;
+    ps.processed = st.processed.load(memory_order_relaxed);
+    ps.dropped = st.dropped.load(memory_order_relaxed);
+    ps.errors = st.errors.load(memory_order_relaxed);
+    ps.depth = st.in ? st.in->size() : 0;
+    ps.maxDepth = st.maxDepth.load(memory_order_relaxed);
+    ps.busy = st.busyNs.load(memory_order_relaxed) * 1e-9;
+    ps.idle = st.idleNs.load(memory_order_relaxed) * 1e-9;
+    ps.stall = st.stallNs.load(memory_order_relaxed) * 1e-9;
+  }
+}
+
+double Pipeline::getHeadStall(void) const
+{
+  return headStallNs.load(memory_order_relaxed) * 1e-9;
+}
@@ -0,0 +1,234 @@
+/*
+ Definition of classes BufferPool and Pipeline
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEPIPELINE_H
+#define VMEPIPELINE_H
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "vmequeue.h"
+
+// buffer passed through the pipeline
+
+struct PipelineBuffer
+{
+  unsigned char *data;
+  unsigned int capacity;         // bytes available in 'data'
+  unsigned int size;             // bytes used
+  unsigned int index;            // buffer number in the pool
+  unsigned long long seq;        // set by Pipeline::push()
+};
+
+//----------------------------------------------------------------------------
+//  BufferPool: 'nrBuffers' buffers of 'bufSize' bytes in one mapping,
+//  backed by huge pages if the system has them reserved (otherwise
+//  transparent huge pages are requested). The pages are touched in the
+//  constructor, get() and put() never allocate and may be called from any
+//  thread.
+//----------------------------------------------------------------------------
+
+class BufferPool
+{
+private:
+  unsigned char *mem;
+  size_t memSize;
+  bool huge;
+  std::vector<PipelineBuffer> buffers;
+  VMEMpmcQueue<PipelineBuffer *> freeList;
+
+  BufferPool(const BufferPool &);
+  BufferPool &operator=(const BufferPool &);
+
+public:
+  BufferPool(unsigned int nrBuffers, unsigned int bufSize);
+  virtual ~BufferPool();
+
+  PipelineBuffer *get(void);     // 0 if none free
+  void put(PipelineBuffer *buf);
+
+  unsigned int getCount(void) const
+  {
+    return buffers.size();
+  }
+
+  unsigned int getFree(void) const
+  {
+    return freeList.size();
+  }
+
+  bool hugePages(void) const
+  {
+    return huge;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+// work of one stage, process() is called by the stage's threads
+
+class PipelineStage
+{
+public:
+  virtual ~PipelineStage()
+  {
+  }
+
+  // returns 0 to pass 'buf' on, 1 to drop it, < 0 on error (dropped)
+
+  virtual int process(PipelineBuffer &buf) = 0;
+};
+
+// counters of a stage, times in seconds summed over its threads
+
+struct PipelineStats
+{
+  std::string name;
+  unsigned long long processed, dropped, errors;
+  unsigned int depth, maxDepth;  // input queue
+  double busy;                   // in process()
+  double idle;                   // waiting for input
+  double stall;                  // waiting for room in the next queue
+};
+
+//----------------------------------------------------------------------------
+//  Pipeline: chain of stages connected by bounded lock free queues.
+//
+//  The producer (e.g. a readout loop) takes a buffer by get(), fills it
+//  and hands it to the first stage by push(). push(data, size) copies data
+//  into a pool buffer, e.g. a slice of the DMA buffer that is reused by
+//  the next transfer. Each stage runs on its own thread(s) and passes
+//  buffers to the next one, the last stage and dropped buffers go back to
+//  the pool. Queues between single threaded stages are SPSC, queues
+//  in front of and behind stages with several threads are MPMC. Several
+//  threads process the buffers of a stage out of order.
+//
+//  getStats() shows the limiting stage: it is busy most of the time while
+//  the stages in front of it stall and the ones behind it idle. The
+//  producer's wait for a free buffer is the head's stall time.
+//----------------------------------------------------------------------------
+
+class Pipeline
+{
+private:
+  // input queue of a stage
+
+  class Queue
+  {
+  private:
+    VMESpscQueue<PipelineBuffer *> *spsc;
+    VMEMpmcQueue<PipelineBuffer *> *mpmc;
+
+  public:
+    Queue(size_t size, bool multi);
+    ~Queue();
+
+    bool push(PipelineBuffer *buf)
+    {
+      return spsc ? spsc->push(buf) : mpmc->push(buf);
+    }
+
+    bool pop(PipelineBuffer *&buf)
+    {
+      return spsc ? spsc->pop(buf) : mpmc->pop(buf);
+    }
+
+    size_t size(void) const
+    {
+      return spsc ? spsc->size() : mpmc->size();
+    }
+  };
+
+  struct Stage
+  {
+    std::string name;
+    PipelineStage *work;
+    unsigned int nrThreads, queueSize;
+    Queue *in;
+
+    std::atomic<unsigned int> active;      // running threads
+    std::atomic<unsigned long long> processed, dropped, errors;
+    std::atomic<unsigned long long> busyNs, idleNs, stallNs;
+    std::atomic<unsigned int> maxDepth;
+  };
+
+  BufferPool pool;
+  std::vector<Stage *> stages;
+  std::vector<std::thread> threads;
+
+  std::atomic<bool> closed;      // no more push()
+  std::atomic<bool> aborted;     // stop without draining
+  bool running;
+
+  unsigned long long seq;
+  std::atomic<unsigned long long> headStallNs;
+
+  void work(unsigned int stage);
+  bool take(unsigned int stage, PipelineBuffer *&buf);
+  bool forward(unsigned int stage, PipelineBuffer *buf);
+
+public:
+  Pipeline(unsigned int nrBuffers, unsigned int bufSize);
+  virtual ~Pipeline();
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  // 'queueSize' 0: number of buffers
+
+  int addStage(const std::string &name, PipelineStage *stage, unsigned int nrThreads = 1, unsigned int queueSize = 0);
+
+  int start(void);
+  void stop(bool drain = true);
+
+  // producer, one thread: wait up to 'timeout' ms (-1: forever) for a buffer
+
+  PipelineBuffer *get(int timeout = -1);
+  int push(PipelineBuffer *buf);
+  int push(const void *data, unsigned int size, int timeout = -1);
+
+  void getStats(std::vector<PipelineStats> &stats);
+  double getHeadStall(void) const;
+
+  BufferPool &getPool(void)
+  {
+    return pool;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
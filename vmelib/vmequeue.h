@@ -0,0 +1,260 @@
+/*
+ Definition of classes VMESpscQueue and VMEMpmcQueue
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEQUEUE_H
+#define VMEQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+#define VME_CACHE_LINE  64
+
+//----------------------------------------------------------------------------
+//  VMESpscQueue: lock free ring buffer for one producer and one consumer
+//  thread. push() and pop() never block or allocate, the capacity is
+//  rounded up to a power of 2.
+//
+//  Producer and consumer keep a copy of the other side's index and read
+//  the shared one only when the copy says the ring is full/empty, so the
+//  cache lines bounce once per batch instead of once per element.
+//----------------------------------------------------------------------------
+
+template<typename T>
+class VMESpscQueue
+{
+private:
+  // the padding keeps the producer's and the consumer's indices in cache
+  // lines of their own without requiring an over-aligned allocation
+
+  std::vector<T> ring;
+  size_t mask;
+  char pad0[VME_CACHE_LINE];
+
+  std::atomic<size_t> tail;     // next to push
+  size_t headCache;             // producer's copy of head
+  char pad1[VME_CACHE_LINE];
+
+  std::atomic<size_t> head;     // next to pop
+  size_t tailCache;             // consumer's copy of tail
+  char pad2[VME_CACHE_LINE];
+
+public:
+  explicit VMESpscQueue(size_t capacity) : tail(0), headCache(0), head(0), tailCache(0)
+  {
+    size_t size = 2;
+
+    while (size < capacity)
+      size *= 2;
+
+    ring.resize(size);
+    mask = size - 1;
+  }
+
+  VMESpscQueue(const VMESpscQueue &) = delete;
+  VMESpscQueue &operator=(const VMESpscQueue &) = delete;
+
+  // producer: returns false if full
+
+  bool push(const T &item)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+
+    if (t - headCache > mask)
+    {
+      headCache = head.load(std::memory_order_acquire);
+      if (t - headCache > mask)
+        return false;
+    }
+
+    ring[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // consumer: returns false if empty
+
+  bool pop(T &item)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+
+    if (h == tailCache)
+    {
+      tailCache = tail.load(std::memory_order_acquire);
+      if (h == tailCache)
+        return false;
+    }
+
+    item = ring[h & mask];
+    head.store(h + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // approximate if called while the other side is active
+
+  size_t size(void) const
+  {
+    size_t t = tail.load(std::memory_order_acquire), h = head.load(std::memory_order_acquire);
+
+    return (t > h) ? t - h : 0;
+  }
+
+  bool empty(void) const
+  {
+    return size() == 0;
+  }
+
+  size_t capacity(void) const
+  {
+    return mask + 1;
+  }
+};
+
+//----------------------------------------------------------------------------
+//  VMEMpmcQueue: lock free ring buffer for any number of producer and
+//  consumer threads. Each cell carries a sequence number telling whether
+//  it is free for the producer or filled for the consumer of the current
+//  round, positions are claimed by compare and swap. push() and pop()
+//  never block or allocate, the capacity is rounded up to a power of 2.
+//----------------------------------------------------------------------------
+
+template<typename T>
+class VMEMpmcQueue
+{
+private:
+  struct Cell
+  {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  Cell *cells;
+  size_t mask;
+  char pad0[VME_CACHE_LINE];
+
+  std::atomic<size_t> tail;     // next to push
+  char pad1[VME_CACHE_LINE];
+
+  std::atomic<size_t> head;     // next to pop
+  char pad2[VME_CACHE_LINE];
+
+public:
+  explicit VMEMpmcQueue(size_t capacity) : tail(0), head(0)
+  {
+    size_t i, size = 2;
+
+    while (size < capacity)
+      size *= 2;
+
+    cells = new Cell[size];
+    for (i = 0; i < size; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    mask = size - 1;
+  }
+
+  ~VMEMpmcQueue()
+  {
+    delete[] cells;
+  }
+
+  VMEMpmcQueue(const VMEMpmcQueue &) = delete;
+  VMEMpmcQueue &operator=(const VMEMpmcQueue &) = delete;
+
+  // returns false if full
+
+  bool push(const T &item)
+  {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    ptrdiff_t diff;
+
+    for (;;)
+    {
+      cell = &cells[pos & mask];
+      diff = (ptrdiff_t) cell->seq.load(std::memory_order_acquire) - (ptrdiff_t) pos;
+
+      if (diff == 0)
+      {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;
+      else
+        pos = tail.load(std::memory_order_relaxed);
+    }
+
+    cell->data = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // returns false if empty
+
+  bool pop(T &item)
+  {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Cell *cell;
+    ptrdiff_t diff;
+
+    for (;;)
+    {
+      cell = &cells[pos & mask];
+      diff = (ptrdiff_t) cell->seq.load(std::memory_order_acquire) - (ptrdiff_t) (pos + 1);
+
+      if (diff == 0)
+      {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;
+      else
+        pos = head.load(std::memory_order_relaxed);
+    }
+
+    item = cell->data;
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // approximate if called while other threads are active
+
+  size_t size(void) const
+  {
+    size_t t = tail.load(std::memory_order_acquire), h = head.load(std::memory_order_acquire);
+
+    return (t > h) ? t - h : 0;
+  }
+
+  bool empty(void) const
+  {
+    return size() == 0;
+  }
+
+  size_t capacity(void) const
+  {
+    return mask + 1;
+  }
+};
+
+#endif
@@ -0,0 +1,494 @@
+/*
+ Implementation of class ReadoutEngine
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "vmereadout.h"
+
+using namespace std;
+
+#define IRQ_TIMEOUT   100          // ms, interval to check for stop()
+#define POLL_SLEEP    50000        // ns, sleep of next() while no event
+
+static unsigned long long now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+ReadoutEngine::ReadoutEngine(VMEBridge &bridge, unsigned int level, unsigned int id, unsigned int nrBufs)
+  : running(false), triggers(0), errors(0), stalls(0), busyNs(0)
+{
+  vme = &bridge;
+  irqLevel = level;
+  statusID = id;
+  irqTimeout = IRQ_TIMEOUT;
+  cpu = -1;
+
+  nrBuffers = nrBufs ? nrBufs : 1;
+  bufSize = 0;
+  dmaBase = 0;
+  filled = 0;
+  freed = 0;
+
+  startNs = 0;
+  lastNs = 0;
+  lastTriggers = 0;
+
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+ReadoutEngine::~ReadoutEngine()
+{
+  stop();
+
+  delete filled;
+  delete freed;
+}
+
+//----------------------------------------------------------------------------
+//  Add action, not while running
+//----------------------------------------------------------------------------
+int ReadoutEngine::add(ActionType type, int image, unsigned int addr, unsigned int size, unsigned int value, int vas, int vdw)
+{
+  Action a;
+
+  if (running)
+  {
+    *Err << "ReadoutEngine: Can't add actions while running!\n";
+    return -1;
+  }
+
+  a.type = type;
+  a.image = image;
+  a.addr = addr;
+  a.size = size;
+  a.value = value;
+  a.vas = vas;
+  a.vdw = vdw;
+  actions.push_back(a);
+
+  return actions.size() - 1;
+}
+
+int ReadoutEngine::addRead(int image, unsigned int addr, int width)
+{
+  if ((image < 0) || (image > 7) || ((width != 1) && (width != 2) && (width != 4)))
+  {
+    *Err << "ReadoutEngine: Invalid image or width of read!\n";
+    return -1;
+  }
+
+  return add(RO_READ, image, addr, width, 0, 0, 0);
+}
+
+int ReadoutEngine::addBlock(int image, unsigned int addr, unsigned int size, int width)
+{
+  if ((image < 0) || (image > 7) || (!size))
+  {
+    *Err << "ReadoutEngine: Invalid image or size of block read!\n";
+    return -1;
+  }
+
+  return add(RO_BLOCK, image, addr, size, width, 0, 0);
+}
+
+int ReadoutEngine::addDMA(unsigned int addr, unsigned int size, int vas, int vdw)
+{
+  if (!size)
+  {
+    *Err << "ReadoutEngine: Invalid size of DMA read!\n";
+    return -1;
+  }
+
+  return add(RO_DMA, 0, addr, size, 0, vas, vdw);
+}
+
+//----------------------------------------------------------------------------
+//  Execute command packet 'list' and copy 'size' bytes from 'offset' of
+//  the DMA buffer (see addCmdPkt()) to the event
+//----------------------------------------------------------------------------
+int ReadoutEngine::addList(int list, unsigned int offset, unsigned int size)
+{
+  if (list < 0)
+  {
+    *Err << "ReadoutEngine: Invalid command packet list!\n";
+    return -1;
+  }
+
+  return add(RO_LIST, list, offset, size, 0, 0, 0);
+}
+
+int ReadoutEngine::addWrite(int image, unsigned int addr, unsigned int value, int width)
+{
+  if ((image < 0) || (image > 7) || ((width != 1) && (width != 2) && (width != 4)))
+  {
+    *Err << "ReadoutEngine: Invalid image or width of write!\n";
+    return -1;
+  }
+
+  return add(RO_WRITE, image, addr, width, value, 0, 0);
+}
+
+void ReadoutEngine::clearActions(void)
+{
+  if (running)
+  {
+    *Err << "ReadoutEngine: Can't remove actions while running!\n";
+    return;
+  }
+
+  actions.clear();
+}
+
+//----------------------------------------------------------------------------
+//  Settings, used by the next start()
+//----------------------------------------------------------------------------
+void ReadoutEngine::setCpu(int nr)
+{
+  cpu = nr;
+}
+
+void ReadoutEngine::setIrqTimeout(unsigned long ms)
+{
+  irqTimeout = ms ? ms : IRQ_TIMEOUT;
+}
+
+//----------------------------------------------------------------------------
+//  Allocate event buffers and start the readout thread
+//     returns 0 on success, < 0 on error
+//----------------------------------------------------------------------------
+int ReadoutEngine::start(void)
+{
+  unsigned int i, dmaSize;
+  bool dma = false;
+
+  if (running)
+    return 0;
+
+  if (actions.empty())
+  {
+    *Err << "ReadoutEngine: No actions defined!\n";
+    return -1;
+  }
+
+  if (worker.joinable())
+    worker.join();
+
+  // event size: fragments of all reading actions
+
+  bufSize = 0;
+  dmaSize = vme->getDMABufSize();
+
+  for (i = 0; i < actions.size(); i++)
+  {
+    const Action &a = actions[i];
+
+    if (a.type == RO_WRITE)
+      continue;
+
+    bufSize += 4 + ((a.size + 3) & ~3);
+
+    if ((a.type == RO_DMA) && ((a.addr & 0x7) + a.size > dmaSize))
+    {
+      *Err << "ReadoutEngine: DMA read of action " << i << " exceeds DMA buffer!\n";
+      return -2;
+    }
+
+    if ((a.type == RO_LIST) && ((uint64_t) a.addr + a.size > (uint64_t) dmaSize * vme->getDMABufCount()))
+    {
+      *Err << "ReadoutEngine: Data of list in action " << i << " exceed DMA buffer!\n";
+      return -2;
+    }
+
+    if ((a.type == RO_DMA) || (a.type == RO_LIST))
+      dma = true;
+  }
+
+  dmaBase = vme->getDMABase();
+  if (dma && !dmaBase)
+  {
+    *Err << "ReadoutEngine: requestDMA() must be called first!\n";
+    return -3;
+  }
+
+  bufSize = (bufSize + VME_CACHE_LINE - 1) & ~(VME_CACHE_LINE - 1);
+  buffers.assign((size_t) nrBuffers * bufSize + VME_CACHE_LINE, 0);
+
+  delete filled;
+  delete freed;
+  filled = new VMESpscQueue<ReadoutEvent>(nrBuffers);
+  freed = new VMESpscQueue<unsigned int>(nrBuffers);
+
+  for (i = 0; i < nrBuffers; i++)
+    freed->push(i);
+
+  triggers = 0;
+  errors = 0;
+  stalls = 0;
+  busyNs = 0;
+  startNs = lastNs = now();
+  lastTriggers = 0;
+
+  running = true;
+  worker = thread(&ReadoutEngine::run, this);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Stop readout thread, takes up to the irq timeout. Events not yet
+//  fetched can still be read by next().
+//----------------------------------------------------------------------------
+void ReadoutEngine::stop(void)
+{
+  running = false;
+
+  if (worker.joinable())
+    worker.join();
+}
+
+bool ReadoutEngine::isRunning(void) const
+{
+  return running;
+}
+
+//----------------------------------------------------------------------------
+//  Run the actions, the fragments are written to 'buf'
+//     returns number of failed actions
+//----------------------------------------------------------------------------
+int ReadoutEngine::readEvent(unsigned char *buf, unsigned int &size)
+{
+  unsigned char *p = buf;
+  unsigned int i, l;
+  unsigned short w;
+  unsigned char b;
+  uint32_t n;
+  int ret, failed = 0;
+
+  for (i = 0; i < actions.size(); i++)
+  {
+    const Action &a = actions[i];
+    unsigned char *data = p + 4;
+
+    n = a.size;
+
+    switch (a.type)
+    {
+    case RO_READ:
+      if (a.size == 4)
+      {
+        ret = vme->rlDirect(a.image, a.addr, &l);
+        memcpy(data, &l, 4);
+      }
+      else if (a.size == 2)
+      {
+        ret = vme->rwDirect(a.image, a.addr, &w);
+        memcpy(data, &w, 2);
+      }
+      else
+      {
+        ret = vme->rbDirect(a.image, a.addr, &b);
+        *data = b;
+      }
+      break;
+
+    case RO_BLOCK:
+      ret = vme->copyFromWindow(a.image, a.addr, data, a.size, a.value);
+      break;
+
+    case RO_DMA:
+      {
+        VMEDMAFuture dma = vme->DMAreadAsync(a.addr, a.size, a.vas, a.vdw, 0);
+
+        ret = dma.get();
+        if (ret >= 0)
+        {
+          n = dma.count();    // less with BLT until BERR
+          memcpy(data, (const void *) (dmaBase + dma.offset()), n);
+          ret = 0;
+        }
+      }
+      break;
+
+    case RO_LIST:
+      ret = vme->execCmdPktList(a.image);
+      if (ret == 0)
+        memcpy(data, (const void *) (dmaBase + a.addr), a.size);
+      break;
+
+    case RO_WRITE:
+      if (a.size == 4)
+        ret = vme->wlDirect(a.image, a.addr, a.value);
+      else if (a.size == 2)
+        ret = vme->wwDirect(a.image, a.addr, (unsigned short) a.value);
+      else
+        ret = vme->wbDirect(a.image, a.addr, (unsigned char) a.value);
+
+      if (ret != 0)
+        failed++;
+      continue;    // no fragment
+
+    default:
+      ret = -1;
+      break;
+    }
+
+    if (ret != 0)
+    {
+      failed++;
+      n = 0;
+    }
+
+    memcpy(p, &n, 4);
+    p += 4 + ((n + 3) & ~3);
+  }
+
+  size = p - buf;
+
+  return failed;
+}
+
+//----------------------------------------------------------------------------
+//  Readout thread
+//----------------------------------------------------------------------------
+void ReadoutEngine::run(void)
+{
+  unsigned long long seq = 0, t0;
+  unsigned int idx;
+  ReadoutEvent ev;
+  cpu_set_t set;
+  int ret;
+
+  if (cpu >= 0)
+  {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      *Err << "ReadoutEngine: Can't pin readout thread to CPU " << cpu << "!\n";
+  }
+
+  while (running.load(memory_order_relaxed))
+  {
+    ret = vme->waitIrq(irqLevel, statusID, irqTimeout);
+    if (ret == -1)
+    {
+      *Err << "ReadoutEngine: Invalid interrupt level or status/ID!\n";
+      running = false;
+      return;
+    }
+    if (ret != 0)
+      continue;     // timeout
+
+    t0 = now();
+    triggers.fetch_add(1, memory_order_relaxed);
+
+    if (!freed->pop(idx))
+    {
+      stalls.fetch_add(1, memory_order_relaxed);
+
+      while (!freed->pop(idx))
+      {
+        if (!running.load(memory_order_relaxed))
+          return;
+        sched_yield();
+      }
+    }
+
+    ev.data = &buffers[(size_t) idx * bufSize];
+    ev.buffer = idx;
+    ev.seq = seq++;
+    ev.status = readEvent(&buffers[(size_t) idx * bufSize], ev.size);
+
+    if (ev.status)
+      errors.fetch_add(ev.status, memory_order_relaxed);
+
+    filled->push(ev);     // can't be full, one entry per buffer
+
+    busyNs.fetch_add(now() - t0, memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Get next event, wait up to 'timeout' ms (-1: forever)
+//     returns 1 on success, 0 on timeout, -1 if the engine has stopped
+//----------------------------------------------------------------------------
+int ReadoutEngine::next(ReadoutEvent &event, int timeout)
+{
+  struct timespec pause = {0, POLL_SLEEP};
+  unsigned long long deadline = 0;
+
+  if (!filled)
+    return -1;
+
+  if (timeout >= 0)
+    deadline = now() + timeout * 1000000ULL;
+
+  while (!filled->pop(event))
+  {
+    if (!running)
+      return filled->pop(event) ? 1 : -1;
+
+    if ((timeout >= 0) && (now() >= deadline))
+      return 0;
+
+    nanosleep(&pause, NULL);
+  }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Give event buffer back to the engine
+//----------------------------------------------------------------------------
+void ReadoutEngine::release(const ReadoutEvent &event)
+{
+  if ((!freed) || (event.buffer >= nrBuffers))
+    return;
+
+  freed->push(event.buffer);
+}
+
+//----------------------------------------------------------------------------
+//  Counters, the rate is measured since the previous call
+//----------------------------------------------------------------------------
+void ReadoutEngine::getStats(ReadoutStats &stats)
+{
+  unsigned long long t = now();
+
+  stats.triggers = triggers.load(memory_order_relaxed);
+  stats.errors = errors.load(memory_order_relaxed);
+  stats.stalls = stalls.load(memory_order_relaxed);
+  stats.busy = busyNs.load(memory_order_relaxed) * 1e-9;
+  stats.elapsed = startNs ? (t - startNs) * 1e-9 : 0;
+  stats.rate = (t > lastNs) ? (stats.triggers - lastTriggers) / ((t - lastNs) * 1e-9) : 0;
+
+  lastNs = t;
+  lastTriggers = stats.triggers;
+}
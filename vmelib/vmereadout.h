@@ -0,0 +1,155 @@
+/*
+ Definition of class ReadoutEngine
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEREADOUT_H
+#define VMEREADOUT_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+#include "vmequeue.h"
+
+// An event read by the engine, the data stay valid until release()
+
+struct ReadoutEvent
+{
+  const unsigned char *data;     // fragments of the actions
+  unsigned int size;             // bytes used in 'data'
+  unsigned int buffer;           // event buffer number
+  unsigned long long seq;        // trigger number
+  int status;                    // 0 or number of failed actions
+};
+
+// Counters of the engine
+
+struct ReadoutStats
+{
+  unsigned long long triggers;   // interrupts seen
+  unsigned long long errors;     // failed actions
+  unsigned long long stalls;     // triggers waiting for a free buffer
+  double busy;                   // seconds spent reading events
+  double elapsed;                // seconds since start()
+  double rate;                   // triggers per second since the last call
+};
+
+//----------------------------------------------------------------------------
+//  ReadoutEngine: trigger driven readout loop.
+//
+//  The actions added before start() are run in order on every interrupt
+//  of 'irqLevel'/'statusID' (set up by VMEBridge::setupIrq()):
+//
+//      addRead()       single read through a mapped image
+//      addBlock()      block copy through a mapped image
+//      addDMA()        DMA read, with BLT until BERR of variable length
+//      addList()       command packet list, copies the given DMA buffer range
+//      addWrite()      single write, e.g. to acknowledge or clear a module
+//
+//  Every reading action appends a fragment to the event: the number of
+//  data bytes as uint32_t, the data, padding to 4 bytes.
+//
+//  The loop runs on a thread of its own (pinned to 'cpu' if >= 0) and does
+//  not allocate: events are read into 'nrBuffers' preallocated buffers and
+//  passed to the consumer by a lock free queue. The consumer hands them
+//  back by release(). If no buffer is free the trigger waits (a stall),
+//  which keeps the modules busy. DMA actions use DMA buffer 0.
+//----------------------------------------------------------------------------
+
+class ReadoutEngine
+{
+private:
+  enum ActionType
+  {
+    RO_READ, RO_BLOCK, RO_DMA, RO_LIST, RO_WRITE
+  };
+
+  struct Action
+  {
+    ActionType type;
+    int image;                   // image nr. or command packet list
+    unsigned int addr;           // VME address or DMA buffer offset
+    unsigned int size;           // bytes, single accesses: width
+    unsigned int value;          // write value
+    int vas, vdw;
+  };
+
+  VMEBridge *vme;
+  unsigned int irqLevel, statusID;
+  unsigned long irqTimeout;
+  int cpu;
+
+  std::vector<Action> actions;
+  unsigned int nrBuffers, bufSize;
+  std::vector<unsigned char> buffers;
+  uintptr_t dmaBase;
+
+  VMESpscQueue<ReadoutEvent> *filled;
+  VMESpscQueue<unsigned int> *freed;
+
+  std::thread worker;
+  std::atomic<bool> running;
+  std::atomic<unsigned long long> triggers, errors, stalls, busyNs;
+  unsigned long long startNs, lastNs, lastTriggers;
+
+  int add(ActionType type, int image, unsigned int addr, unsigned int size, unsigned int value, int vas, int vdw);
+  int readEvent(unsigned char *buf, unsigned int &size);
+  void run(void);
+
+public:
+  ReadoutEngine(VMEBridge &bridge, unsigned int irqLevel, unsigned int statusID, unsigned int nrBuffers = 64);
+  virtual ~ReadoutEngine();
+
+  ReadoutEngine(const ReadoutEngine &) = delete;
+  ReadoutEngine &operator=(const ReadoutEngine &) = delete;
+
+  // actions, return their index or -1
+
+  int addRead(int image, unsigned int addr, int width = 4);
+  int addBlock(int image, unsigned int addr, unsigned int size, int width = 0);
+  int addDMA(unsigned int addr, unsigned int size, int vas, int vdw);
+  int addList(int list, unsigned int offset, unsigned int size);
+  int addWrite(int image, unsigned int addr, unsigned int value, int width = 4);
+  void clearActions(void);
+
+  void setCpu(int cpu);
+  void setIrqTimeout(unsigned long ms);
+
+  int start(void);
+  void stop(void);
+  bool isRunning(void) const;
+
+  // consumer
+
+  int next(ReadoutEvent &event, int timeout = -1);
+  void release(const ReadoutEvent &event);
+
+  void getStats(ReadoutStats &stats);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
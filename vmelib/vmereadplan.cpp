@@ -0,0 +1,292 @@
+/*
+ Implementation of class ReadPlan
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "vmereadplan.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+ReadPlan::ReadPlan(VMEBridge &bridge)
+{
+  vme = &bridge;
+  built = false;
+  dmaList = -1;
+  dmaBase = 0;
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+ReadPlan::~ReadPlan()
+{
+  clear();
+}
+
+//----------------------------------------------------------------------------
+//  Register a read of 'size' bytes at 'addr' into 'data', accessed in
+//  units of 'width' (1, 2, 4) bytes. Invalidates a built plan.
+//----------------------------------------------------------------------------
+int ReadPlan::addBlock(int image, unsigned int addr, void *data, unsigned int size, int width)
+{
+  Read rd;
+
+  if ((image < 0) || (image > 7))
+  {
+    *Err << "ReadPlan: Image nr. " << image << " is invalid!\n";
+    return -1;
+  }
+
+  if (((width != 1) && (width != 2) && (width != 4)) || (!size) || (size % width) || (addr % width))
+  {
+    *Err << "ReadPlan: Read at 0x" << hex << addr << dec << " is not aligned to its width!\n";
+    return -1;
+  }
+
+  if (built)
+  {
+    if (dmaList >= 0)
+      vme->delCmdPktList(dmaList);
+    dmaList = -1;
+    regions.clear();
+    built = false;
+  }
+
+  rd.image = image;
+  rd.width = width;
+  rd.addr = addr;
+  rd.size = size;
+  rd.dest = data;
+  reads.push_back(rd);
+
+  return reads.size() - 1;
+}
+
+int ReadPlan::add(int image, unsigned int addr, unsigned int *data)
+{
+  return addBlock(image, addr, data, 4, 4);
+}
+
+int ReadPlan::add(int image, unsigned int addr, unsigned short *data)
+{
+  return addBlock(image, addr, data, 2, 2);
+}
+
+int ReadPlan::add(int image, unsigned int addr, unsigned char *data)
+{
+  return addBlock(image, addr, data, 1, 1);
+}
+
+//----------------------------------------------------------------------------
+//  Merge reads into regions
+//----------------------------------------------------------------------------
+int ReadPlan::merge(unsigned int maxGap)
+{
+  vector<pair<uint64_t, unsigned int> > order;
+  unsigned int i;
+
+  regions.clear();
+
+  // sort by image, width and address
+
+  for (i = 0; i < reads.size(); i++)
+    order.push_back(make_pair(((uint64_t) reads[i].image << 40) | ((uint64_t) reads[i].width << 32) | reads[i].addr, i));
+  sort(order.begin(), order.end());
+
+  for (i = 0; i < order.size(); i++)
+  {
+    const Read &rd = reads[order[i].second];
+    uint64_t end = (uint64_t) rd.addr + rd.size;
+
+    if (!regions.empty())
+    {
+      Region &r = regions.back();
+      uint64_t rEnd = (uint64_t) r.addr + r.size;
+
+      if ((r.image == rd.image) && (r.width == rd.width) && (rd.addr <= rEnd + maxGap))
+      {
+        if (end > rEnd)
+          r.size = (unsigned int) (end - r.addr);
+        r.reads.push_back(order[i].second);
+        continue;
+      }
+    }
+
+    Region r;
+
+    r.image = rd.image;
+    r.width = rd.width;
+    r.addr = rd.addr;
+    r.size = rd.size;
+    r.dmaOffset = 0;
+    r.reads.push_back(order[i].second);
+    regions.push_back(r);
+  }
+
+  for (i = 0; i < regions.size(); i++)
+    regions[i].buf.resize((regions[i].size + 3) / 4);
+
+  return regions.size();
+}
+
+//----------------------------------------------------------------------------
+//  Build plan executed by block reads through the images
+//     returns number of regions
+//----------------------------------------------------------------------------
+int ReadPlan::build(unsigned int maxGap)
+{
+  if (dmaList >= 0)
+    vme->delCmdPktList(dmaList);
+  dmaList = -1;
+
+  built = true;
+
+  return merge(maxGap);
+}
+
+//----------------------------------------------------------------------------
+//  Build plan executed as one DMA command packet list, all reads must be
+//  in address space 'vas'. requestDMA() must have been called before.
+//     returns number of regions, < 0 on error
+//----------------------------------------------------------------------------
+int ReadPlan::buildDMA(int vas, unsigned int maxGap)
+{
+  unsigned int i, offset, bufSize;
+  int vdw;
+
+  build(maxGap);
+  built = false;
+
+  dmaBase = vme->getDMABase();
+  bufSize = vme->getDMABufSize() * vme->getDMABufCount();
+  if (!dmaBase)
+  {
+    *Err << "ReadPlan: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  if ((dmaList = vme->newCmdPktList()) < 0)
+    return -2;
+
+  for (i = 0; i < regions.size(); i++)
+  {
+    vdw = (regions[i].width == 4) ? D32 : (regions[i].width == 2) ? D16 : D8;
+
+    offset = vme->addCmdPkt(dmaList, 0, regions[i].addr, regions[i].size, vas, vdw);
+    if ((offset == 0xFFFFFFFF) || ((uint64_t) offset + regions[i].size > bufSize))
+    {
+      *Err << "ReadPlan: Regions exceed DMA buffer!\n";
+      vme->delCmdPktList(dmaList);
+      dmaList = -1;
+      return -3;
+    }
+
+    regions[i].dmaOffset = offset;
+  }
+
+  built = true;
+
+  return regions.size();
+}
+
+//----------------------------------------------------------------------------
+//  Copy data of region 'r' to the registered variables
+//----------------------------------------------------------------------------
+void ReadPlan::scatter(const Region &r, const unsigned char *data)
+{
+  unsigned int i;
+
+  for (i = 0; i < r.reads.size(); i++)
+  {
+    const Read &rd = reads[r.reads[i]];
+
+    memcpy(rd.dest, data + (rd.addr - r.addr), rd.size);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Execute the plan
+//     returns 0 on success, -1 on bus/DMA error, -2 if not built
+//----------------------------------------------------------------------------
+int ReadPlan::execute(void)
+{
+  unsigned int i;
+  int ret;
+
+  if (!built)
+  {
+    *Err << "ReadPlan: Plan must be built before execution!\n";
+    return -2;
+  }
+
+  if (dmaList >= 0)
+  {
+    if (vme->execCmdPktList(dmaList) != 0)
+      return -1;
+
+    for (i = 0; i < regions.size(); i++)
+      scatter(regions[i], (const unsigned char *) (dmaBase + regions[i].dmaOffset));
+
+    return 0;
+  }
+
+  for (i = 0; i < regions.size(); i++)
+  {
+    Region &r = regions[i];
+
+    switch (r.width)
+    {
+    case 4:
+      ret = vme->rl(r.image, r.addr, &r.buf[0], r.size);
+      break;
+    case 2:
+      ret = vme->rw(r.image, r.addr, (unsigned short *) &r.buf[0], r.size);
+      break;
+    default:
+      ret = vme->rb(r.image, r.addr, (unsigned char *) &r.buf[0], r.size);
+      break;
+    }
+
+    if (ret != 0)
+      return -1;
+
+    scatter(r, (const unsigned char *) &r.buf[0]);
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Remove all reads
+//----------------------------------------------------------------------------
+void ReadPlan::clear(void)
+{
+  if (dmaList >= 0)
+    vme->delCmdPktList(dmaList);
+
+  dmaList = -1;
+  reads.clear();
+  regions.clear();
+  built = false;
+}
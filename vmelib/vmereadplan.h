@@ -0,0 +1,110 @@
+/*
+ Definition of class ReadPlan
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEREADPLAN_H
+#define VMEREADPLAN_H
+
+#include <vector>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  ReadPlan: a fixed set of reads executed as few block transfers.
+//
+//  Register the reads with add(), then build() merges reads of the same
+//  image and width whose address ranges overlap or touch (or are at most
+//  'maxGap' bytes apart) into regions. execute() reads every region with
+//  one block pread, or with one DMA command packet each if the plan was
+//  built by buildDMA(), and copies the results to the registered
+//  variables. The variables must stay valid as long as the plan is used.
+//
+//  Note: a gap is read as well, don't use 'maxGap' next to FIFOs or
+//  registers with read side effects.
+//----------------------------------------------------------------------------
+
+class ReadPlan
+{
+private:
+  struct Read
+  {
+    int image;
+    int width;
+    unsigned int addr, size;
+    void *dest;
+  };
+
+  struct Region
+  {
+    int image;
+    int width;
+    unsigned int addr, size;
+    unsigned int dmaOffset;
+    std::vector<unsigned int> buf;
+    std::vector<unsigned int> reads;
+  };
+
+  VMEBridge *vme;
+  std::vector<Read> reads;
+  std::vector<Region> regions;
+  bool built;
+  int dmaList;
+  uintptr_t dmaBase;
+
+  int merge(unsigned int maxGap);
+  void scatter(const Region &r, const unsigned char *data);
+
+  ReadPlan(const ReadPlan &);
+  ReadPlan &operator=(const ReadPlan &);
+
+public:
+  ReadPlan(VMEBridge &bridge);
+  virtual ~ReadPlan();
+
+  // register reads, returns index of the read or -1
+
+  int add(int image, unsigned int addr, unsigned int *data);
+  int add(int image, unsigned int addr, unsigned short *data);
+  int add(int image, unsigned int addr, unsigned char *data);
+  int addBlock(int image, unsigned int addr, void *data, unsigned int size, int width);
+
+  int build(unsigned int maxGap = 0);
+  int buildDMA(int vas, unsigned int maxGap = 0);
+  int execute(void);
+  void clear(void);
+
+  unsigned int getReadCount(void) const
+  {
+    return reads.size();
+  }
+
+  unsigned int getRegionCount(void) const
+  {
+    return regions.size();
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
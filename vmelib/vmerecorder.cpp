@@ -0,0 +1,381 @@
+/*
+ Implementation of class Recorder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "vmerecorder.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//  Constructor, allocates and registers the buffers
+//----------------------------------------------------------------------------
+Recorder::Recorder(unsigned int nrBuffers, unsigned int bufSize) : ring(nrBuffers < 2 ? 2 : nrBuffers)
+{
+  vector<struct iovec> iov;
+  void *p;
+  unsigned int i;
+
+  Err = &cerr;
+  fd = -1;
+  direct = false;
+  fill = 0;
+  current = 0;
+  offset = 0;
+  bytes = 0;
+  failed = false;
+  inFlight = 0;
+  maxInFlight = 0;
+  writes = 0;
+  stalls = 0;
+
+  if (nrBuffers < 2)
+    nrBuffers = 2;
+
+  this->bufSize = (bufSize + REC_ALIGN - 1) & ~(REC_ALIGN - 1);
+  if (!this->bufSize)
+    this->bufSize = REC_ALIGN;
+
+  memSize = (size_t) nrBuffers * this->bufSize;
+  p = mmap(NULL, memSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (p == MAP_FAILED)
+  {
+    *Err << "Recorder: Can't allocate " << memSize << " bytes!\n";
+    mem = 0;
+    memSize = 0;
+    useRing = fixed = false;
+    return;
+  }
+
+  mem = (unsigned char *) p;
+  slots.resize(nrBuffers);
+  iov.resize(nrBuffers);
+  for (i = 0; i < nrBuffers; i++)
+  {
+    slots[i].data = mem + (size_t) i * this->bufSize;
+    slots[i].len = 0;
+    slots[i].busy = false;
+    iov[i].iov_base = slots[i].data;
+    iov[i].iov_len = this->bufSize;
+  }
+
+  // registered buffers save the page pinning per write, they count
+  // against RLIMIT_MEMLOCK, without them plain WRITE is used
+
+  useRing = ring.valid();
+  fixed = useRing && (ring.registerBuffers(&iov[0], nrBuffers) == 0);
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+Recorder::~Recorder()
+{
+  close();
+
+  while ((inFlight > 0) && (complete(true) > 0))
+    ;
+
+  if (mem)
+    munmap(mem, memSize);
+}
+
+//----------------------------------------------------------------------------
+//  Create file 'name', closes the current one. With 'tryDirect' false, or
+//  if the file system rejects O_DIRECT, the page cache is used.
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int Recorder::open(const char *name, bool tryDirect)
+{
+  if (fd >= 0)
+    close();
+
+  if (!mem)
+  {
+    *Err << "Recorder: No buffers!\n";
+    return -1;
+  }
+
+  direct = tryDirect;
+  fd = direct ? ::open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644) : -1;
+  if (!direct || ((fd < 0) && (errno == EINVAL)))
+  {
+    direct = false;
+    fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+
+  if (fd < 0)
+  {
+    *Err << "Recorder: Can't open " << name << ": " << strerror(errno) << "!\n";
+    direct = false;
+    return -1;
+  }
+
+  fill = 0;
+  current = 0;
+  offset = 0;
+  bytes = 0;
+  failed = false;
+  maxInFlight = 0;
+  writes = 0;
+  stalls = 0;
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Write the last buffer and close the file
+//     returns 0 on success, -1 if a write failed
+//----------------------------------------------------------------------------
+int Recorder::close(void)
+{
+  unsigned int len;
+
+  if (fd < 0)
+    return 0;
+
+  if (fill && !failed)
+  {
+    len = direct ? (fill + REC_ALIGN - 1) & ~(REC_ALIGN - 1) : fill;
+    memset(slots[current].data + fill, 0, len - fill);
+    if (issue(current, len) < 0)
+      failed = true;
+    fill = 0;
+  }
+
+  flush();
+
+  if ((offset != bytes) && (ftruncate(fd, bytes) != 0))
+  {
+    *Err << "Recorder: Can't truncate file: " << strerror(errno) << "!\n";
+    failed = true;
+  }
+
+  ::close(fd);
+  fd = -1;
+
+  return failed ? -1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  Start writing 'len' bytes of buffer 'slot' at the end of the file
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int Recorder::issue(unsigned int slot, unsigned int len)
+{
+  struct io_uring_sqe *sqe;
+  unsigned char *data = slots[slot].data;
+  unsigned int done;
+  ssize_t n;
+
+  if (useRing)
+  {
+    if ((sqe = ring.getSqe()) == NULL)
+    {
+      ring.submit();
+      sqe = ring.getSqe();
+    }
+
+    if (sqe == NULL)
+    {
+      *Err << "Recorder: Submission queue is full!\n";
+      return -1;
+    }
+
+    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) data;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = fixed ? slot : 0;
+    sqe->user_data = slot;
+
+    if (ring.submit() < 0)
+      return -1;
+
+    slots[slot].len = len;
+    slots[slot].busy = true;
+    if (++inFlight > maxInFlight)
+      maxInFlight = inFlight;
+  }
+  else
+  {
+    for (done = 0; done < len; done += n)
+    {
+      n = pwrite(fd, data + done, len - done, offset + done);
+      if ((n < 0) && (errno == EINTR))
+      {
+        n = 0;
+        continue;
+      }
+
+      if (n <= 0)
+      {
+        *Err << "Recorder: Write failed: " << ((n < 0) ? strerror(errno) : "disk full") << "!\n";
+        return -1;
+      }
+    }
+  }
+
+  offset += len;
+  writes++;
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Collect one write completion, wait for it if 'wait' is true
+//     returns 1 if one was collected, 0 if none, -1 on ring failure
+//----------------------------------------------------------------------------
+int Recorder::complete(bool wait)
+{
+  uint64_t tag;
+  int result, ret;
+
+  if (!useRing || !inFlight)
+    return 0;
+
+  if ((ret = ring.reap(&tag, &result, wait)) <= 0)
+    return ret;
+
+  if (tag >= slots.size())
+    return 1;
+
+  Slot &s = slots[tag];
+
+  if (result != (int) s.len)
+  {
+    *Err << "Recorder: Write failed: " << ((result < 0) ? strerror(-result) : "short write") << "!\n";
+    failed = true;
+  }
+
+  s.busy = false;
+  inFlight--;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Switch to the next buffer, wait until its write has completed
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int Recorder::nextSlot(void)
+{
+  while (complete(false) > 0)
+    ;
+
+  current = (current + 1) % slots.size();
+  fill = 0;
+
+  if (slots[current].busy)
+  {
+    stalls++;
+    while (slots[current].busy)
+      if (complete(true) < 0)
+        return -1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Append 'size' bytes
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int Recorder::write(const void *data, unsigned int size)
+{
+  const unsigned char *src = (const unsigned char *) data;
+  unsigned int n;
+
+  if ((fd < 0) || failed)
+    return -1;
+
+  bytes += size;
+
+  while (size)
+  {
+    n = bufSize - fill;
+    if (n > size)
+      n = size;
+
+    memcpy(slots[current].data + fill, src, n);
+    fill += n;
+    src += n;
+    size -= n;
+
+    if (fill == bufSize)
+    {
+      if ((issue(current, bufSize) < 0) || (nextSlot() < 0))
+      {
+        failed = true;
+        return -1;
+      }
+    }
+  }
+
+  return failed ? -1 : 0;
+}
+
+//----------------------------------------------------------------------------
+//  Append 'size' bytes at 'dmaOffset' in the DMA buffer, e.g. the offset
+//  returned by DMAread() plus bufNr * getDMABufSize()
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int Recorder::writeDMA(VMEBridge &vme, unsigned int dmaOffset, unsigned int size)
+{
+  uintptr_t base = vme.getDMABase();
+
+  if (!base)
+  {
+    *Err << "Recorder: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  if ((uint64_t) dmaOffset + size > (uint64_t) vme.getDMABufSize() * vme.getDMABufCount())
+  {
+    *Err << "Recorder: Data exceeds DMA buffer!\n";
+    return -1;
+  }
+
+  return write((const void *) (base + dmaOffset), size);
+}
+
+//----------------------------------------------------------------------------
+//  Wait for all writes in flight. Data of the current buffer is written when
+//  the buffer is full or by close().
+//     returns 0 on success, -1 if a write failed
+//----------------------------------------------------------------------------
+int Recorder::flush(void)
+{
+  while (inFlight > 0)
+    if (complete(true) < 0)
+      return -1;
+
+  return failed ? -1 : 0;
+}
+
+int Recorder::process(PipelineBuffer &buf)
+{
+  return (write(buf.data, buf.size) < 0) ? -1 : 0;
+}
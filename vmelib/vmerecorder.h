@@ -0,0 +1,149 @@
+/*
+ Definition of class Recorder
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMERECORDER_H
+#define VMERECORDER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+#include "vmering.h"
+#include "vmepipeline.h"
+
+#define REC_ALIGN  4096     // O_DIRECT alignment of buffers, sizes and offsets
+
+//----------------------------------------------------------------------------
+//  Recorder: writes data to a file bypassing the page cache.
+//
+//  Data is collected in 'nrBuffers' buffers of 'bufSize' bytes which are
+//  registered with an io_uring. A full buffer is written by WRITE_FIXED to
+//  a file opened with O_DIRECT while the next one is filled, so up to
+//  'nrBuffers' - 1 writes are in flight. Without io_uring the buffers are
+//  written by pwrite(), file systems not supporting O_DIRECT (e.g. older
+//  tmpfs) are written through the page cache.
+//
+//  The DMA buffer is mapped from driver memory which can't be pinned for
+//  direct I/O, so writeDMA() copies from the DMA slot into the current
+//  buffer. This is the only copy of the data.
+//
+//  The last buffer is padded to REC_ALIGN bytes, close() truncates the file
+//  to the bytes written. Not thread safe, as a pipeline stage it must run
+//  on one thread.
+//----------------------------------------------------------------------------
+
+class Recorder : public PipelineStage
+{
+private:
+  struct Slot
+  {
+    unsigned char *data;
+    unsigned int len;        // bytes of the write in flight
+    bool busy;
+  };
+
+  VMERing ring;
+  bool useRing, fixed;
+
+  int fd;
+  bool direct;
+
+  unsigned char *mem;
+  size_t memSize;
+  unsigned int bufSize;
+  std::vector<Slot> slots;
+  unsigned int current, fill;
+
+  uint64_t offset;           // of the next write in the file
+  uint64_t bytes;            // data bytes written by the caller
+  bool failed;
+
+  unsigned int inFlight, maxInFlight;
+  unsigned long long writes, stalls;
+
+  int issue(unsigned int slot, unsigned int len);
+  int complete(bool wait);
+  int nextSlot(void);
+
+  Recorder(const Recorder &);
+  Recorder &operator=(const Recorder &);
+
+public:
+  Recorder(unsigned int nrBuffers = 8, unsigned int bufSize = 0x100000);
+  virtual ~Recorder();
+
+  int open(const char *name, bool tryDirect = true);
+  int close(void);
+
+  int write(const void *data, unsigned int size);
+  int writeDMA(VMEBridge &vme, unsigned int dmaOffset, unsigned int size);
+  int flush(void);
+
+  // PipelineStage: writes the buffer, returns < 0 on error
+
+  virtual int process(PipelineBuffer &buf);
+
+  bool isOpen(void) const
+  {
+    return fd >= 0;
+  }
+
+  bool isDirect(void) const
+  {
+    return direct;
+  }
+
+  bool usesRing(void) const
+  {
+    return useRing;
+  }
+
+  uint64_t getBytes(void) const
+  {
+    return bytes;
+  }
+
+  unsigned long long getWrites(void) const
+  {
+    return writes;
+  }
+
+  // number of times all buffers were in flight when the next was needed
+
+  unsigned long long getStalls(void) const
+  {
+    return stalls;
+  }
+
+  unsigned int getMaxInFlight(void) const
+  {
+    return maxInFlight;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+    ring.setErrorlog(log);
+  }
+};
+
+#endif
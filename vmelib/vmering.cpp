@@ -0,0 +1,507 @@
+/*
+ Implementation of class VMERing
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <vector>
+
+#include "vmeioctl.h"
+#include "vmelock.h"
+#include "vmering.h"
+
+using namespace std;
+
+#define RING_DMA_READ   1
+#define RING_DMA_WRITE  2
+#define RING_DCP        3
+#define RING_BATCH      4
+
+#define RING_VME_REQUEST  0x8000000000000000ULL  // user_data of VME requests
+
+// Per request data which has to stay valid until the driver has processed it
+
+struct VMERingRequest
+{
+  int index;
+  int type;
+  uint64_t tag;
+  uring_cmd_t cmd;
+  dma_param_t dma;
+  batch_param_t batch;
+  vector<batch_op_t> ops;
+  vector<VMEBatchOp> *userOps;
+};
+
+//----------------------------------------------------------------------------
+//  Setup ring with 'nrEntries' submission queue entries
+//----------------------------------------------------------------------------
+void VMERing::init(unsigned int nrEntries)
+{
+  struct io_uring_params p;
+  void *ptr;
+  unsigned int i;
+
+  Err = &cerr;
+  entries = 0;
+  sqRing = cqRing = MAP_FAILED;
+  sqes = (struct io_uring_sqe *) MAP_FAILED;
+  sqLocalTail = 0;
+
+  memset(&p, 0, sizeof(p));
+  ringFd = syscall(__NR_io_uring_setup, nrEntries, &p);
+  if (ringFd < 0)
+  {
+    *Err << "Can't setup io_uring: " << strerror(errno) << "!\n";
+    return;
+  }
+
+  sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+  ptr = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+  if ((sqRing == MAP_FAILED) || (cqRing == MAP_FAILED) || (ptr == MAP_FAILED))
+  {
+    *Err << "Can't mmap() io_uring to user space!\n";
+    if (ptr != MAP_FAILED)
+      munmap(ptr, p.sq_entries * sizeof(struct io_uring_sqe));
+    if (sqRing != MAP_FAILED)
+      munmap(sqRing, sqRingSize);
+    if (cqRing != MAP_FAILED)
+      munmap(cqRing, cqRingSize);
+    sqRing = cqRing = MAP_FAILED;
+    close(ringFd);
+    ringFd = -1;
+    return;
+  }
+
+  sqes = (struct io_uring_sqe *) ptr;
+  entries = p.sq_entries;
+
+  sqHead = (unsigned int *) ((char *) sqRing + p.sq_off.head);
+  sqTail = (unsigned int *) ((char *) sqRing + p.sq_off.tail);
+  sqMask = (unsigned int *) ((char *) sqRing + p.sq_off.ring_mask);
+  sqArray = (unsigned int *) ((char *) sqRing + p.sq_off.array);
+  cqHead = (unsigned int *) ((char *) cqRing + p.cq_off.head);
+  cqTail = (unsigned int *) ((char *) cqRing + p.cq_off.tail);
+  cqMask = (unsigned int *) ((char *) cqRing + p.cq_off.ring_mask);
+  cqes = (char *) cqRing + p.cq_off.cqes;
+
+  sqLocalTail = *sqTail;
+
+  // one request per submission entry, the completion ring is twice as large
+
+  for (i = 0; i < entries; i++)
+  {
+    VMERingRequest *req = new VMERingRequest;
+
+    req->index = i;
+    req->type = 0;
+    requests.push_back(req);
+    freeRequests.push_back(entries - 1 - i);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Get a free submission queue entry, NULL if the queue is full
+//----------------------------------------------------------------------------
+struct io_uring_sqe *VMERing::getSqe(void)
+{
+  unsigned int head, idx;
+  struct io_uring_sqe *sqe;
+
+  if (ringFd < 0)
+    return NULL;
+
+  head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  if (sqLocalTail - head >= entries)
+    return NULL;
+
+  idx = sqLocalTail & *sqMask;
+  sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray[idx] = idx;
+  sqLocalTail++;
+
+  return sqe;
+}
+
+//----------------------------------------------------------------------------
+//  Hand all queued entries to the kernel, optionally wait for 'waitNr'
+//  completions. Returns the number of submitted entries or -1.
+//----------------------------------------------------------------------------
+int VMERing::submit(unsigned int waitNr)
+{
+  int ret;
+  unsigned int toSubmit;
+
+  if (ringFd < 0)
+    return -1;
+
+  toSubmit = sqLocalTail - *sqTail;
+  __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+  if ((toSubmit == 0) && (waitNr == 0))
+    return 0;
+
+  do
+    ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  while ((ret < 0) && (errno == EINTR));
+
+  if (ret < 0)
+  {
+    *Err << "io_uring submit failed: " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+//  Get one completion. Returns 1 and fills 'tag' and 'result' if there was
+//  one, 0 if 'wait' is false and no completion is available, -1 on error.
+//----------------------------------------------------------------------------
+int VMERing::reap(uint64_t *tag, int *result, bool wait)
+{
+  int ret;
+  unsigned int head;
+  struct io_uring_cqe *cqe;
+  uint64_t userData;
+
+  if (ringFd < 0)
+    return -1;
+
+  head = *cqHead;
+  while (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+  {
+    if (!wait)
+      return 0;
+
+    ret = syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if ((ret < 0) && (errno != EINTR))
+    {
+      *Err << "io_uring wait failed: " << strerror(errno) << "!\n";
+      return -1;
+    }
+  }
+
+  cqe = (struct io_uring_cqe *) cqes + (head & *cqMask);
+  userData = cqe->user_data;
+  ret = cqe->res;
+  __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+  if (userData & RING_VME_REQUEST)
+  {
+    VMERingRequest *req = requests[userData & ~RING_VME_REQUEST];
+
+    *tag = req->tag;
+    *result = finishRequest(req, ret);
+    freeRequest(req);
+  }
+  else
+  {
+    *tag = userData;
+    *result = ret;
+  }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Register buffers for fixed buffer operations (e.g. IORING_OP_WRITE_FIXED)
+//----------------------------------------------------------------------------
+int VMERing::registerBuffers(const struct iovec *iov, unsigned int nrIov)
+{
+  if (ringFd < 0)
+    return -1;
+
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iov, nrIov) < 0)
+  {
+    *Err << "Can't register io_uring buffers: " << strerror(errno) << "!\n";
+    return -1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Request handling
+//----------------------------------------------------------------------------
+VMERingRequest *VMERing::allocRequest(int type, uint64_t tag)
+{
+  VMERingRequest *req;
+
+  if (!vme)
+  {
+    *Err << "VMERing: No VMEBridge attached!\n";
+    return NULL;
+  }
+
+  if (freeRequests.empty())
+  {
+    *Err << "VMERing: Too many requests in flight!\n";
+    return NULL;
+  }
+
+  req = requests[freeRequests.back()];
+  freeRequests.pop_back();
+
+  req->type = type;
+  req->tag = tag;
+
+  return req;
+}
+
+void VMERing::freeRequest(VMERingRequest *req)
+{
+  req->type = 0;
+  freeRequests.push_back(req->index);
+}
+
+int VMERing::queueRequest(int fd, unsigned int op, VMERingRequest *req)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = getSqe();
+  if (sqe == NULL)
+  {
+    submit();
+    sqe = getSqe();
+  }
+
+  if (sqe == NULL)
+  {
+    *Err << "VMERing: Submission queue is full!\n";
+    freeRequest(req);
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_URING_CMD;
+  sqe->fd = fd;
+  sqe->cmd_op = op;
+  sqe->user_data = RING_VME_REQUEST | req->index;
+  memcpy(sqe->cmd, &req->cmd, sizeof(req->cmd));
+
+  return 0;
+}
+
+int VMERing::finishRequest(VMERingRequest *req, int res)
+{
+  unsigned int i, n;
+
+  if (req->type != RING_BATCH)
+    return res;
+
+  if (res != 0)
+  {
+    *Err << "VMERing: Driver can't execute batch!\n";
+    return -2;
+  }
+
+  n = (req->batch.berr >= 0) ? (unsigned int) req->batch.berr : req->batch.count;
+  for (i = 0; i < n; i++)
+    if (!req->ops[i].write)
+      (*req->userOps)[i].data = req->ops[i].data;
+
+  return n;
+}
+
+//----------------------------------------------------------------------------
+//  Queue DMA transfers, result is the offset of the data in the buffer
+//----------------------------------------------------------------------------
+int VMERing::DMAread(unsigned int source, unsigned int count, int vas, int vdw, unsigned int bufNr, uint64_t tag)
+{
+  VMERingRequest *req;
+
+  if (!vme)
+    return -1;
+
+  VMEReadLock guard(vme->dmaLock);
+
+  if (vme->checkDmaParam(count, bufNr) != 0)
+    return -1;
+
+  if ((req = allocRequest(RING_DMA_READ, tag)) == NULL)
+    return -1;
+
+  req->dma.addr = source;
+  req->dma.count = count;
+  req->dma.vas = vas;
+  req->dma.vdw = vdw;
+  req->dma.dma_ctl = vme->dma_ctl;
+  req->dma.bufNr = bufNr;
+  req->cmd.arg = (uintptr_t) &req->dma;
+
+  return queueRequest(vme->dma_handle, URING_DMA_READ, req);
+}
+
+int VMERing::DMAwrite(unsigned int dest, unsigned int count, int vas, int vdw, unsigned int bufNr, uint64_t tag)
+{
+  VMERingRequest *req;
+
+  if (!vme)
+    return -1;
+
+  VMEReadLock guard(vme->dmaLock);
+
+  if (vme->checkDmaParam(count, bufNr) != 0)
+    return -1;
+
+  if ((req = allocRequest(RING_DMA_WRITE, tag)) == NULL)
+    return -1;
+
+  req->dma.addr = dest;
+  req->dma.count = count;
+  req->dma.vas = vas;
+  req->dma.vdw = vdw;
+  req->dma.dma_ctl = vme->dma_ctl;
+  req->dma.bufNr = bufNr;
+  req->cmd.arg = (uintptr_t) &req->dma;
+
+  return queueRequest(vme->dma_handle, URING_DMA_WRITE, req);
+}
+
+//----------------------------------------------------------------------------
+//  Queue execution of command packet list
+//----------------------------------------------------------------------------
+int VMERing::execCmdPktList(int list, uint64_t tag)
+{
+  VMERingRequest *req;
+
+  if (list < 0)
+  {
+    *Err << "Invalid list number: " << list << "!\n";
+    return -1;
+  }
+
+  if ((req = allocRequest(RING_DCP, tag)) == NULL)
+    return -1;
+
+  req->cmd.arg = list;
+
+  return queueRequest(vme->uni_handle, IOCTL_EXEC_DCP, req);
+}
+
+//----------------------------------------------------------------------------
+//  Queue a batch of up to BATCH_MAX_OPS single accesses. 'ops' must stay
+//  valid until completion, read data is stored there by reap().
+//----------------------------------------------------------------------------
+int VMERing::executeBatch(vector<VMEBatchOp> &ops, uint64_t tag)
+{
+  unsigned int i;
+  VMERingRequest *req;
+
+  if ((ops.size() < 1) || (ops.size() > BATCH_MAX_OPS))
+  {
+    *Err << "VMERing: Batch size must be in [1.." << BATCH_MAX_OPS << "]!\n";
+    return -1;
+  }
+
+  if ((req = allocRequest(RING_BATCH, tag)) == NULL)
+    return -1;
+
+  req->ops.resize(ops.size());
+  for (i = 0; i < ops.size(); i++)
+  {
+    int image = ops[i].image;
+    bool mapped = false;
+
+    if ((image >= 0) && (image <= 7))
+    {
+      VMEReadLock guard(vme->imageLock[image]);
+
+      if (vme->vme_handle[image] != -1)
+      {
+        req->ops[i].offset = ops[i].addr - vme->vmeBaseAddr[image];
+        mapped = true;
+      }
+    }
+
+    if (!mapped)
+    {
+      *Err << "executeBatch: Access " << i << " uses invalid image " << image << "!\n";
+      freeRequest(req);
+      return -1;
+    }
+
+    req->ops[i].image = ops[i].image;
+    req->ops[i].width = ops[i].width;
+    req->ops[i].write = ops[i].write;
+    req->ops[i].data = ops[i].data;
+  }
+
+  req->userOps = &ops;
+  req->batch.ops = (uintptr_t) &req->ops[0];
+  req->batch.count = ops.size();
+  req->batch.berr = -1;
+  req->cmd.arg = (uintptr_t) &req->batch;
+
+  return queueRequest(vme->uni_handle, IOCTL_EXEC_BATCH, req);
+}
+
+//----------------------------------------------------------------------------
+//  Constructors
+//----------------------------------------------------------------------------
+VMERing::VMERing(unsigned int nrEntries)
+{
+  vme = 0;
+  init(nrEntries);
+}
+
+VMERing::VMERing(VMEBridge &bridge, unsigned int nrEntries)
+{
+  vme = &bridge;
+  init(nrEntries);
+  Err = bridge.Err;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+VMERing::~VMERing()
+{
+  uint64_t tag;
+  int result;
+  unsigned int i;
+
+  // the driver still accesses the data of requests in flight
+
+  if (ringFd >= 0)
+  {
+    submit();
+    while (freeRequests.size() < requests.size())
+      if (reap(&tag, &result, true) < 0)
+        break;
+
+    munmap(sqes, entries * sizeof(struct io_uring_sqe));
+    munmap(sqRing, sqRingSize);
+    munmap(cqRing, cqRingSize);
+    close(ringFd);
+  }
+
+  for (i = 0; i < requests.size(); i++)
+    delete requests[i];
+}
@@ -0,0 +1,109 @@
+/*
+ Definition of class VMERing
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMERING_H
+#define VMERING_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+
+struct io_uring_sqe;
+struct iovec;
+struct VMERingRequest;
+
+//----------------------------------------------------------------------------
+//  VMERing: io_uring based asynchronous access to the universeII driver.
+//
+//  DMA transfers, command packet lists and access batches are queued on the
+//  submission ring and executed by the driver in kernel worker threads, so
+//  the calling thread continues after submit(). Completions are collected
+//  with reap(), which returns the tag given at queue time and the result of
+//  the operation: the DMA buffer offset, 0 or the number of the unprocessed
+//  packet of a list, the accesses done by a batch, or -errno (-EIO on bus
+//  or DMA error, -EBUSY, -EINVAL).
+//
+//  The ring can also be used for other io_uring operations: get a free entry
+//  with getSqe(), fill it and submit(). Their user_data must be < 2^63.
+//----------------------------------------------------------------------------
+
+class VMERing
+{
+private:
+  VMEBridge *vme;
+  int ringFd;
+  unsigned int entries;
+
+  unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned int *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe *sqes;
+  void *cqes;
+  void *sqRing, *cqRing;
+  size_t sqRingSize, cqRingSize;
+  unsigned int sqLocalTail;
+
+  std::vector<VMERingRequest *> requests;
+  std::vector<int> freeRequests;
+
+  void init(unsigned int nrEntries);
+  VMERingRequest *allocRequest(int type, uint64_t tag);
+  void freeRequest(VMERingRequest *req);
+  int queueRequest(int fd, unsigned int op, VMERingRequest *req);
+  int finishRequest(VMERingRequest *req, int res);
+
+public:
+  VMERing(unsigned int nrEntries = 64);
+  VMERing(VMEBridge &bridge, unsigned int nrEntries = 64);
+  virtual ~VMERing();
+
+  bool valid() const
+  {
+    return ringFd >= 0;
+  }
+
+  int getFd() const
+  {
+    return ringFd;
+  }
+
+  // VME operations
+
+  int DMAread(unsigned int source, unsigned int count, int vas, int vdw, unsigned int bufNr, uint64_t tag);
+  int DMAwrite(unsigned int dest, unsigned int count, int vas, int vdw, unsigned int bufNr, uint64_t tag);
+  int execCmdPktList(int list, uint64_t tag);
+  int executeBatch(std::vector<VMEBatchOp> &ops, uint64_t tag);
+
+  // generic ring handling
+
+  struct io_uring_sqe *getSqe(void);
+  int submit(unsigned int waitNr = 0);
+  int reap(uint64_t *tag, int *result, bool wait = true);
+  int registerBuffers(const struct iovec *iov, unsigned int nrIov);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
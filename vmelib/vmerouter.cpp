@@ -0,0 +1,339 @@
+/*
+ Implementation of class VMERouter
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "vmelock.h"
+#include "vmerouter.h"
+
+using namespace std;
+
+#define MIN_WINDOW  0x10000      // images are 64 kB aligned
+
+struct VMERouterWindow
+{
+  int image;
+  int space;
+  unsigned int base, size;
+  list<VMERouterWindow *>::iterator lruPos;
+};
+
+//----------------------------------------------------------------------------
+//  Index of address space 'vas' and its size, -1 if invalid
+//----------------------------------------------------------------------------
+static int addrSpace(int vas, uint64_t *end)
+{
+  switch (vas)
+  {
+  case A16:
+    *end = 0x10000ULL;
+    return 0;
+  case A24:
+    *end = 0x1000000ULL;
+    return 1;
+  case A32:
+    *end = 0x100000000ULL;
+    return 2;
+  default:
+    *end = 0;
+    return -1;
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Constructor, 'winSize' is rounded up to a power of 2 of at least 64 kB
+//----------------------------------------------------------------------------
+VMERouter::VMERouter(VMEBridge &bridge, unsigned int winSize, int dw, unsigned int maxImg)
+{
+  vme = &bridge;
+  vdw = dw;
+  maxImages = ((maxImg < 1) || (maxImg > 8)) ? 8 : maxImg;
+
+  windowSize = MIN_WINDOW;
+  while ((windowSize < winSize) && (windowSize < 0x80000000))
+    windowSize <<= 1;
+
+  nrWindows = 0;
+  hits = 0;
+  misses = 0;
+  remaps = 0;
+
+  Err = &cerr;
+
+  pthread_mutex_init(&lock, NULL);
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+VMERouter::~VMERouter()
+{
+  releaseAll();
+  pthread_mutex_destroy(&lock);
+}
+
+//----------------------------------------------------------------------------
+//  Find window covering [addr, addr + size). Only the window with the
+//  highest base <= addr is checked: windows are aligned to the window size
+//  except for accesses crossing a window boundary, which at worst cost an
+//  additional window.
+//----------------------------------------------------------------------------
+VMERouterWindow *VMERouter::lookup(int space, unsigned int addr, unsigned int size)
+{
+  map<unsigned int, VMERouterWindow *>::iterator it;
+  VMERouterWindow *w;
+
+  it = index[space].upper_bound(addr);
+  if (it == index[space].begin())
+    return NULL;
+
+  w = (--it)->second;
+  if ((uint64_t) addr + size > (uint64_t) w->base + w->size)
+    return NULL;
+
+  return w;
+}
+
+//----------------------------------------------------------------------------
+//  Map a new window for [addr, addr + size), recycle the least recently
+//  used window if no image is available
+//----------------------------------------------------------------------------
+VMERouterWindow *VMERouter::mapWindow(int vas, int space, unsigned int addr, unsigned int size)
+{
+  VMERouterWindow *w;
+  uint64_t end, base, winSize;
+  int image;
+
+  if (addrSpace(vas, &end) != space)
+  {
+    *Err << "VMERouter: Invalid address space!\n";
+    return NULL;
+  }
+
+  winSize = windowSize;
+  if (winSize > end)
+    winSize = end;
+
+  base = addr & ~(winSize - 1);
+  if (addr + (uint64_t) size > base + winSize)   // access crosses window end
+    base = addr & ~(uint64_t) (MIN_WINDOW - 1);
+  if (base + winSize > end)
+    base = end - winSize;
+
+  // a window at the same base doesn't cover the access, replace it
+
+  if (index[space].count((unsigned int) base))
+  {
+    unmapWindow(index[space][(unsigned int) base]);
+    remaps++;
+  }
+
+  for (;;)
+  {
+    if (nrWindows >= maxImages)
+    {
+      unmapWindow(lru.back());
+      remaps++;
+    }
+
+    image = vme->getImage((unsigned int) base, (unsigned int) winSize, vas, vdw, MASTER);
+    if (image >= 0)
+      break;
+
+    if (!nrWindows)
+    {
+      *Err << "VMERouter: Can't map window at 0x" << hex << base << dec << "!\n";
+      return NULL;
+    }
+
+    unmapWindow(lru.back());
+    remaps++;
+  }
+
+  w = new VMERouterWindow;
+  w->image = image;
+  w->space = space;
+  w->base = (unsigned int) base;
+  w->size = (unsigned int) winSize;
+
+  lru.push_front(w);
+  w->lruPos = lru.begin();
+  index[space][w->base] = w;
+  nrWindows++;
+
+  return w;
+}
+
+//----------------------------------------------------------------------------
+//  Release image of window 'w'
+//----------------------------------------------------------------------------
+void VMERouter::unmapWindow(VMERouterWindow *w)
+{
+  vme->releaseImage(w->image);
+
+  index[w->space].erase(w->base);
+  lru.erase(w->lruPos);
+  nrWindows--;
+
+  delete w;
+}
+
+//----------------------------------------------------------------------------
+//  Get image for [addr, addr + size), lock must be held
+//----------------------------------------------------------------------------
+int VMERouter::route(int vas, unsigned int addr, unsigned int size)
+{
+  VMERouterWindow *w;
+  uint64_t end;
+  int space;
+
+  space = addrSpace(vas, &end);
+  if ((space < 0) || ((uint64_t) addr + size > end) || (size > windowSize))
+  {
+    *Err << "VMERouter: Address 0x" << hex << addr << dec << " is invalid for address space!\n";
+    return -1;
+  }
+
+  w = lookup(space, addr, size);
+  if (w)
+  {
+    hits++;
+    if (w->lruPos != lru.begin())
+      lru.splice(lru.begin(), lru, w->lruPos);
+    return w->image;
+  }
+
+  misses++;
+  w = mapWindow(vas, space, addr, size);
+  if (!w)
+    return -2;
+
+  return w->image;
+}
+
+int VMERouter::imageFor(int vas, unsigned int addr, unsigned int size)
+{
+  VMEMutexLock guard(lock);
+
+  return route(vas, addr, size);
+}
+
+//----------------------------------------------------------------------------
+//  Single accesses
+//----------------------------------------------------------------------------
+int VMERouter::read32(int vas, unsigned int addr, unsigned int *data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 4)) < 0)
+    return -2;
+
+  return vme->rlDirect(image, addr, data);
+}
+
+int VMERouter::read16(int vas, unsigned int addr, unsigned short *data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 2)) < 0)
+    return -2;
+
+  return vme->rwDirect(image, addr, data);
+}
+
+int VMERouter::read8(int vas, unsigned int addr, unsigned char *data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 1)) < 0)
+    return -2;
+
+  return vme->rbDirect(image, addr, data);
+}
+
+int VMERouter::write32(int vas, unsigned int addr, unsigned int data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 4)) < 0)
+    return -2;
+
+  return vme->wlDirect(image, addr, data);
+}
+
+int VMERouter::write16(int vas, unsigned int addr, unsigned short data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 2)) < 0)
+    return -2;
+
+  return vme->wwDirect(image, addr, data);
+}
+
+int VMERouter::write8(int vas, unsigned int addr, unsigned char data)
+{
+  int image;
+  VMEMutexLock guard(lock);
+
+  if ((image = route(vas, addr, 1)) < 0)
+    return -2;
+
+  return vme->wbDirect(image, addr, data);
+}
+
+//----------------------------------------------------------------------------
+//  Release all images of the router
+//----------------------------------------------------------------------------
+void VMERouter::releaseAll(void)
+{
+  VMEMutexLock guard(lock);
+
+  while (!lru.empty())
+    unmapWindow(lru.back());
+}
+
+//----------------------------------------------------------------------------
+//  Statistics
+//----------------------------------------------------------------------------
+unsigned long long VMERouter::getHits(void)
+{
+  VMEMutexLock guard(lock);
+  return hits;
+}
+
+unsigned long long VMERouter::getMisses(void)
+{
+  VMEMutexLock guard(lock);
+  return misses;
+}
+
+unsigned long long VMERouter::getRemaps(void)
+{
+  VMEMutexLock guard(lock);
+  return remaps;
+}
+
+unsigned int VMERouter::getWindowCount(void)
+{
+  VMEMutexLock guard(lock);
+  return nrWindows;
+}
@@ -0,0 +1,100 @@
+/*
+ Definition of class VMERouter
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEROUTER_H
+#define VMEROUTER_H
+
+#include <list>
+#include <map>
+#include <pthread.h>
+
+#include "vmelib.h"
+
+struct VMERouterWindow;
+
+//----------------------------------------------------------------------------
+//  VMERouter: access the whole VME address space without handling images.
+//
+//  Each access is routed to a master image covering the address. Images
+//  are looked up in a sorted index per address space; if none covers the
+//  address, a new window of 'windowSize' bytes (aligned to its size) is
+//  mapped by getImage(). When no image is left, the least recently used
+//  window of the router is released and remapped, which is counted in
+//  getRemaps(). Accesses of one router are serialized.
+//----------------------------------------------------------------------------
+
+class VMERouter
+{
+private:
+  VMEBridge *vme;
+  unsigned int windowSize, maxImages;
+  int vdw;
+
+  std::map<unsigned int, VMERouterWindow *> index[3];   // A16, A24, A32
+  std::list<VMERouterWindow *> lru;                      // front: newest
+  unsigned int nrWindows;
+
+  unsigned long long hits, misses, remaps;
+  pthread_mutex_t lock;
+
+  VMERouterWindow *lookup(int space, unsigned int addr, unsigned int size);
+  VMERouterWindow *mapWindow(int vas, int space, unsigned int addr, unsigned int size);
+  void unmapWindow(VMERouterWindow *w);
+  int route(int vas, unsigned int addr, unsigned int size);
+
+  VMERouter(const VMERouter &);
+  VMERouter &operator=(const VMERouter &);
+
+public:
+  VMERouter(VMEBridge &bridge, unsigned int windowSize = 0x100000, int vdw = D32, unsigned int maxImages = 8);
+  virtual ~VMERouter();
+
+  // single accesses, return values as VMEBridge::rlDirect()
+
+  int read32(int vas, unsigned int addr, unsigned int *data);
+  int read16(int vas, unsigned int addr, unsigned short *data);
+  int read8(int vas, unsigned int addr, unsigned char *data);
+
+  int write32(int vas, unsigned int addr, unsigned int data);
+  int write16(int vas, unsigned int addr, unsigned short data);
+  int write8(int vas, unsigned int addr, unsigned char data);
+
+  // image covering [addr, addr + size), valid until the next router call
+
+  int imageFor(int vas, unsigned int addr, unsigned int size);
+
+  void releaseAll(void);
+
+  // statistics
+
+  unsigned long long getHits(void);
+  unsigned long long getMisses(void);
+  unsigned long long getRemaps(void);
+  unsigned int getWindowCount(void);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -0,0 +1,344 @@
+/*
+ Implementation of class ShadowRegisters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "vmelock.h"
+#include "vmeshadow.h"
+
+using namespace std;
+
+#define REG_KEY(image, width, addr)  (((uint64_t) (image) << 40) | ((uint64_t) (width) << 32) | (addr))
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+ShadowRegisters::ShadowRegisters(VMEBridge &bridge)
+{
+  vme = &bridge;
+  nrDirty = 0;
+  skipped = 0;
+  written = 0;
+  blocks = 0;
+  Err = &cerr;
+
+  pthread_mutex_init(&lock, NULL);
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, registers not flushed are dropped
+//----------------------------------------------------------------------------
+ShadowRegisters::~ShadowRegisters()
+{
+  pthread_mutex_destroy(&lock);
+}
+
+//----------------------------------------------------------------------------
+//  Record register value
+//----------------------------------------------------------------------------
+int ShadowRegisters::stage(int image, unsigned int addr, int width, unsigned int value)
+{
+  if ((image < 0) || (image > 7) || (addr % width))
+  {
+    *Err << "ShadowRegisters: Invalid register 0x" << hex << addr << dec << ", image " << image << "!\n";
+    return -1;
+  }
+
+  VMEMutexLock guard(lock);
+  Entry &e = regs[REG_KEY(image, width, addr)];   // new entries are zeroed
+
+  if (e.known && (e.hw == value))
+  {
+    if (e.dirty)
+    {
+      e.dirty = false;   // changed back before flush
+      nrDirty--;
+    }
+    e.value = value;
+    skipped++;
+    return 0;
+  }
+
+  e.value = value;
+  if (!e.dirty)
+  {
+    e.dirty = true;
+    nrDirty++;
+  }
+
+  return 1;
+}
+
+int ShadowRegisters::write32(int image, unsigned int addr, unsigned int value)
+{
+  return stage(image, addr, 4, value);
+}
+
+int ShadowRegisters::write16(int image, unsigned int addr, unsigned short value)
+{
+  return stage(image, addr, 2, value);
+}
+
+int ShadowRegisters::write8(int image, unsigned int addr, unsigned char value)
+{
+  return stage(image, addr, 1, value);
+}
+
+//----------------------------------------------------------------------------
+//  Find runs of consecutive dirty registers, lock must be held
+//----------------------------------------------------------------------------
+void ShadowRegisters::collectRuns(vector<Run> &runs)
+{
+  RegMap::iterator it;
+  int image, width;
+  unsigned int addr;
+
+  for (it = regs.begin(); it != regs.end(); it++)
+  {
+    if (!it->second.dirty)
+      continue;
+
+    image = (int) (it->first >> 40);
+    width = (int) ((it->first >> 32) & 0xFF);
+    addr = (unsigned int) it->first;
+
+    if (!runs.empty())
+    {
+      Run &r = runs.back();
+
+      if ((r.image == image) && (r.width == width) && ((uint64_t) r.addr + r.n * width == addr))
+      {
+        r.n++;
+        continue;
+      }
+    }
+
+    Run r;
+
+    r.image = image;
+    r.width = width;
+    r.addr = addr;
+    r.n = 1;
+    r.first = it;
+    runs.push_back(r);
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Copy the values of 'run' to 'dst' in units of the register width
+//----------------------------------------------------------------------------
+void ShadowRegisters::fillRun(const Run &run, void *dst)
+{
+  RegMap::iterator it = run.first;
+  unsigned int i;
+
+  for (i = 0; i < run.n; i++, it++)
+  {
+    if (run.width == 4)
+      ((unsigned int *) dst)[i] = it->second.value;
+    else if (run.width == 2)
+      ((unsigned short *) dst)[i] = (unsigned short) it->second.value;
+    else
+      ((unsigned char *) dst)[i] = (unsigned char) it->second.value;
+  }
+}
+
+//----------------------------------------------------------------------------
+//  Mark registers of 'run' as written
+//----------------------------------------------------------------------------
+void ShadowRegisters::cleanRun(const Run &run)
+{
+  RegMap::iterator it = run.first;
+  unsigned int i;
+
+  for (i = 0; i < run.n; i++, it++)
+  {
+    it->second.hw = it->second.value;
+    it->second.known = true;
+    it->second.dirty = false;
+  }
+
+  nrDirty -= run.n;
+  written += run.n;
+  blocks++;
+}
+
+//----------------------------------------------------------------------------
+//  Write dirty registers by block writes through the images
+//----------------------------------------------------------------------------
+int ShadowRegisters::flush(void)
+{
+  vector<Run> runs;
+  vector<unsigned int> buf;
+  unsigned int i;
+  int ret, res = 0;
+
+  VMEMutexLock guard(lock);
+
+  collectRuns(runs);
+
+  for (i = 0; i < runs.size(); i++)
+  {
+    const Run &r = runs[i];
+
+    buf.resize((r.n * r.width + 3) / 4);
+    fillRun(r, &buf[0]);
+
+    if (r.width == 4)
+      ret = vme->wl(r.image, r.addr, &buf[0], r.n * 4);
+    else if (r.width == 2)
+      ret = vme->ww(r.image, r.addr, (unsigned short *) &buf[0], r.n * 2);
+    else
+      ret = vme->wb(r.image, r.addr, (unsigned char *) &buf[0], r.n);
+
+    if (ret == 0)
+      cleanRun(r);
+    else
+      res = -1;
+  }
+
+  return res;
+}
+
+//----------------------------------------------------------------------------
+//  Write dirty registers by one DMA command packet list, all registers
+//  must be in address space 'vas'. requestDMA() must have been called.
+//----------------------------------------------------------------------------
+int ShadowRegisters::flushDMA(int vas)
+{
+  vector<Run> runs;
+  unsigned int i, offset, bufSize;
+  uintptr_t base;
+  int list, vdw, ret;
+
+  VMEMutexLock guard(lock);
+
+  collectRuns(runs);
+  if (runs.empty())
+    return 0;
+
+  base = vme->getDMABase();
+  bufSize = vme->getDMABufSize() * vme->getDMABufCount();
+  if (!base)
+  {
+    *Err << "ShadowRegisters: requestDMA() must be called first!\n";
+    return -1;
+  }
+
+  if ((list = vme->newCmdPktList()) < 0)
+    return -1;
+
+  for (i = 0; i < runs.size(); i++)
+  {
+    const Run &r = runs[i];
+
+    vdw = (r.width == 4) ? D32 : (r.width == 2) ? D16 : D8;
+
+    offset = vme->addCmdPkt(list, 1, r.addr, r.n * r.width, vas, vdw);
+    if ((offset == 0xFFFFFFFF) || ((uint64_t) offset + r.n * r.width > bufSize))
+    {
+      *Err << "ShadowRegisters: Dirty registers exceed DMA buffer, use flush()!\n";
+      vme->delCmdPktList(list);
+      return -1;
+    }
+
+    fillRun(r, (void *) (base + offset));
+  }
+
+  ret = vme->execCmdPktList(list);
+  vme->delCmdPktList(list);
+
+  if (ret != 0)
+    return -1;
+
+  for (i = 0; i < runs.size(); i++)
+    cleanRun(runs[i]);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Get recorded value of a register, returns 1 if it was written to the
+//  module, 0 if still dirty, -1 if unknown
+//----------------------------------------------------------------------------
+int ShadowRegisters::get(int image, unsigned int addr, int width, unsigned int *value)
+{
+  RegMap::iterator it;
+
+  VMEMutexLock guard(lock);
+
+  it = regs.find(REG_KEY(image, width, addr));
+  if ((it == regs.end()) || (!it->second.known && !it->second.dirty))
+    return -1;
+
+  *value = it->second.value;
+
+  return it->second.dirty ? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+//  Forget the values known to be in the modules (of 'image'), all of its
+//  registers are written by the next flush()
+//----------------------------------------------------------------------------
+void ShadowRegisters::invalidate(void)
+{
+  invalidate(-1);
+}
+
+void ShadowRegisters::invalidate(int image)
+{
+  RegMap::iterator it;
+
+  VMEMutexLock guard(lock);
+
+  for (it = regs.begin(); it != regs.end(); it++)
+    if ((image < 0) || ((int) (it->first >> 40) == image))
+    {
+      it->second.known = false;
+      if (!it->second.dirty)
+      {
+        it->second.dirty = true;
+        nrDirty++;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+//  Statistics
+//----------------------------------------------------------------------------
+unsigned int ShadowRegisters::getDirtyCount(void)
+{
+  VMEMutexLock guard(lock);
+  return nrDirty;
+}
+
+unsigned long long ShadowRegisters::getSkipped(void)
+{
+  VMEMutexLock guard(lock);
+  return skipped;
+}
+
+unsigned long long ShadowRegisters::getWritten(void)
+{
+  VMEMutexLock guard(lock);
+  return written;
+}
+
+unsigned long long ShadowRegisters::getBlocks(void)
+{
+  VMEMutexLock guard(lock);
+  return blocks;
+}
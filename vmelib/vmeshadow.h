@@ -0,0 +1,114 @@
+/*
+ Definition of class ShadowRegisters
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMESHADOW_H
+#define VMESHADOW_H
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  ShadowRegisters: cache of configuration register values.
+//
+//  write32/16/8() only record the value. A register is marked dirty if its
+//  value differs from the last value written to the module, writes of the
+//  known value are skipped. flush() writes the dirty registers sorted by
+//  image, width and address, consecutive registers as one block write
+//  (or one DMA command packet with flushDMA()).
+//
+//  Writes are reordered, call flush() where the order matters (e.g. after
+//  a module reset). invalidate() forgets the known values, e.g. after a
+//  power cycle, so all registers are written again.
+//----------------------------------------------------------------------------
+
+class ShadowRegisters
+{
+private:
+  struct Entry
+  {
+    unsigned int value;    // latest value
+    unsigned int hw;       // value last written to the module
+    bool known;            // 'hw' is valid
+    bool dirty;            // 'value' must be written
+  };
+
+  typedef std::map<uint64_t, Entry> RegMap;   // key: image, width, address
+
+  // consecutive dirty registers of one image and width
+
+  struct Run
+  {
+    int image, width;
+    unsigned int addr, n;
+    RegMap::iterator first;
+  };
+
+  VMEBridge *vme;
+  RegMap regs;
+  unsigned int nrDirty;
+  unsigned long long skipped, written, blocks;
+  pthread_mutex_t lock;
+
+  int stage(int image, unsigned int addr, int width, unsigned int value);
+  void collectRuns(std::vector<Run> &runs);
+  void fillRun(const Run &run, void *dst);
+  void cleanRun(const Run &run);
+
+  ShadowRegisters(const ShadowRegisters &);
+  ShadowRegisters &operator=(const ShadowRegisters &);
+
+public:
+  ShadowRegisters(VMEBridge &bridge);
+  virtual ~ShadowRegisters();
+
+  // record register values, returns 1 if dirty, 0 if skipped, -1 on error
+
+  int write32(int image, unsigned int addr, unsigned int value);
+  int write16(int image, unsigned int addr, unsigned short value);
+  int write8(int image, unsigned int addr, unsigned char value);
+
+  // write dirty registers, returns 0 or -1 (failed registers stay dirty)
+
+  int flush(void);
+  int flushDMA(int vas);
+
+  int get(int image, unsigned int addr, int width, unsigned int *value);
+  void invalidate(void);
+  void invalidate(int image);
+
+  // statistics
+
+  unsigned int getDirtyCount(void);
+  unsigned long long getSkipped(void);
+  unsigned long long getWritten(void);
+  unsigned long long getBlocks(void);
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
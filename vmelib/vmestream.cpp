@@ -0,0 +1,480 @@
+/*
+ Implementation of classes VMEInputStream and VMEOutputStream
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "vmestream.h"
+
+using namespace std;
+
+#define SHRINK_RUNS  8     // slots found read ahead before reducing the depth
+
+//----------------------------------------------------------------------------
+//  VMEInputStream constructor, starts reading ahead
+//----------------------------------------------------------------------------
+VMEInputStream::VMEInputStream(VMEBridge &bridge, unsigned int vmeAddr, unsigned int length, int vas, int vdw, bool fifo)
+{
+  Err = &cerr;
+  vme = &bridge;
+  this->vas = vas;
+  this->vdw = vdw;
+  this->fifo = fifo;
+
+  fetchAddr = vmeAddr;
+  remaining = length;
+  unbounded = fifo && (length == 0);
+  ended = false;
+
+  requested = 0;
+  inFlight = false;
+  head = filled = issued = 0;
+  fullRuns = 0;
+  position = 0;
+  error = 0;
+  transfers = 0;
+  waits = 0;
+
+  dmaBase = vme->getDMABase();
+  slotSize = vme->getDMABufSize();
+  chunk = (slotSize - 8) & ~7;
+
+  if ((!dmaBase) || (!vme->getDMABufCount()) || (slotSize < 16))
+  {
+    *Err << "VMEInputStream: requestDMA() must be called first!\n";
+    error = -1;
+    depth = 0;
+    return;
+  }
+
+  slots.resize(vme->getDMABufCount());
+  depth = (slots.size() > 1) ? 1 : 0;
+
+  pump(false);
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, the DMA engine still writes to the buffer of a transfer
+//----------------------------------------------------------------------------
+VMEInputStream::~VMEInputStream()
+{
+  if (inFlight)
+    dma.wait(-1);
+}
+
+//----------------------------------------------------------------------------
+//  Collect a finished transfer (wait for it if 'wait' is true) and, with
+//  'start', start the next one if the read ahead depth allows
+//     returns 0 on success, < 0 on error
+//----------------------------------------------------------------------------
+int VMEInputStream::pump(bool wait, bool start)
+{
+  unsigned int len, index;
+  int ret;
+
+  if (inFlight)
+  {
+    ret = dma.wait(wait ? -1 : 0);
+    if (ret < 0)
+    {
+      inFlight = false;
+      error = -2;
+      return error;
+    }
+
+    if (ret == 1)
+    {
+      Slot &s = slots[filled % slots.size()];
+
+      s.offset = dma.offset();
+      s.count = dma.count();
+      s.pos = 0;
+      filled++;
+      transfers++;
+      inFlight = false;
+
+      // BLT until BERR: the module has no more data
+
+      if (s.count < requested)
+      {
+        ended = true;
+        remaining = 0;
+        unbounded = false;
+      }
+    }
+  }
+
+  if ((!start) || (inFlight) || (ended) || ((!remaining) && (!unbounded)) || (issued - head >= depth + 1))
+    return 0;
+
+  len = ((unbounded) || (remaining > chunk)) ? chunk : remaining;
+  index = issued % slots.size();
+
+  dma = vme->DMAreadAsync(fetchAddr, len, vas, vdw, index);
+  if (!dma.valid())
+  {
+    error = -2;
+    return error;
+  }
+
+  requested = len;
+  inFlight = true;
+  issued++;
+
+  if (!fifo)
+    fetchAddr += len;
+  if (!unbounded)
+    remaining -= len;
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Make sure the slot at 'head' holds data, adapt the read ahead depth when
+//  a slot is started
+//     returns 1 if there is data, 0 at the end, < 0 on error
+//----------------------------------------------------------------------------
+int VMEInputStream::nextSlot(void)
+{
+  if (error)
+    return error;
+
+  if (pump(false) < 0)
+    return error;
+
+  if ((head < filled) && (slots[head % slots.size()].pos != 0))
+    return 1;
+
+  if (head == filled)
+  {
+    if (!inFlight)
+      return 0;
+
+    // the consumer is faster than the read ahead
+
+    waits++;
+    fullRuns = 0;
+    if (depth + 1 < slots.size())
+      depth++;
+
+    while (head == filled)
+    {
+      if (pump(true) < 0)
+        return error;
+      if ((head == filled) && (!inFlight))
+        return 0;
+    }
+  }
+  else if (filled - head - 1 >= depth)
+  {
+    // all read ahead slots were ready, fewer would do
+
+    if ((++fullRuns >= SHRINK_RUNS) && (depth > 1))
+    {
+      depth--;
+      fullRuns = 0;
+    }
+  }
+  else
+    fullRuns = 0;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+//  Read up to 'n' bytes, less at the end of the stream
+//     returns bytes read, 0 at the end, < 0 on error
+//----------------------------------------------------------------------------
+int VMEInputStream::read(void *buf, unsigned int n)
+{
+  unsigned char *dst = (unsigned char *) buf;
+  unsigned int done, k, index;
+  int ret;
+
+  for (done = 0; done < n; done += k)
+  {
+    if ((ret = nextSlot()) <= 0)
+    {
+      if ((ret < 0) && (!done))
+        return ret;
+      break;
+    }
+
+    index = head % slots.size();
+    Slot &s = slots[index];
+
+    k = s.count - s.pos;
+    if (k > n - done)
+      k = n - done;
+
+    memcpy(dst + done, (const void *) (dmaBase + index * slotSize + s.offset + s.pos), k);
+    s.pos += k;
+
+    if (s.pos == s.count)
+    {
+      head++;
+      pump(false);
+    }
+  }
+
+  position += done;
+
+  return done;
+}
+
+//----------------------------------------------------------------------------
+//  Skip 'n' bytes. Data read ahead is dropped, the rest of a memory range
+//  is not transferred; FIFOs are read and discarded.
+//     returns bytes skipped, 0 at the end, < 0 on error
+//----------------------------------------------------------------------------
+int VMEInputStream::skip(unsigned int n)
+{
+  unsigned int done, k;
+  int ret;
+
+  for (done = 0; done < n; done += k)
+  {
+    if (fifo)
+      ret = nextSlot();
+    else if ((ret = error) == 0)
+    {
+      // memory: no new transfers, the one in flight can't be stopped
+
+      ret = pump(false, false);
+      if ((ret == 0) && (head == filled) && (inFlight))
+      {
+        ret = pump(true, false);
+        k = 0;
+        continue;
+      }
+
+      if ((ret == 0) && (head == filled))
+      {
+        if ((ended) || (!remaining))
+          break;
+
+        k = (remaining > n - done) ? n - done : remaining;
+        fetchAddr += k;
+        remaining -= k;
+        continue;
+      }
+
+      ret = 1;
+    }
+
+    if (ret <= 0)
+    {
+      if ((ret < 0) && (!done))
+        return ret;
+      break;
+    }
+
+    Slot &s = slots[head % slots.size()];
+
+    k = s.count - s.pos;
+    if (k > n - done)
+      k = n - done;
+    s.pos += k;
+
+    if (s.pos == s.count)
+      head++;
+  }
+
+  position += done;
+  pump(false);
+
+  return done;
+}
+
+bool VMEInputStream::eof(void)
+{
+  if (error)
+    return true;
+
+  pump(false);
+
+  return (head == filled) && (!inFlight);
+}
+
+//----------------------------------------------------------------------------
+//  VMEOutputStream constructor
+//----------------------------------------------------------------------------
+VMEOutputStream::VMEOutputStream(VMEBridge &bridge, unsigned int vmeAddr, int vas, int vdw, bool fifo)
+{
+  Err = &cerr;
+  vme = &bridge;
+  this->vas = vas;
+  this->vdw = vdw;
+  this->fifo = fifo;
+
+  nextAddr = vmeAddr;
+  fill = 0;
+  offset = 0;
+  inFlight = false;
+  filled = sent = done = 0;
+  position = 0;
+  error = 0;
+  transfers = 0;
+  waits = 0;
+
+  dmaBase = vme->getDMABase();
+  slotSize = vme->getDMABufSize();
+  chunk = (slotSize - 8) & ~7;
+
+  if ((!dmaBase) || (!vme->getDMABufCount()) || (slotSize < 16))
+  {
+    *Err << "VMEOutputStream: requestDMA() must be called first!\n";
+    error = -1;
+    return;
+  }
+
+  slots.resize(vme->getDMABufCount());
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, writes what is left
+//----------------------------------------------------------------------------
+VMEOutputStream::~VMEOutputStream()
+{
+  flush();
+
+  if (inFlight)
+    dma.wait(-1);
+}
+
+//----------------------------------------------------------------------------
+//  Collect a finished transfer (wait for it if 'wait' is true) and start
+//  writing the next full slot
+//     returns 0 on success, < 0 on error
+//----------------------------------------------------------------------------
+int VMEOutputStream::pump(bool wait)
+{
+  int ret;
+
+  if (inFlight)
+  {
+    ret = dma.wait(wait ? -1 : 0);
+    if (ret < 0)
+    {
+      inFlight = false;
+      error = -2;
+      return error;
+    }
+
+    if (ret == 1)
+    {
+      inFlight = false;
+      done++;
+      transfers++;
+    }
+  }
+
+  if ((inFlight) || (sent == filled))
+    return 0;
+
+  Slot &s = slots[sent % slots.size()];
+
+  dma = vme->DMAwriteAsync(s.vmeAddr, s.count, vas, vdw, sent % slots.size());
+  if (!dma.valid())
+  {
+    error = -2;
+    return error;
+  }
+
+  inFlight = true;
+  sent++;
+
+  return 0;
+}
+
+int VMEOutputStream::commitSlot(void)
+{
+  slots[filled % slots.size()].count = fill;
+  filled++;
+
+  if (!fifo)
+    nextAddr += fill;
+  fill = 0;
+
+  return pump(false);
+}
+
+//----------------------------------------------------------------------------
+//  Copy 'n' bytes into the DMA buffers, full ones are written behind
+//     returns 'n', < 0 on error
+//----------------------------------------------------------------------------
+int VMEOutputStream::write(const void *buf, unsigned int n)
+{
+  const unsigned char *src = (const unsigned char *) buf;
+  unsigned int left, k, index;
+
+  if (error)
+    return error;
+
+  for (left = n; left > 0; left -= k, src += k)
+  {
+    index = filled % slots.size();
+
+    if (!fill)
+    {
+      // all slots written or in flight: wait for the oldest
+
+      if (filled - done >= slots.size())
+      {
+        waits++;
+        while (filled - done >= slots.size())
+          if (pump(true) < 0)
+            return error;
+      }
+
+      slots[index].vmeAddr = nextAddr;
+      offset = nextAddr & 7;
+    }
+
+    k = chunk - fill;
+    if (k > left)
+      k = left;
+
+    memcpy((void *) (dmaBase + index * slotSize + offset + fill), src, k);
+    fill += k;
+
+    if ((fill == chunk) && (commitSlot() < 0))
+      return error;
+  }
+
+  position += n;
+
+  return n;
+}
+
+//----------------------------------------------------------------------------
+//  Write the current slot and wait for all transfers
+//     returns 0 on success, < 0 on error
+//----------------------------------------------------------------------------
+int VMEOutputStream::flush(void)
+{
+  if (error)
+    return error;
+
+  if ((fill) && (commitSlot() < 0))
+    return error;
+
+  while ((done < filled) && (pump(true) == 0))
+    ;
+
+  return error;
+}
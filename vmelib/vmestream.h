@@ -0,0 +1,207 @@
+/*
+ Definition of classes VMEInputStream and VMEOutputStream
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMESTREAM_H
+#define VMESTREAM_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  VMEInputStream: sequential reading of a VME address range by DMA.
+//
+//  The range is read in chunks of one DMA buffer (requestDMA(nrOfBufs)).
+//  While the caller consumes a buffer, the next ones are read ahead by
+//  asynchronous DMA. The transfers are started and collected inside read()
+//  and skip(), no thread is involved; the DMA engine transfers one chunk
+//  at a time, so the stream needs it for itself while in use.
+//
+//  The read ahead depth adapts to the consumer: it grows when read() has
+//  to wait for a transfer and shrinks when the read ahead buffers stayed
+//  full for a while, leaving the bus to others.
+//
+//  With 'fifo' every chunk is read from 'vmeAddr' (FIFO-backed buffers),
+//  'length' 0 then reads until a transfer returns less (BLT until BERR).
+//  A short transfer always ends the stream.
+//----------------------------------------------------------------------------
+
+class VMEInputStream
+{
+private:
+  struct Slot
+  {
+    unsigned int offset;       // of the data in the DMA buffer
+    unsigned int count;        // bytes transferred
+    unsigned int pos;          // bytes consumed
+  };
+
+  VMEBridge *vme;
+  int vas, vdw;
+  bool fifo;
+
+  uintptr_t dmaBase;
+  unsigned int slotSize, chunk;
+  std::vector<Slot> slots;
+
+  uint64_t fetchAddr;          // VME address of the next transfer
+  uint64_t remaining;          // bytes not yet requested
+  bool unbounded, ended;
+
+  VMEDMAFuture dma;
+  unsigned int requested;      // bytes of the transfer in flight
+  bool inFlight;
+  unsigned long long head, filled, issued;
+
+  unsigned int depth;
+  unsigned int fullRuns;       // slots started with the read ahead full
+  uint64_t position;
+  int error;
+
+  unsigned long long transfers, waits;
+
+  int pump(bool wait, bool start = true);
+  int nextSlot(void);
+
+  VMEInputStream(const VMEInputStream &);
+  VMEInputStream &operator=(const VMEInputStream &);
+
+public:
+  VMEInputStream(VMEBridge &bridge, unsigned int vmeAddr, unsigned int length, int vas, int vdw, bool fifo = false);
+  virtual ~VMEInputStream();
+
+  // returns bytes read, 0 at the end, < 0 on error
+
+  int read(void *buf, unsigned int n);
+  int skip(unsigned int n);
+
+  bool eof(void);
+
+  uint64_t tell(void) const
+  {
+    return position;
+  }
+
+  unsigned int getDepth(void) const
+  {
+    return depth;
+  }
+
+  unsigned long long getTransfers(void) const
+  {
+    return transfers;
+  }
+
+  // times read() had to wait for a transfer
+
+  unsigned long long getWaits(void) const
+  {
+    return waits;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+//----------------------------------------------------------------------------
+//  VMEOutputStream: sequential writing by DMA with write behind. write()
+//  copies into the DMA buffers and returns, full buffers are written by
+//  asynchronous DMA while the next are filled. flush() writes the last
+//  partial buffer and waits for all transfers; errors of transfers
+//  are returned by the next write() or flush().
+//----------------------------------------------------------------------------
+
+class VMEOutputStream
+{
+private:
+  struct Slot
+  {
+    unsigned int vmeAddr;
+    unsigned int count;
+  };
+
+  VMEBridge *vme;
+  int vas, vdw;
+  bool fifo;
+
+  uintptr_t dmaBase;
+  unsigned int slotSize, chunk, offset;
+  std::vector<Slot> slots;
+
+  uint64_t nextAddr;
+  unsigned int fill;           // bytes in the current slot
+
+  VMEDMAFuture dma;
+  bool inFlight;
+  unsigned long long filled, sent, done;
+
+  uint64_t position;
+  int error;
+
+  unsigned long long transfers, waits;
+
+  int pump(bool wait);
+  int commitSlot(void);
+
+  VMEOutputStream(const VMEOutputStream &);
+  VMEOutputStream &operator=(const VMEOutputStream &);
+
+public:
+  VMEOutputStream(VMEBridge &bridge, unsigned int vmeAddr, int vas, int vdw, bool fifo = false);
+  virtual ~VMEOutputStream();
+
+  // returns bytes accepted, < 0 on error
+
+  int write(const void *buf, unsigned int n);
+  int flush(void);
+
+  uint64_t tell(void) const
+  {
+    return position;
+  }
+
+  unsigned long long getTransfers(void) const
+  {
+    return transfers;
+  }
+
+  // times write() had to wait for a free buffer
+
+  unsigned long long getWaits(void) const
+  {
+    return waits;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ Implementation of byte swap and unpack functions for VME data
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SWAP_SIMD                  // SSE2/AVX2 kernels
+#endif
+
+#include "vmeswap.h"
+
+// kernels of one SIMD level, 'n' counts words/long words
+
+struct SwapKernels
+{
+  const char *name;
+  void (*swap16)(unsigned char *dst, const unsigned char *src, unsigned int n);
+  void (*swap32)(unsigned char *dst, const unsigned char *src, unsigned int n);
+
+  // unpack the leading data words of 'src', returns their number
+
+  unsigned int (*dataRun)(const unsigned char *src, unsigned int n, const VMEWordLayout &l,
+                          unsigned int *chan, unsigned int *value, unsigned int *event, unsigned int ev);
+};
+
+//----------------------------------------------------------------------------
+//  Scalar kernels
+//----------------------------------------------------------------------------
+static inline uint32_t load32(const unsigned char *src, bool swap)
+{
+  uint32_t w;
+
+  memcpy(&w, src, 4);
+  return swap ? __builtin_bswap32(w) : w;
+}
+
+static void swap16Scalar(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  unsigned int i;
+  uint16_t w;
+
+  for (i = 0; i < n; i++)
+  {
+    memcpy(&w, src + 2 * i, 2);
+    w = (uint16_t) ((w >> 8) | (w << 8));
+    memcpy(dst + 2 * i, &w, 2);
+  }
+}
+
+static void swap32Scalar(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  unsigned int i;
+  uint32_t l;
+
+  for (i = 0; i < n; i++)
+  {
+    l = load32(src + 4 * i, true);
+    memcpy(dst + 4 * i, &l, 4);
+  }
+}
+
+static unsigned int dataRunScalar(const unsigned char *src, unsigned int n, const VMEWordLayout &l,
+                                  unsigned int *chan, unsigned int *value, unsigned int *event, unsigned int ev)
+{
+  unsigned int i;
+  uint32_t w;
+
+  for (i = 0; i < n; i++)
+  {
+    w = load32(src + 4 * i, l.swap);
+    if (((w >> l.typeShift) & l.typeMask) != l.data)
+      break;
+
+    chan[i] = (w >> l.chanShift) & l.chanMask;
+    value[i] = (w >> l.valueShift) & l.valueMask;
+    event[i] = ev;
+  }
+
+  return i;
+}
+
+#ifdef SWAP_SIMD
+
+//----------------------------------------------------------------------------
+//  SSE2 kernels, SSE2 has no byte shuffle: words are swapped by shifts,
+//  long words by exchanging their words first
+//----------------------------------------------------------------------------
+__attribute__((target("sse2")))
+static inline __m128i bswap16Sse2(__m128i v)
+{
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i bswap32Sse2(__m128i v)
+{
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return bswap16Sse2(v);
+}
+
+__attribute__((target("sse2")))
+static void swap16Sse2(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm_storeu_si128((__m128i *) (dst + 2 * i), bswap16Sse2(_mm_loadu_si128((const __m128i *) (src + 2 * i))));
+
+  swap16Scalar(dst + 2 * i, src + 2 * i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void swap32Sse2(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  unsigned int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_si128((__m128i *) (dst + 4 * i), bswap32Sse2(_mm_loadu_si128((const __m128i *) (src + 4 * i))));
+
+  swap32Scalar(dst + 4 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("sse2")))
+static unsigned int dataRunSse2(const unsigned char *src, unsigned int n, const VMEWordLayout &l,
+                                unsigned int *chan, unsigned int *value, unsigned int *event, unsigned int ev)
+{
+  const __m128i typeShift = _mm_cvtsi32_si128(l.typeShift), typeMask = _mm_set1_epi32(l.typeMask);
+  const __m128i chanShift = _mm_cvtsi32_si128(l.chanShift), chanMask = _mm_set1_epi32(l.chanMask);
+  const __m128i valueShift = _mm_cvtsi32_si128(l.valueShift), valueMask = _mm_set1_epi32(l.valueMask);
+  const __m128i data = _mm_set1_epi32(l.data), evNr = _mm_set1_epi32(ev);
+  unsigned int i;
+  __m128i w, type;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    w = _mm_loadu_si128((const __m128i *) (src + 4 * i));
+    if (l.swap)
+      w = bswap32Sse2(w);
+
+    type = _mm_and_si128(_mm_srl_epi32(w, typeShift), typeMask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(type, data)) != 0xFFFF)
+      break;
+
+    _mm_storeu_si128((__m128i *) (chan + i), _mm_and_si128(_mm_srl_epi32(w, chanShift), chanMask));
+    _mm_storeu_si128((__m128i *) (value + i), _mm_and_si128(_mm_srl_epi32(w, valueShift), valueMask));
+    _mm_storeu_si128((__m128i *) (event + i), evNr);
+  }
+
+  return i + dataRunScalar(src + 4 * i, n - i, l, chan + i, value + i, event + i, ev);
+}
+
+//----------------------------------------------------------------------------
+//  AVX2 kernels, the tails are done by the SSE2 kernels which are not VEX
+//  encoded: the upper halves of the registers must be cleared before, or
+//  each SSE instruction pays for the AVX/SSE transition
+//----------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static inline __m256i swapMask16(void)
+{
+  return _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i swapMask32(void)
+{
+  return _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+}
+
+__attribute__((target("avx2")))
+static void swap16Avx2(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  const __m256i mask = swapMask16();
+  unsigned int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    _mm256_storeu_si256((__m256i *) (dst + 2 * i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (src + 2 * i)), mask));
+
+  _mm256_zeroupper();
+  swap16Sse2(dst + 2 * i, src + 2 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void swap32Avx2(unsigned char *dst, const unsigned char *src, unsigned int n)
+{
+  const __m256i mask = swapMask32();
+  unsigned int i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *) (dst + 4 * i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (src + 4 * i)), mask));
+
+  _mm256_zeroupper();
+  swap32Sse2(dst + 4 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned int dataRunAvx2(const unsigned char *src, unsigned int n, const VMEWordLayout &l,
+                                unsigned int *chan, unsigned int *value, unsigned int *event, unsigned int ev)
+{
+  const __m128i typeShift = _mm_cvtsi32_si128(l.typeShift), chanShift = _mm_cvtsi32_si128(l.chanShift);
+  const __m128i valueShift = _mm_cvtsi32_si128(l.valueShift);
+  const __m256i typeMask = _mm256_set1_epi32(l.typeMask), chanMask = _mm256_set1_epi32(l.chanMask);
+  const __m256i valueMask = _mm256_set1_epi32(l.valueMask), data = _mm256_set1_epi32(l.data);
+  const __m256i evNr = _mm256_set1_epi32(ev), mask = swapMask32();
+  unsigned int i;
+  __m256i w, type;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    w = _mm256_loadu_si256((const __m256i *) (src + 4 * i));
+    if (l.swap)
+      w = _mm256_shuffle_epi8(w, mask);
+
+    type = _mm256_and_si256(_mm256_srl_epi32(w, typeShift), typeMask);
+    if ((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi32(type, data)) != 0xFFFFFFFF)
+      break;
+
+    _mm256_storeu_si256((__m256i *) (chan + i), _mm256_and_si256(_mm256_srl_epi32(w, chanShift), chanMask));
+    _mm256_storeu_si256((__m256i *) (value + i), _mm256_and_si256(_mm256_srl_epi32(w, valueShift), valueMask));
+    _mm256_storeu_si256((__m256i *) (event + i), evNr);
+  }
+
+  _mm256_zeroupper();
+  return i + dataRunSse2(src + 4 * i, n - i, l, chan + i, value + i, event + i, ev);
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//  Kernel selection
+//----------------------------------------------------------------------------
+static const SwapKernels kernels[] =
+{
+  {"scalar", swap16Scalar, swap32Scalar, dataRunScalar},
+#ifdef SWAP_SIMD
+  {"sse2", swap16Sse2, swap32Sse2, dataRunSse2},
+  {"avx2", swap16Avx2, swap32Avx2, dataRunAvx2},
+#endif
+};
+
+static int bestLevel(void)
+{
+#ifdef SWAP_SIMD
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return VME_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return VME_SIMD_SSE2;
+#endif
+  return VME_SIMD_SCALAR;
+}
+
+static int level = bestLevel();
+
+int vmeSwapSelect(int max)
+{
+  level = bestLevel();
+  if (level > max)
+    level = (max < VME_SIMD_SCALAR) ? VME_SIMD_SCALAR : max;
+
+  return level;
+}
+
+const char *vmeSwapKernel(void)
+{
+  return kernels[level].name;
+}
+
+//----------------------------------------------------------------------------
+//  Byte swap
+//----------------------------------------------------------------------------
+void vmeSwap16(void *data, unsigned int n)
+{
+  kernels[level].swap16((unsigned char *) data, (const unsigned char *) data, n);
+}
+
+void vmeSwap32(void *data, unsigned int n)
+{
+  kernels[level].swap32((unsigned char *) data, (const unsigned char *) data, n);
+}
+
+void vmeSwapCopy16(void *dst, const void *src, unsigned int n)
+{
+  kernels[level].swap16((unsigned char *) dst, (const unsigned char *) src, n);
+}
+
+void vmeSwapCopy32(void *dst, const void *src, unsigned int n)
+{
+  kernels[level].swap32((unsigned char *) dst, (const unsigned char *) src, n);
+}
+
+//----------------------------------------------------------------------------
+//  Layout of CAEN V785/V792/V775: type in bits 24-26, channel in bits
+//  16-20, 12 bit value with under threshold/overflow bits, 24 bit event
+//  counter in the trailer
+//----------------------------------------------------------------------------
+VMEWordLayout vmeCaenLayout(bool swap)
+{
+  VMEWordLayout l;
+
+  l.swap = swap;
+  l.typeShift = 24;
+  l.typeMask = 0x7;
+  l.header = 2;
+  l.data = 0;
+  l.trailer = 4;
+  l.chanShift = 16;
+  l.chanMask = 0x1F;
+  l.valueShift = 0;
+  l.valueMask = 0x3FFF;
+  l.countShift = 0;
+  l.countMask = 0xFFFFFF;
+
+  return l;
+}
+
+//----------------------------------------------------------------------------
+//  Unpack: runs of data words are done by the vector kernel, the other
+//  words one by one
+//----------------------------------------------------------------------------
+unsigned int vmeUnpack(const void *src, unsigned int n, const VMEWordLayout &layout, VMEUnpacked &out)
+{
+  const unsigned char *p = (const unsigned char *) src;
+  const SwapKernels &k = kernels[level];
+  unsigned int i = 0, run, type;
+  uint32_t w;
+
+  while (i < n)
+  {
+    run = n - i;
+    if (run > out.size - out.nrData)
+      run = out.size - out.nrData;
+
+    run = k.dataRun(p + 4 * i, run, layout, out.channel + out.nrData, out.value + out.nrData, out.event + out.nrData, out.nrEvents);
+    out.nrData += run;
+    i += run;
+
+    if (i == n)
+      break;
+
+    w = load32(p + 4 * i, layout.swap);
+    type = (w >> layout.typeShift) & layout.typeMask;
+
+    if (type == layout.data)
+      break;    // out is full
+
+    if (type == layout.trailer)
+    {
+      if (out.nrEvents == out.maxEvents)
+        break;
+      out.counter[out.nrEvents++] = (w >> layout.countShift) & layout.countMask;
+    }
+    else if (type == layout.header)
+      out.nrHeaders++;
+    else
+      out.nrInvalid++;
+
+    i++;
+  }
+
+  return i;
+}
@@ -0,0 +1,90 @@
+/*
+ Definition of byte swap and unpack functions for VME data
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMESWAP_H
+#define VMESWAP_H
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------------
+//  Byte swap and unpack of big endian module data, e.g. in a DMA buffer.
+//
+//  The functions use AVX2 or SSE2 if the CPU has them, the kernels are
+//  selected when the library is loaded. vmeSwapSelect() restricts them
+//  (e.g. to compare with the scalar code), call it before threads start.
+//  Buffers need no alignment, 'dst' may be equal to 'src'.
+//----------------------------------------------------------------------------
+
+enum VMESimdLevel
+{
+  VME_SIMD_SCALAR, VME_SIMD_SSE2, VME_SIMD_AVX2
+};
+
+// byte swap 'n' words/long words
+
+void vmeSwap16(void *data, unsigned int n);
+void vmeSwap32(void *data, unsigned int n);
+void vmeSwapCopy16(void *dst, const void *src, unsigned int n);
+void vmeSwapCopy32(void *dst, const void *src, unsigned int n);
+
+// use kernels up to 'level', returns the level in use
+
+int vmeSwapSelect(int level);
+const char *vmeSwapKernel(void);
+
+// layout of the 32 bit words of a module's event data
+
+struct VMEWordLayout
+{
+  bool swap;                            // words are big endian
+  unsigned int typeShift, typeMask;     // word type
+  unsigned int header, data, trailer;   // type codes
+  unsigned int chanShift, chanMask;     // data word: channel
+  unsigned int valueShift, valueMask;   // data word: value
+  unsigned int countShift, countMask;   // trailer: event counter
+};
+
+// layout of CAEN V785/V792/V775 ADCs/TDCs
+
+VMEWordLayout vmeCaenLayout(bool swap);
+
+// unpacked data, structure of arrays filled by vmeUnpack()
+
+struct VMEUnpacked
+{
+  unsigned int *channel;      // per data word
+  unsigned int *value;
+  unsigned int *event;        // index of the event in 'counter'
+  unsigned int size;          // capacity of channel/value/event
+
+  unsigned int *counter;      // per trailer: event counter
+  unsigned int maxEvents;     // capacity of counter
+
+  unsigned int nrData, nrEvents, nrHeaders, nrInvalid;
+};
+
+//----------------------------------------------------------------------------
+//  Unpack 'n' words of 'src' into 'out'. Results are appended, the counts
+//  of 'out' must be set to 0 before the first call. Data words belong to
+//  the event closed by the next trailer.
+//     returns number of words unpacked, less than 'n' if 'out' is full
+//----------------------------------------------------------------------------
+
+unsigned int vmeUnpack(const void *src, unsigned int n, const VMEWordLayout &layout, VMEUnpacked &out);
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ Implementation of class TransferEngine
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "vmetransfer.h"
+
+using namespace std;
+
+#define DEFAULT_DMA_SIZE  0x800    // DMA from this size on without table
+#define CAL_MIN_SIZE      8        // first size of the calibration sweep
+
+//----------------------------------------------------------------------------
+//  Table index of address space/data width, -1 if invalid
+//----------------------------------------------------------------------------
+static int spaceIndex(int vas)
+{
+  switch (vas)
+  {
+  case A16:
+    return 0;
+  case A24:
+    return 1;
+  case A32:
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+static int widthIndex(int vdw)
+{
+  switch (vdw)
+  {
+  case D8:
+    return 0;
+  case D16:
+    return 1;
+  case D32:
+    return 2;
+  case D64:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+static const char *spaceNames[3] = {"A16", "A24", "A32"};
+static const char *widthNames[4] = {"D8", "D16", "D32", "D64"};
+static const int spaces[3] = {A16, A24, A32};
+static const int widths[4] = {D8, D16, D32, D64};
+
+//----------------------------------------------------------------------------
+//  Bytes per single cycle access for data width 'vdw'
+//----------------------------------------------------------------------------
+static int accessWidth(int vdw)
+{
+  return (vdw == D8) ? 1 : (vdw == D16) ? 2 : 4;
+}
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+TransferEngine::TransferEngine(VMEBridge &bridge)
+{
+  vme = &bridge;
+  count[XFER_PIO] = 0;
+  count[XFER_MAPPED] = 0;
+  count[XFER_DMA] = 0;
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor
+//----------------------------------------------------------------------------
+TransferEngine::~TransferEngine()
+{
+}
+
+//----------------------------------------------------------------------------
+//  Name of 'method' as used in the table file
+//----------------------------------------------------------------------------
+const char *TransferEngine::methodName(Method method)
+{
+  return (method == XFER_DMA) ? "dma" : (method == XFER_MAPPED) ? "mapped" : "pio";
+}
+
+//----------------------------------------------------------------------------
+//  Method for a transfer of 'size' bytes
+//----------------------------------------------------------------------------
+TransferEngine::Method TransferEngine::choose(unsigned int size, int vas, int vdw)
+{
+  int s = spaceIndex(vas), w = widthIndex(vdw);
+  unsigned int i;
+
+  if ((s < 0) || (w < 0) || table[s][w].empty())
+    return (size < DEFAULT_DMA_SIZE) ? XFER_MAPPED : XFER_DMA;
+
+  const vector<Crossover> &t = table[s][w];
+
+  for (i = 1; i < t.size(); i++)
+    if (t[i].minSize > size)
+      break;
+
+  return t[i - 1].method;
+}
+
+//----------------------------------------------------------------------------
+//  Use 'method' from 'minSize' bytes on
+//----------------------------------------------------------------------------
+int TransferEngine::setMethod(int vas, int vdw, unsigned int minSize, Method method)
+{
+  int s = spaceIndex(vas), w = widthIndex(vdw);
+  vector<Crossover>::iterator it;
+  Crossover c;
+
+  if ((s < 0) || (w < 0))
+  {
+    *Err << "TransferEngine: Invalid address space or data width!\n";
+    return -1;
+  }
+
+  for (it = table[s][w].begin(); it != table[s][w].end(); it++)
+    if (it->minSize >= minSize)
+      break;
+
+  if ((it != table[s][w].end()) && (it->minSize == minSize))
+  {
+    it->method = method;
+    return 0;
+  }
+
+  c.minSize = minSize;
+  c.method = method;
+  table[s][w].insert(it, c);
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Remove all entries
+//----------------------------------------------------------------------------
+void TransferEngine::clear(void)
+{
+  int s, w;
+
+  for (s = 0; s < 3; s++)
+    for (w = 0; w < 4; w++)
+      table[s][w].clear();
+}
+
+//----------------------------------------------------------------------------
+//  Transfer by 'method', falls back to the next slower method if it is not
+//  available
+//----------------------------------------------------------------------------
+int TransferEngine::run(Method method, int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw, bool write)
+{
+  int width = accessWidth(vdw);
+  int ret;
+
+  if ((method == XFER_DMA) && (vme->getDMABase()))
+  {
+    __sync_fetch_and_add(&count[XFER_DMA], 1);
+
+    if (write)
+      return vme->writeLarge(addr, buf, size, vas, vdw);
+    return vme->readLarge(addr, buf, size, vas, vdw);
+  }
+
+  if (method != XFER_PIO)
+  {
+    if (write)
+      ret = vme->copyToWindow(image, addr, buf, size, 0);
+    else
+      ret = vme->copyFromWindow(image, addr, buf, size, 0);
+
+    if ((ret != -2) || (VMEBridge::lastError().code != VME_NOT_MAPPED))
+    {
+      __sync_fetch_and_add(&count[XFER_MAPPED], 1);
+      return (ret == 0) ? (int) size : ret;
+    }
+  }
+
+  __sync_fetch_and_add(&count[XFER_PIO], 1);
+
+  if (width == 4)
+    ret = write ? vme->wl(image, addr, (unsigned int *) buf, size) : vme->rl(image, addr, (unsigned int *) buf, size);
+  else if (width == 2)
+    ret = write ? vme->ww(image, addr, (unsigned short *) buf, size) : vme->rw(image, addr, (unsigned short *) buf, size);
+  else
+    ret = write ? vme->wb(image, addr, (unsigned char *) buf, size) : vme->rb(image, addr, (unsigned char *) buf, size);
+
+  return (ret == 0) ? (int) size : ret;
+}
+
+//----------------------------------------------------------------------------
+//  Transfer 'size' bytes between VME 'addr' of 'image' and 'buf'. The
+//  image must cover 'addr' with address space 'vas' and data width 'vdw'.
+//     returns number of bytes transferred, < 0 on error
+//----------------------------------------------------------------------------
+int TransferEngine::transfer(int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw, bool write)
+{
+  return run(choose(size, vas, vdw), image, addr, buf, size, vas, vdw, write);
+}
+
+int TransferEngine::read(int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw)
+{
+  return transfer(image, addr, buf, size, vas, vdw, false);
+}
+
+int TransferEngine::write(int image, unsigned int addr, const void *buf, unsigned int size, int vas, int vdw)
+{
+  return transfer(image, addr, (void *) buf, size, vas, vdw, true);
+}
+
+//----------------------------------------------------------------------------
+//  Measure reads of all available methods from 'addr' of 'image' with
+//  sizes doubling up to 'maxSize', best of 'reps' runs each. The entries
+//  of 'vas'/'vdw' are replaced by the crossover points found. Only reads
+//  are done, so any memory of a module may be used.
+//     returns number of entries, < 0 on error
+//----------------------------------------------------------------------------
+int TransferEngine::calibrate(int image, unsigned int addr, unsigned int maxSize, int vas, int vdw, int reps)
+{
+  int s = spaceIndex(vas), w = widthIndex(vdw);
+  int width = accessWidth(vdw);
+  bool avail[3];
+  vector<unsigned int> buf;
+  unsigned int size;
+  double t, best[3];
+  int m, r, fastest;
+  Crossover c;
+
+  if ((s < 0) || (w < 0) || (reps < 1) || (maxSize < CAL_MIN_SIZE))
+  {
+    *Err << "TransferEngine: Invalid calibration parameters!\n";
+    return -1;
+  }
+
+  buf.resize(maxSize / 4 + 1);
+
+  // PIO must work, the others are optional
+
+  if (width == 4)
+    avail[XFER_PIO] = (vme->rl(image, addr, &buf[0], 4) == 0);
+  else if (width == 2)
+    avail[XFER_PIO] = (vme->rw(image, addr, (unsigned short *) &buf[0], 2) == 0);
+  else
+    avail[XFER_PIO] = (vme->rb(image, addr, (unsigned char *) &buf[0], 1) == 0);
+  avail[XFER_MAPPED] = (vme->copyFromWindow(image, addr, &buf[0], maxSize - maxSize % width, 0) == 0);
+  avail[XFER_DMA] = (vme->getDMABase() != 0);
+
+  if (!avail[XFER_PIO])
+  {
+    *Err << "TransferEngine: Can't read 0x" << hex << addr << dec << " by image " << image << "!\n";
+    return -2;
+  }
+
+  table[s][w].clear();
+
+  for (size = CAL_MIN_SIZE; size <= maxSize; size *= 2)
+  {
+    fastest = XFER_PIO;
+
+    for (m = XFER_PIO; m <= XFER_DMA; m++)
+    {
+      best[m] = 1e9;
+
+      if (!avail[m])
+        continue;
+
+      for (r = 0; r < reps; r++)
+      {
+        t = now();
+        if (run((Method) m, image, addr, &buf[0], size, vas, vdw, false) < 0)
+        {
+          avail[m] = false;
+          break;
+        }
+        t = now() - t;
+
+        if (t < best[m])
+          best[m] = t;
+      }
+
+      if ((avail[m]) && (best[m] < best[fastest]))
+        fastest = m;
+    }
+
+    if (table[s][w].empty() || (table[s][w].back().method != fastest))
+    {
+      c.minSize = table[s][w].empty() ? 0 : size;
+      c.method = (Method) fastest;
+      table[s][w].push_back(c);
+    }
+
+    if (size > maxSize / 2)
+      break;
+  }
+
+  count[XFER_PIO] = 0;
+  count[XFER_MAPPED] = 0;
+  count[XFER_DMA] = 0;
+
+  return table[s][w].size();
+}
+
+//----------------------------------------------------------------------------
+//  Write table to 'file'
+//     returns 0 on success, -1 on error
+//----------------------------------------------------------------------------
+int TransferEngine::save(const char *file)
+{
+  ofstream out(file);
+  unsigned int i;
+  int s, w;
+
+  if (!out)
+  {
+    *Err << "TransferEngine: Can't create " << file << "!\n";
+    return -1;
+  }
+
+  out << "# space  width  minSize  method\n";
+
+  for (s = 0; s < 3; s++)
+    for (w = 0; w < 4; w++)
+      for (i = 0; i < table[s][w].size(); i++)
+        out << spaceNames[s] << " " << widthNames[w] << " " << table[s][w][i].minSize << " " << methodName(table[s][w][i].method) << "\n";
+
+  out.close();
+
+  if (!out)
+  {
+    *Err << "TransferEngine: Can't write " << file << "!\n";
+    return -1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+//  Read table from 'file', replaces all entries
+//     returns number of entries read, < 0 on error
+//----------------------------------------------------------------------------
+int TransferEngine::load(const char *file)
+{
+  ifstream in(file);
+  string line, space, width, minSize, method;
+  vector<Crossover> old[3][4];
+  char *end;
+  unsigned long size;
+  int s, w, m, nr = 0, lineNr = 0;
+  size_t pos;
+
+  if (!in)
+  {
+    *Err << "TransferEngine: Can't open " << file << "!\n";
+    return -1;
+  }
+
+  for (s = 0; s < 3; s++)
+    for (w = 0; w < 4; w++)
+      old[s][w].swap(table[s][w]);
+
+  while (getline(in, line))
+  {
+    lineNr++;
+
+    if ((pos = line.find('#')) != string::npos)
+      line.erase(pos);
+
+    istringstream fields(line);
+    if (!(fields >> space))
+      continue;   // empty line
+
+    s = w = m = -1;
+    size = 0;
+    end = NULL;
+
+    if (fields >> width >> minSize >> method)
+    {
+      for (s = 2; s >= 0; s--)
+        if (space == spaceNames[s])
+          break;
+
+      for (w = 3; w >= 0; w--)
+        if (width == widthNames[w])
+          break;
+
+      m = (method == "pio") ? XFER_PIO : (method == "mapped") ? XFER_MAPPED : (method == "dma") ? XFER_DMA : -1;
+      size = strtoul(minSize.c_str(), &end, 0);
+    }
+
+    if ((s < 0) || (w < 0) || (m < 0) || (*end))
+    {
+      *Err << "TransferEngine: " << file << ":" << lineNr << ": Expected space, width, minSize, method!\n";
+
+      for (s = 0; s < 3; s++)
+        for (w = 0; w < 4; w++)
+          table[s][w].swap(old[s][w]);
+      return -2;
+    }
+
+    setMethod(spaces[s], widths[w], size, (Method) m);
+    nr++;
+  }
+
+  return nr;
+}
@@ -0,0 +1,106 @@
+/*
+ Definition of class TransferEngine
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMETRANSFER_H
+#define VMETRANSFER_H
+
+#include <vector>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  TransferEngine: transfers a block by the fastest of
+//
+//      XFER_PIO     block pread/pwrite through the image (rl/wl, ...)
+//      XFER_MAPPED  copy through the memory mapped image (copyFromWindow, ...)
+//      XFER_DMA     Universe DMA (readLarge/writeLarge)
+//
+//  The method is chosen by size from a table per address space and data
+//  width. Each entry gives the method used from 'minSize' bytes on:
+//
+//      # space  width  minSize  method
+//      A32      D32    0        mapped
+//      A32      D32    4096     dma
+//
+//  calibrate() measures reads of all methods over a size sweep and enters
+//  the crossover points, save()/load() keep them in a file. Without an
+//  entry small transfers use the mapped image and large ones DMA. DMA is
+//  used only if requestDMA() has been called, a mapped copy falls back to
+//  PIO if the address is not mapped.
+//----------------------------------------------------------------------------
+
+class TransferEngine
+{
+public:
+  enum Method
+  {
+    XFER_PIO, XFER_MAPPED, XFER_DMA
+  };
+
+private:
+  struct Crossover
+  {
+    unsigned int minSize;
+    Method method;
+  };
+
+  VMEBridge *vme;
+  std::vector<Crossover> table[3][4];   // [space][width], sorted by size
+  unsigned long long count[3];          // transfers per method
+
+  int run(Method method, int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw, bool write);
+
+  TransferEngine(const TransferEngine &);
+  TransferEngine &operator=(const TransferEngine &);
+
+public:
+  TransferEngine(VMEBridge &bridge);
+  virtual ~TransferEngine();
+
+  // returns number of bytes transferred (less with BLT until BERR), < 0 on error
+
+  int read(int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw);
+  int write(int image, unsigned int addr, const void *buf, unsigned int size, int vas, int vdw);
+  int transfer(int image, unsigned int addr, void *buf, unsigned int size, int vas, int vdw, bool write = false);
+
+  Method choose(unsigned int size, int vas, int vdw);
+  int setMethod(int vas, int vdw, unsigned int minSize, Method method);
+  void clear(void);
+
+  int calibrate(int image, unsigned int addr, unsigned int maxSize, int vas, int vdw, int reps = 100);
+  int save(const char *file);
+  int load(const char *file);
+
+  static const char *methodName(Method method);
+
+  unsigned long long getCount(Method method) const
+  {
+    return count[method];
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ Definition of template class VMEWindow
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEWINDOW_H
+#define VMEWINDOW_H
+
+#include <stdint.h>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  VMEWindow: a master image with address space and data width fixed at
+//  compile time. Accesses are inlined volatile loads/stores from the mapped
+//  image, the image is released when the window is destroyed. Windows can
+//  be moved (e.g. into containers) but not copied.
+//
+//  Offsets are relative to the VME base address given to the constructor
+//  and are not range checked. Use testBerr() to check for bus errors.
+//----------------------------------------------------------------------------
+
+template<int AddrSpace, int DataWidth>
+class VMEWindow
+{
+private:
+  static_assert((AddrSpace == A16) || (AddrSpace == A24) || (AddrSpace == A32),
+                "VMEWindow: address space must be A16, A24 or A32");
+  static_assert((DataWidth == D8) || (DataWidth == D16) || (DataWidth == D32),
+                "VMEWindow: data width must be D8, D16 or D32");
+
+  VMEBridge *vme;
+  int image;
+  unsigned int vmeBase, size;
+  uintptr_t base;
+
+public:
+  static const unsigned int width = (DataWidth == D32) ? 4 : (DataWidth == D16) ? 2 : 1;
+
+  VMEWindow() : vme(0), image(-1), vmeBase(0), size(0), base(0)
+  {
+  }
+
+  VMEWindow(VMEBridge &bridge, unsigned int vmeAddr, unsigned int length)
+    : vme(&bridge), image(-1), vmeBase(vmeAddr), size(length), base(0)
+  {
+    // images start 64k aligned, map the part below 'vmeAddr' as well
+
+    unsigned int align = vmeAddr & 0x0000FFFF;
+
+    image = vme->getImage(vmeAddr - align, length + align, AddrSpace, DataWidth, MASTER);
+    if (image < 0)
+    {
+      image = -1;
+      size = 0;
+      return;
+    }
+
+    base = vme->getPciBaseAddr(image);
+    if (!base)
+    {
+      release();
+      return;
+    }
+    base += align;
+  }
+
+  VMEWindow(const VMEWindow &) = delete;
+  VMEWindow &operator=(const VMEWindow &) = delete;
+
+  VMEWindow(VMEWindow &&other) noexcept
+    : vme(other.vme), image(other.image), vmeBase(other.vmeBase), size(other.size), base(other.base)
+  {
+    other.image = -1;
+    other.base = 0;
+    other.size = 0;
+  }
+
+  VMEWindow &operator=(VMEWindow &&other) noexcept
+  {
+    if (this != &other)
+    {
+      release();
+      vme = other.vme;
+      image = other.image;
+      vmeBase = other.vmeBase;
+      size = other.size;
+      base = other.base;
+      other.image = -1;
+      other.base = 0;
+      other.size = 0;
+    }
+    return *this;
+  }
+
+  ~VMEWindow()
+  {
+    release();
+  }
+
+  // give the master image back to the bridge
+
+  void release()
+  {
+    if (image >= 0)
+      vme->releaseImage(image);
+
+    image = -1;
+    base = 0;
+    size = 0;
+  }
+
+  template<typename T>
+  T read(unsigned int offset) const
+  {
+    static_assert(sizeof(T) <= width, "VMEWindow: access is wider than data width");
+    return *(volatile T *) (base + offset);
+  }
+
+  template<typename T>
+  void write(unsigned int offset, T data) const
+  {
+    static_assert(sizeof(T) <= width, "VMEWindow: access is wider than data width");
+    *(volatile T *) (base + offset) = data;
+  }
+
+  int testBerr() const
+  {
+    return vme->testBerr();
+  }
+
+  bool valid() const
+  {
+    return base != 0;
+  }
+
+  int getImage() const
+  {
+    return image;
+  }
+
+  unsigned int getVmeBase() const
+  {
+    return vmeBase;
+  }
+
+  unsigned int getSize() const
+  {
+    return size;
+  }
+
+  uintptr_t getPciBase() const
+  {
+    return base;
+  }
+};
+
+#endif
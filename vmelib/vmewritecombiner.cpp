@@ -0,0 +1,190 @@
+/*
+ Implementation of class WriteCombiner
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "vmewritecombiner.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------
+//  Constructor
+//----------------------------------------------------------------------------
+WriteCombiner::WriteCombiner(VMEBridge &bridge, int img, int w, unsigned int size, int as, int dw, unsigned int threshold)
+{
+  vme = &bridge;
+  image = img;
+  width = ((w == 1) || (w == 2)) ? w : 4;
+  vas = as;
+  vdw = dw;
+  dmaThreshold = threshold;
+
+  bufSize = size - size % width;
+  if (bufSize < (unsigned int) width)
+    bufSize = width;
+  buf.resize((bufSize + 3) / 4);
+
+  start = 0;
+  len = 0;
+  writes = 0;
+  flushes = 0;
+  dmaFlushes = 0;
+
+  Err = &cerr;
+}
+
+//----------------------------------------------------------------------------
+//  Destructor, writes pending data
+//----------------------------------------------------------------------------
+WriteCombiner::~WriteCombiner()
+{
+  flush();
+}
+
+//----------------------------------------------------------------------------
+//  Append 'size' bytes for 'addr', flush if not consecutive or full.
+//  Data of a failed flush are dropped.
+//----------------------------------------------------------------------------
+int WriteCombiner::append(unsigned int addr, const void *data, unsigned int size)
+{
+  const unsigned char *src = (const unsigned char *) data;
+  unsigned int n;
+  int ret = 0;
+
+  while (size)
+  {
+    if (len && ((addr != start + len) || (len == bufSize)))
+      if (flush() != 0)
+        ret = -1;    // report error, but keep this write
+
+    if (!len)
+      start = addr;
+
+    n = bufSize - len;
+    if (n > size)
+      n = size;
+
+    memcpy((unsigned char *) &buf[0] + len, src, n);
+    len += n;
+    addr += n;
+    src += n;
+    size -= n;
+  }
+
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+//  Write 'value' to 'addr' / 'size' bytes of 'data' starting at 'addr'
+//----------------------------------------------------------------------------
+int WriteCombiner::write(unsigned int addr, unsigned int value)
+{
+  unsigned short w = value;
+  unsigned char b = value;
+
+  if (addr % width)
+  {
+    *Err << "WriteCombiner: Write at 0x" << hex << addr << dec << " is not aligned to width!\n";
+    return -1;
+  }
+
+  writes++;
+
+  if (width == 4)
+    return append(addr, &value, 4);
+  if (width == 2)
+    return append(addr, &w, 2);
+  return append(addr, &b, 1);
+}
+
+int WriteCombiner::write(unsigned int addr, const void *data, unsigned int size)
+{
+  if ((addr % width) || (size % width))
+  {
+    *Err << "WriteCombiner: Write at 0x" << hex << addr << dec << " is not aligned to width!\n";
+    return -1;
+  }
+
+  writes += size / width;
+
+  return append(addr, data, size);
+}
+
+//----------------------------------------------------------------------------
+//  Write pending data to the bus
+//----------------------------------------------------------------------------
+int WriteCombiner::flush(void)
+{
+  uintptr_t dmaBase;
+  unsigned int offset;
+  int ret;
+
+  if (!len)
+    return 0;
+
+  flushes++;
+
+  // DMA: data are placed at (start & 7) in the buffer, see DMAwrite
+
+  dmaBase = dmaThreshold ? vme->getDMABase() : 0;
+  offset = start & 0x7;
+
+  if ((dmaBase) && (len >= dmaThreshold) && (offset + len <= vme->getDMABufSize()))
+  {
+    memcpy((void *) (dmaBase + offset), &buf[0], len);
+    ret = (vme->DMAwrite(start, len, vas, vdw, 0) < 0) ? -1 : 0;
+    dmaFlushes++;
+  }
+  else if (width == 4)
+    ret = vme->wl(image, start, &buf[0], len);
+  else if (width == 2)
+    ret = vme->ww(image, start, (unsigned short *) &buf[0], len);
+  else
+    ret = vme->wb(image, start, (unsigned char *) &buf[0], len);
+
+  len = 0;
+
+  return (ret == 0) ? 0 : -1;
+}
+
+//----------------------------------------------------------------------------
+//  Read of the combiner's width after flushing pending writes
+//----------------------------------------------------------------------------
+int WriteCombiner::read(unsigned int addr, unsigned int *value)
+{
+  unsigned short w;
+  unsigned char b;
+  int ret;
+
+  if (flush() != 0)
+    return -1;
+
+  if (width == 4)
+    return vme->rl(image, addr, value);
+
+  if (width == 2)
+  {
+    ret = vme->rw(image, addr, &w);
+    *value = w;
+    return ret;
+  }
+
+  ret = vme->rb(image, addr, &b);
+  *value = b;
+  return ret;
+}
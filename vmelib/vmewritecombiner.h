@@ -0,0 +1,108 @@
+/*
+ Definition of class WriteCombiner
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VMEWRITECOMBINER_H
+#define VMEWRITECOMBINER_H
+
+#include <vector>
+
+#include "vmelib.h"
+
+//----------------------------------------------------------------------------
+//  WriteCombiner: collects writes to consecutive addresses of one image
+//  and writes them as one block.
+//
+//  A write to the address following the pending ones is appended, any
+//  other write flushes the pending data first. The data are written by
+//  one block pwrite, or by DMAwrite() if at least 'dmaThreshold' bytes are
+//  pending (0: never, requestDMA() must have been called). Up to 'bufSize'
+//  bytes are collected.
+//
+//  Pending writes are not visible on the bus: flush() (or fence()) writes
+//  them, the read functions of the combiner flush before reading.
+//----------------------------------------------------------------------------
+
+class WriteCombiner
+{
+private:
+  VMEBridge *vme;
+  int image, width, vas, vdw;
+  unsigned int bufSize, dmaThreshold;
+
+  std::vector<unsigned int> buf;
+  unsigned int start, len;
+
+  unsigned long long writes, flushes, dmaFlushes;
+
+  int append(unsigned int addr, const void *data, unsigned int size);
+
+  WriteCombiner(const WriteCombiner &);
+  WriteCombiner &operator=(const WriteCombiner &);
+
+public:
+  WriteCombiner(VMEBridge &bridge, int image, int width = 4, unsigned int bufSize = 0x10000, int vas = A32, int vdw = D32, unsigned int dmaThreshold = 0);
+  virtual ~WriteCombiner();
+
+  // writes of the combiner's width, return 0 or -1 if a flush failed
+
+  int write(unsigned int addr, unsigned int value);
+  int write(unsigned int addr, const void *data, unsigned int size);
+
+  int flush(void);
+  int fence(void)
+  {
+    return flush();
+  }
+
+  // reads see all previous writes
+
+  int read(unsigned int addr, unsigned int *value);
+
+  unsigned int pending(void) const
+  {
+    return len;
+  }
+
+  // statistics
+
+  unsigned long long getWrites(void) const
+  {
+    return writes;
+  }
+
+  unsigned long long getFlushes(void) const
+  {
+    return flushes;
+  }
+
+  unsigned long long getDMAFlushes(void) const
+  {
+    return dmaFlushes;
+  }
+
+protected:
+  std::ostream *Err;
+
+public:
+  virtual void setErrorlog(std::ostream *log)
+  {
+    Err = log;
+  }
+};
+
+#endif